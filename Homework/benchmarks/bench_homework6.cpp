@@ -0,0 +1,105 @@
+/**
+ * Copyright 2021 zarembmj@miamioh.edu
+ *
+ * Microbenchmarks for the hot paths of the homework6 web server:
+ * decoding URLs, HTTP-streaming files via http::operator<<, and
+ * starting child processes via ChildProcess::forkNexec.  This file is
+ * linked with the homework6 sources built with -DBENCHMARK (see
+ * run_benchmarks.sh).
+ */
+
+#include <benchmark/benchmark.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include "HTTPFile.h"
+#include "ChildProcess.h"
+
+// Defined in homework6/main.cpp
+std::string url_decode(std::string url);
+
+namespace {
+
+/** A stream buffer that discards everything written to it.  The data
+    is copied into a small buffer (just as writing into a socket copies
+    it into the kernel) so that the pages of mapped files are read.
+*/
+class NullBuf : public std::streambuf {
+protected:
+    std::streamsize xsputn(const char* data, std::streamsize n) override {
+        for (std::streamsize i = 0; (i < n); i += sizeof(buf)) {
+            std::memcpy(buf, data + i, std::min<std::streamsize>(sizeof(buf),
+                                                                 n - i));
+            benchmark::ClobberMemory();
+        }
+        return n;
+    }
+    int_type overflow(int_type c) override { return c; }
+
+private:
+    char buf[64 * 1024];
+};
+
+// Helper method to create a temporary file with a given size.
+std::string makeFile(const size_t size) {
+    const std::string path = "/tmp/bench_hw6_" + std::to_string(getpid()) +
+        "_" + std::to_string(size) + ".txt";
+    std::ofstream os(path, std::ios::binary);
+    const std::string line = "The quick brown fox jumps over the lazy dog\n";
+    for (size_t written = 0; (written < size); written += line.size()) {
+        os.write(line.data(), std::min(line.size(), size - written));
+    }
+    return path;
+}
+
+}  // namespace
+
+// Decode a URL with an encoded entity every few characters.  The
+// argument is the length of the URL.
+static void BM_UrlDecode(benchmark::State& state) {
+    std::string url = "/cgi-bin/exec?cmd=";
+    while (url.size() < size_t(state.range(0))) {
+        url += "ls+-l%20%2Ftmp%2F";
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(url_decode(url));
+    }
+    state.SetBytesProcessed(state.iterations() * url.size());
+}
+BENCHMARK(BM_UrlDecode)->Arg(64)->Arg(1024);
+
+// Stream a file (headers and contents) to an output stream.  Small
+// files come from the FileCache; large ones are memory-mapped.
+static void BM_HttpFileStream(benchmark::State& state) {
+    const std::string path = makeFile(state.range(0));
+    NullBuf sink;
+    std::ostream os(&sink);
+    for (auto _ : state) {
+        os << http::file(path);
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+    unlink(path.c_str());
+}
+BENCHMARK(BM_HttpFileStream)->Arg(4 << 10)->Arg(256 << 10)->Arg(16 << 20);
+
+// Start a child process ("true") and wait for it.  The argument is
+// the launcher: 0 for fork()/exec() and 1 for posix_spawn().
+static void BM_ForkNexec(benchmark::State& state) {
+    const auto launcher = (state.range(0) == 0 ? ChildProcess::Launcher::Fork :
+                           ChildProcess::Launcher::Spawn);
+    const StrVec argList = {"true"};
+    for (auto _ : state) {
+        ChildProcess child(launcher);
+        child.forkNexec(argList);
+        benchmark::DoNotOptimize(child.wait());
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetLabel(state.range(0) == 0 ? "fork" : "spawn");
+}
+BENCHMARK(BM_ForkNexec)->Arg(0)->Arg(1)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,47 @@
+/**
+ * Copyright 2021 zarembmj@miamioh.edu
+ *
+ * Microbenchmark for the word counting in homework7: splitting text
+ * into lowercase words via WordTokenizer::tokenize.  The tokenizer is
+ * header-only, so it is used directly from homework7.
+ */
+
+#include <benchmark/benchmark.h>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include "WordTokenizer.h"
+
+namespace {
+
+// Helper method to generate some text with words, punctuation and
+// mixed case, roughly like the text files processed by homework7.
+std::string makeText(const size_t size) {
+    const std::string line = "It was the best of times, it was the WORST "
+        "of times; it was the age of wisdom... \"Foolishness\"!\n";
+    std::string text;
+    while (text.size() < size) {
+        text += line;
+    }
+    return text;
+}
+
+}  // namespace
+
+// Split text into words.  The argument is the size of the text.
+static void BM_Tokenize(benchmark::State& state) {
+    const std::string text = makeText(state.range(0));
+    size_t words = 0;
+    for (auto _ : state) {
+        std::istringstream is(text);
+        WordTokenizer::tokenize(is, [&words](const std::string_view word) {
+            words++;
+            benchmark::DoNotOptimize(word.data());
+        });
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+    state.SetItemsProcessed(words);
+}
+BENCHMARK(BM_Tokenize)->Arg(4 << 10)->Arg(1 << 20);
+
+BENCHMARK_MAIN();
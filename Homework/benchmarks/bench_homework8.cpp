@@ -0,0 +1,105 @@
+/**
+ * Copyright 2021 zarembmj@miamioh.edu
+ *
+ * Microbenchmarks for the hot paths of the homework8/9 stock server:
+ * parsing (pipelined) requests read by clientThread(), processing a
+ * request, and updating the balance of stocks with several threads
+ * contending for the same stock or working on their own stocks.  This
+ * file is linked with homework8/zarembmj_homework9.cpp built with
+ * -DBENCHMARK (see run_benchmarks.sh).
+ */
+
+#include <benchmark/benchmark.h>
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include "Stock.h"
+#include "StockTable.h"
+#include "RequestParser.h"
+
+// Defined in homework8/zarembmj_homework9.cpp
+namespace sm {
+    extern StockTable stockMap;
+}
+std::string processRequest(const RequestParser& req);
+std::string updateBalance(const std::string_view trans, Stock& stock,
+                          const unsigned trades,
+                          const std::chrono::milliseconds timeout);
+
+namespace {
+
+// A typical request sent by the stock client on a persistent connection.
+const std::string Request =
+    "GET /trans=buy&stock=MSFT%2DB&amount=5 HTTP/1.1\r\n"
+    "Host: localhost:8080\r\n"
+    "Connection: keep-alive\r\n"
+    "User-Agent: stock_client\r\n"
+    "\r\n";
+
+}  // namespace
+
+// Parse a batch of pipelined requests from a stream, just as
+// clientThread() does.  The argument is the number of requests.
+static void BM_RequestParse(benchmark::State& state) {
+    std::string input;
+    for (int i = 0; (i < state.range(0)); i++) {
+        input += Request;
+    }
+    RequestParser req;
+    for (auto _ : state) {
+        std::istringstream is(input);
+        while (req.read(is)) {
+            benchmark::DoNotOptimize(req.amount);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetBytesProcessed(state.iterations() * input.size());
+}
+BENCHMARK(BM_RequestParse)->Arg(1)->Arg(64);
+
+// Process a status request for an existing stock, i.e., the work done
+// per request without the network I/O.
+static void BM_ProcessRequest(benchmark::State& state) {
+    sm::stockMap.reset();
+    sm::stockMap.current()->insert("MSFT", 1000);
+    RequestParser req;
+    std::istringstream is("GET /trans=status&stock=MSFT HTTP/1.1\r\n\r\n");
+    req.read(is);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(processRequest(req));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ProcessRequest);
+
+// Alternately sell and buy stocks.  The argument is 0 if all the
+// threads share 1 stock (contention) and 1 if each thread has its own.
+static void BM_UpdateBalance(benchmark::State& state) {
+    if (state.thread_index() == 0) {
+        sm::stockMap.reset();
+        for (int i = 0; (i < state.threads()); i++) {
+            sm::stockMap.current()->insert("S" + std::to_string(i), 1000);
+        }
+    }
+    const std::string name = "S" + std::to_string(state.range(0) == 0 ? 0 :
+                                                  state.thread_index());
+    Stock* stock = nullptr;
+    for (auto _ : state) {
+        // The threads start the loop together, i.e., once thread 0
+        // has set up the stocks.  So look up the stock only here.
+        if (stock == nullptr) {
+            stock = sm::stockMap.current()->find(name);
+        }
+        benchmark::DoNotOptimize(updateBalance("sell", *stock, 5,
+                                               std::chrono::milliseconds(0)));
+        benchmark::DoNotOptimize(updateBalance("buy", *stock, 5,
+                                               std::chrono::milliseconds(0)));
+    }
+    state.SetItemsProcessed(2 * state.iterations());
+    state.SetLabel(state.range(0) == 0 ? "shared" : "per-thread");
+}
+BENCHMARK(BM_UpdateBalance)->Arg(0)->Arg(1)->Threads(1)->Threads(4)->
+    Threads(8)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,80 @@
+#!/usr/bin/env python3
+"""
+Compare the JSON results of 2 runs of run_benchmarks.sh and report
+the change in throughput of each benchmark.  The median of the
+repetitions is compared.  The throughput is items_per_second if the
+benchmark reports it, bytes_per_second otherwise (or the inverse of
+the real time).  The script exits with status 1 if any benchmark is
+slower than the baseline by more than the threshold, so that it can
+be used to gate changes on throughput regressions.
+
+Usage: compare_benchmarks.py [--threshold PCT] BASELINE CURRENT
+
+BASELINE and CURRENT are directories with the JSON files (or 2 JSON
+files).
+
+Copyright 2021 zarembmj@miamioh.edu
+"""
+
+import argparse
+import json
+import os
+import sys
+
+
+def load(path):
+    """Return a dict of benchmark name -> throughput from JSON files."""
+    files = [path]
+    if os.path.isdir(path):
+        files = [os.path.join(path, name) for name in sorted(os.listdir(path))
+                 if name.endswith('.json')]
+    results = {}
+    for name in files:
+        with open(name) as f:
+            for bench in json.load(f)['benchmarks']:
+                if bench.get('aggregate_name', 'median') != 'median':
+                    continue
+                key = bench.get('run_name', bench['name'])
+                if 'items_per_second' in bench:
+                    results[key] = (bench['items_per_second'], 'items/s')
+                elif 'bytes_per_second' in bench:
+                    results[key] = (bench['bytes_per_second'], 'bytes/s')
+                else:
+                    results[key] = (1.0 / bench['real_time'], '1/time')
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n\n')[0])
+    parser.add_argument('--threshold', type=float, default=10.0,
+                        help='Largest allowed slow-down in percent')
+    parser.add_argument('baseline')
+    parser.add_argument('current')
+    args = parser.parse_args()
+
+    baseline, current = load(args.baseline), load(args.current)
+    regressions = 0
+    print('%-50s %14s %14s %8s' % ('Benchmark', 'Baseline', 'Current',
+                                   'Change'))
+    for name in sorted(baseline.keys() | current.keys()):
+        if name not in baseline or name not in current:
+            print('%-50s %s' % (name, 'only in ' +
+                                ('baseline' if name in baseline else
+                                 'current')))
+            continue
+        (old, unit), (new, _) = baseline[name], current[name]
+        change = 100.0 * (new - old) / old
+        status = ''
+        if change < -args.threshold:
+            status = '  REGRESSION'
+            regressions += 1
+        print('%-50s %14.4g %14.4g %+7.1f%% %s%s' % (name, old, new, change,
+                                                     unit, status))
+    if regressions:
+        print('%d benchmark(s) regressed by more than %g%%' %
+              (regressions, args.threshold))
+    return 1 if regressions else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
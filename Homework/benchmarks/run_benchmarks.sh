@@ -0,0 +1,46 @@
+#!/bin/bash
+
+# Build and run the microbenchmarks for the homework servers using
+# Google Benchmark (libbenchmark-dev).  The results are written as
+# JSON, 1 file per benchmark program, to the given directory (default:
+# results).  Each benchmark is repeated so that the median is stable
+# enough to be compared against a baseline, e.g.:
+#
+#   ./run_benchmarks.sh baseline          # On the old code
+#   ./run_benchmarks.sh results           # On the new code
+#   ./compare_benchmarks.py baseline results
+#
+# Extra arguments are passed on to the benchmarks, for example,
+# --benchmark_filter=UpdateBalance to run only some of them.  The
+# programs are built in build/.  It, results/, and baseline/ are
+# ignored by git (see .gitignore).
+
+set -e
+
+cd "$(dirname "$0")"
+OUT=${1:-results}
+shift || true
+BUILD=build
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:-"-std=c++17 -O2 -DNDEBUG"}
+LIBS="-lbenchmark -lpthread"
+
+mkdir -p "$BUILD" "$OUT"
+
+# The homework files are compiled with -DBENCHMARK so that their
+# main() is left out in favor of the one from the benchmark library.
+$CXX $CXXFLAGS -DBENCHMARK -I../homework6 -o "$BUILD/bench_homework6" \
+    bench_homework6.cpp ../homework6/main.cpp ../homework6/HTTPFile.cpp \
+    ../homework6/FileCache.cpp ../homework6/ChildProcess.cpp $LIBS
+$CXX $CXXFLAGS -I../homework7 -o "$BUILD/bench_homework7" \
+    bench_homework7.cpp $LIBS
+$CXX $CXXFLAGS -DBENCHMARK -I../homework8 -o "$BUILD/bench_homework8" \
+    bench_homework8.cpp ../homework8/zarembmj_homework9.cpp $LIBS
+
+for bench in bench_homework6 bench_homework7 bench_homework8; do
+    "$BUILD/$bench" --benchmark_repetitions=5 \
+        --benchmark_report_aggregates_only=true \
+        --benchmark_out_format=json --benchmark_out="$OUT/$bench.json" "$@"
+done
+
+# End of script
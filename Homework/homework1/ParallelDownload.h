@@ -0,0 +1,180 @@
+#ifndef PARALLEL_DOWNLOAD_H
+#define PARALLEL_DOWNLOAD_H
+
+/**
+ * A stream buffer that downloads a large file over several concurrent
+ * connections.  The file is split into pieces that are downloaded (via
+ * HTTP Range requests) by a few threads, while the pieces that have
+ * arrived are read in order through the stream buffer.  Hence the
+ * download is not limited by the bandwidth of a single TCP connection
+ * and the data is processed while the rest of it is being downloaded.
+ * Only a window of pieces is kept in memory at a time, so the memory
+ * used does not depend on the size of the file.
+ *
+ * Copyright 2021 zarembmj@miamioh.edu
+ */
+
+#include <algorithm>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+#include "HttpClient.h"
+
+// ------------------------------------------------------------------- //
+// ****  NOTE: NEVER NEVER put "using namespace" IN A HEADER FILE  *** //
+// ------------------------------------------------------------------- //
+
+/**
+ * A stream buffer that reads a file as a sequence of pieces that are
+ * downloaded in parallel.  Use it via a std::istream from 1 thread.
+ */
+class ParallelDownload : public std::streambuf {
+public:
+    /** The size of each piece downloaded with 1 Range request. */
+    static constexpr size_t PieceSize = 1024 * 1024;
+
+    /** The constructor starts the threads that download the pieces.
+
+        \param[in] client The client used for the requests.
+
+        \param[in] host The host name of the server.
+
+        \param[in] port The port number of the server.
+
+        \param[in] path The path of the file on the server.
+
+        \param[in] length The length of the file (from a HEAD request).
+
+        \param[in] etag The ETag of the file (if any).  The pieces are
+        requested with "If-Range" so that the download fails, instead
+        of mixing pieces of different versions, if the file changes.
+
+        \param[in] connections The number of pieces downloaded at the
+        same time.
+    */
+    ParallelDownload(HttpClient& client, const std::string& host,
+                     const std::string& port, const std::string& path,
+                     const size_t length, const std::string& etag,
+                     const size_t connections) :
+        client(client), host(host), port(port), path(path), length(length),
+        etag(etag), numPieces((length + PieceSize - 1) / PieceSize),
+        window(2 * std::max<size_t>(1, connections)) {
+        setg(nullptr, nullptr, nullptr);
+        for (size_t i = 0; (i < std::max<size_t>(1, connections)); i++) {
+            threads.emplace_back([this] { download(); });
+        }
+    }
+
+    /** The destructor stops (and waits for) the download threads. */
+    ~ParallelDownload() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        changed.notify_all();
+        for (auto& thr : threads) {
+            thr.join();
+        }
+    }
+
+    /** True if all the pieces read so far were downloaded correctly.
+        If a piece fails, the stream ends at that piece, so the data
+        read must not be used unless this method returns true.
+    */
+    bool ok() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return !failed;
+    }
+
+protected:
+    int_type underflow() override {
+        if (gptr() < egptr()) {
+            return traits_type::to_int_type(*gptr());
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        current.clear();
+        if (nextRead == numPieces) {
+            return traits_type::eof();
+        }
+        changed.wait(lock, [this] { return failed || ready.count(nextRead); });
+        if (failed) {
+            return traits_type::eof();
+        }
+        current = std::move(ready[nextRead]);
+        ready.erase(nextRead++);
+        lock.unlock();
+        changed.notify_all();  // Another piece may be downloaded now.
+        setg(&current[0], &current[0], &current[0] + current.size());
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+    // The method run by each download thread.  Each thread repeatedly
+    // downloads the next piece that fits in the window.
+    void download() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            changed.wait(lock, [this] {
+                return stop || failed || (nextPiece == numPieces) ||
+                    (nextPiece < nextRead + window);
+            });
+            if (stop || failed || (nextPiece == numPieces)) {
+                return;
+            }
+            const size_t piece = nextPiece++;
+            lock.unlock();
+            std::string data;
+            const bool good = fetch(piece, data);
+            lock.lock();
+            failed = failed || !good;
+            ready.emplace(piece, std::move(data));
+            changed.notify_all();
+        }
+    }
+
+    // Download a piece of the file.  Returns false on errors.
+    bool fetch(const size_t piece, std::string& data) {
+        const size_t start = piece * PieceSize;
+        const size_t size  = std::min(PieceSize, length - start);
+        HttpClient::Headers headers = {{"Range", "bytes=" +
+                                        std::to_string(start) + "-" +
+                                        std::to_string(start + size - 1)}};
+        if (!etag.empty()) {
+            headers.emplace_back("If-Range", etag);
+        }
+        const auto resp = client.request("GET", host, port, path, headers);
+        if (resp->status != 206) {
+            return false;  // The file changed or ranges don't work.
+        }
+        data.resize(size);
+        resp->body().read(&data[0], size);
+        return (resp->body().gcount() == static_cast<std::streamsize>(size));
+    }
+
+    // The client and the file to be downloaded.
+    HttpClient& client;
+    const std::string host, port, path;
+    const size_t length;
+    const std::string etag;
+    // The number of pieces and the most pieces in memory at a time.
+    const size_t numPieces, window;
+    // The threads that download the pieces.
+    std::vector<std::thread> threads;
+    // The piece being read.
+    std::string current;
+    // The mutex and condition that protect/signal the fields below.
+    mutable std::mutex mutex;
+    std::condition_variable changed;
+    // The pieces downloaded but not read yet.
+    std::map<size_t, std::string> ready;
+    // The next piece to be downloaded and to be read.
+    size_t nextPiece = 0, nextRead = 0;
+    // Flags to stop the downloads.
+    bool stop = false, failed = false;
+};
+
+#endif
@@ -0,0 +1,421 @@
+#ifndef STREAM_STATS_H
+#define STREAM_STATS_H
+
+/**
+ * Classes to compute statistics of a stream of integers in a single
+ * pass, i.e., while the data is being downloaded.  The integers are
+ * parsed directly from large blocks of data (without the locale and
+ * per-value overheads of operator>>).  Only the statistics that have
+ * been asked for are computed.  The quantiles are approximated with a
+ * t-digest, which uses a small, fixed amount of memory regardless of
+ * the number of values.
+ *
+ * Copyright 2021 zarembmj@miamioh.edu
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+// ------------------------------------------------------------------- //
+// ****  NOTE: NEVER NEVER put "using namespace" IN A HEADER FILE  *** //
+// ------------------------------------------------------------------- //
+
+/**
+ * A class with a static method to parse whitespace-separated integers
+ * from a stream.
+ */
+class IntParser {
+public:
+    /** The number of bytes read from the stream at a time. */
+    static constexpr size_t BlockSize = 64 * 1024;
+
+    /** Parse all the integers in a stream.  Parsing stops at the first
+        token that is not an integer, just like a loop with
+        operator>>.  The digits at the start of such a token (e.g.,
+        "12" in "12abc") are still returned as an integer.
+
+        \param[in,out] is The input stream to be read.
+
+        \param[in] handler The method to be called with each integer
+        (as a long long).
+
+        \return This method returns true if the whole stream consisted
+        of integers.
+    */
+    template <typename Handler>
+    static bool parse(std::istream& is, Handler&& handler) {
+        char buf[BlockSize];
+        enum { Space, Sign, Digits } state = Space;
+        bool negative = false;
+        uint64_t value = 0;
+        for (;;) {
+            is.read(buf, sizeof(buf));
+            if (is.gcount() == 0) {
+                break;
+            }
+            for (const char *p = buf, *end = buf + is.gcount(); (p < end); p++) {
+                const char c = *p;
+                const unsigned digit = static_cast<unsigned char>(c) - '0';
+                if (digit < 10) {
+                    if (__builtin_mul_overflow(value, 10, &value) ||
+                        __builtin_add_overflow(value, digit, &value)) {
+                        return false;  // Too big for a long long
+                    }
+                    state = Digits;
+                } else if ((c == ' ') || ((c >= '\t') && (c <= '\r'))) {
+                    if ((state == Digits) && !emit(handler, negative, value)) {
+                        return false;
+                    }
+                    if (state == Sign) {
+                        return false;  // A sign without digits
+                    }
+                    state = Space;
+                    negative = false;
+                    value = 0;
+                } else if (((c == '-') || (c == '+')) && (state == Space)) {
+                    negative = (c == '-');
+                    state = Sign;
+                } else {
+                    if (state == Digits) {
+                        emit(handler, negative, value);
+                    }
+                    return false;
+                }
+            }
+        }
+        return (state == Space) || ((state == Digits) &&
+                                    emit(handler, negative, value));
+    }
+
+private:
+    // Helper method to pass a parsed integer to the handler.  Returns
+    // false if the value does not fit in a long long.
+    template <typename Handler>
+    static bool emit(Handler& handler, const bool negative,
+                     const uint64_t value) {
+        const uint64_t limit = uint64_t(std::numeric_limits<long long>::max()) +
+            (negative ? 1 : 0);
+        if (value > limit) {
+            return false;
+        }
+        handler(negative ? static_cast<long long>(0 - value) :
+                static_cast<long long>(value));
+        return true;
+    }
+};
+
+/**
+ * A (merging) t-digest that estimates the quantiles of a stream of
+ * values.  Values are buffered and periodically merged into a sorted
+ * list of centroids (a mean and a weight each).  Centroids near the
+ * extremes (quantiles near 0 or 1) are kept small, so that the tails
+ * are estimated accurately.  This class is not MT-safe.
+ */
+class TDigest {
+public:
+    /** The constructor.
+
+        \param[in] compression Controls the number of centroids (about
+        compression / 2) and hence the accuracy.
+    */
+    explicit TDigest(const double compression = 200) :
+        compression(compression) {
+        buffer.reserve(BufferFactor * compression);
+    }
+
+    /** Add a value to the digest.
+
+        \param[in] value The value to be added.
+    */
+    void add(const double value) {
+        buffer.push_back(value);
+        if (buffer.size() >= BufferFactor * compression) {
+            flush();
+        }
+    }
+
+    /** Estimate a quantile of the values added so far.
+
+        \param[in] q The quantile, in the range 0 to 1.
+
+        \return The estimated quantile (NaN if there are no values).
+    */
+    double quantile(const double q) {
+        flush();
+        if (centroids.empty()) {
+            return std::nan("");
+        }
+        const double index = std::min(std::max(q, 0.0), 1.0) * totalWeight;
+        const Centroid& first = centroids.front();
+        if (index < first.weight / 2) {
+            return minValue + (first.mean - minValue) * index /
+                (first.weight / 2);
+        }
+        // Interpolate between the centers of neighboring centroids.
+        double soFar = 0;
+        for (size_t i = 0; (i + 1 < centroids.size()); i++) {
+            const Centroid &left = centroids[i], &right = centroids[i + 1];
+            const double leftCenter  = soFar + left.weight / 2;
+            const double rightCenter = soFar + left.weight + right.weight / 2;
+            if (index <= rightCenter) {
+                return left.mean + (right.mean - left.mean) *
+                    (index - leftCenter) / (rightCenter - leftCenter);
+            }
+            soFar += left.weight;
+        }
+        const Centroid& last = centroids.back();
+        const double lastCenter = totalWeight - last.weight / 2;
+        return last.mean + (maxValue - last.mean) *
+            std::min(1.0, (index - lastCenter) / (last.weight / 2));
+    }
+
+private:
+    /** A cluster of nearby values. */
+    struct Centroid {
+        double mean;
+        double weight;
+    };
+
+    // The buffer holds this many times compression values.
+    static constexpr size_t BufferFactor = 8;
+
+    // The scale function (k1) that limits the size of centroids, and
+    // its inverse.
+    double scale(const double q) const {
+        return compression / (2 * M_PI) * std::asin(2 * q - 1);
+    }
+
+    double inverseScale(const double k) const {
+        return (k >= compression / 4) ? 1 :
+            (std::sin(k * 2 * M_PI / compression) + 1) / 2;
+    }
+
+    // Merge the buffered values into the centroids.
+    void flush() {
+        if (buffer.empty()) {
+            return;
+        }
+        std::sort(buffer.begin(), buffer.end());
+        minValue = std::min(minValue, buffer.front());
+        maxValue = std::max(maxValue, buffer.back());
+        // Merge the (sorted) centroids and buffered values.
+        std::vector<Centroid> items;
+        items.reserve(centroids.size() + buffer.size());
+        auto next = centroids.begin();
+        for (const double value : buffer) {
+            for (; (next != centroids.end()) && (next->mean < value); next++) {
+                items.push_back(*next);
+            }
+            items.push_back(Centroid{value, 1});
+        }
+        items.insert(items.end(), next, centroids.end());
+        totalWeight += buffer.size();
+        buffer.clear();
+        // Combine neighboring items as long as a centroid stays within
+        // 1 unit of the scale function.
+        centroids.clear();
+        Centroid current = items.front();
+        double soFar = 0;
+        double limit = totalWeight * inverseScale(scale(0) + 1);
+        for (size_t i = 1; (i < items.size()); i++) {
+            const double weight = current.weight + items[i].weight;
+            if (soFar + weight <= limit) {
+                current.mean += (items[i].mean - current.mean) *
+                    items[i].weight / weight;
+                current.weight = weight;
+            } else {
+                soFar += current.weight;
+                centroids.push_back(current);
+                limit = totalWeight *
+                    inverseScale(scale(soFar / totalWeight) + 1);
+                current = items[i];
+            }
+        }
+        centroids.push_back(current);
+    }
+
+    // The parameter controlling the accuracy.
+    const double compression;
+    // The centroids sorted by their means.
+    std::vector<Centroid> centroids;
+    // The values not merged into the centroids yet.
+    std::vector<double> buffer;
+    // The total weight of the centroids and the smallest/largest value.
+    double totalWeight = 0;
+    double minValue = std::numeric_limits<double>::infinity();
+    double maxValue = -std::numeric_limits<double>::infinity();
+};
+
+/**
+ * A configurable set of statistics of a stream of integers, computed
+ * in a single pass.  The largest values are always computed.  This
+ * class is not MT-safe; use 1 object per stream.
+ */
+class StreamStats {
+public:
+    /** The statistics to be computed. */
+    struct Config {
+        bool count = false, min = false, mean = false, variance = false;
+        size_t topK = 2;                 // The number of largest values
+        std::vector<double> quantiles;   // Each one in the range 0 to 1
+
+        /** Create a configuration from a comma-separated list of
+            statistics, e.g., "count,min,mean,variance,top=5,p50,p99.9".
+            Quantiles are given as percentiles ("p" followed by a
+            number from 0 to 100).
+
+            \param[in] list The list of statistics.
+
+            \return The configuration.  Unknown names cause an
+            exception to be thrown.
+        */
+        static Config parse(const std::string& list) {
+            Config config;
+            std::istringstream is(list);
+            for (std::string name; std::getline(is, name, ',');) {
+                if (name == "count") {
+                    config.count = true;
+                } else if (name == "min") {
+                    config.min = true;
+                } else if (name == "mean") {
+                    config.mean = true;
+                } else if (name == "variance") {
+                    config.variance = true;
+                } else if (name.find("top=") == 0) {
+                    config.topK = std::max<size_t>(2, std::stoul(name.substr(4)));
+                } else if ((name.size() > 1) && (name[0] == 'p') &&
+                           (std::stod(name.substr(1)) >= 0) &&
+                           (std::stod(name.substr(1)) <= 100)) {
+                    config.quantiles.push_back(std::stod(name.substr(1)) / 100);
+                } else if (!name.empty()) {
+                    throw std::invalid_argument("Unknown statistic: " + name);
+                }
+            }
+            return config;
+        }
+    };
+
+    /** The constructor.
+
+        \param[in] config The statistics to be computed.
+    */
+    explicit StreamStats(const Config& config) : config(config) {}
+
+    /** Add a value to the statistics.
+
+        \param[in] value The value to be added.
+    */
+    void add(const long long value) {
+        numValues++;
+        minValue = std::min(minValue, value);
+        if ((top.size() < config.topK) || (value > top.back())) {
+            addTop(value);
+        }
+        if (config.mean || config.variance) {
+            // Welford's method, which does not lose precision for
+            // large values the way a sum of squares does.
+            const double delta = value - runningMean;
+            runningMean += delta / numValues;
+            sumSquares  += delta * (value - runningMean);
+        }
+        if (!config.quantiles.empty()) {
+            digest.add(value);
+        }
+    }
+
+    /** Add all the integers in a stream to the statistics.
+
+        \param[in,out] is The stream to be read (see IntParser::parse).
+
+        \return This method returns true if the whole stream consisted
+        of integers.
+    */
+    bool process(std::istream& is) {
+        return IntParser::parse(is, [this](const long long value) {
+            add(value);
+        });
+    }
+
+    /** The largest distinct values, in decreasing order. */
+    const std::vector<long long>& largest() const { return top; }
+
+    /** The statistics in the configuration (other than the largest 2
+        values) as pairs of a description and a value.
+    */
+    std::vector<std::pair<std::string, std::string>> report() {
+        std::vector<std::pair<std::string, std::string>> rows;
+        const bool empty = (numValues == 0);
+        if (config.count) {
+            rows.push_back({"Number of values", std::to_string(numValues)});
+        }
+        if (config.min) {
+            rows.push_back({"Minimum integer value",
+                            empty ? "N/A" : std::to_string(minValue)});
+        }
+        if (config.topK > 2) {
+            std::string values;
+            for (const long long value : top) {
+                values += (values.empty() ? "" : ", ") + std::to_string(value);
+            }
+            rows.push_back({"The " + std::to_string(config.topK) +
+                            " largest integer values", values});
+        }
+        if (config.mean) {
+            rows.push_back({"Mean", empty ? "N/A" : format(runningMean)});
+        }
+        if (config.variance) {
+            rows.push_back({"Variance", (numValues < 2) ? "N/A" :
+                            format(sumSquares / (numValues - 1))});
+        }
+        for (const double q : config.quantiles) {
+            rows.push_back({"Percentile " + format(q * 100) + " (approx.)",
+                            empty ? "N/A" : format(digest.quantile(q))});
+        }
+        return rows;
+    }
+
+private:
+    // Helper method to insert a value into the (sorted) largest values.
+    void addTop(const long long value) {
+        const auto pos = std::lower_bound(top.begin(), top.end(), value,
+                                          std::greater<long long>());
+        if ((pos != top.end()) && (*pos == value)) {
+            return;  // Only distinct values are kept.
+        }
+        top.insert(pos, value);
+        if (top.size() > config.topK) {
+            top.pop_back();
+        }
+    }
+
+    // Helper method to format a floating point value.
+    static std::string format(const double value) {
+        std::ostringstream os;
+        os.precision(10);
+        os << value;
+        return os.str();
+    }
+
+    // The statistics to be computed.
+    const Config config;
+    // The number of values and the smallest value.
+    size_t numValues = 0;
+    long long minValue = std::numeric_limits<long long>::max();
+    // The largest distinct values (in decreasing order).
+    std::vector<long long> top;
+    // The running mean and sum of squared differences from the mean.
+    double runningMean = 0, sumSquares = 0;
+    // The digest to estimate quantiles.
+    TDigest digest;
+};
+
+#endif
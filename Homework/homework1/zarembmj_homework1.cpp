@@ -15,16 +15,41 @@
 #include <fstream>
 #include <iomanip>
 #include <algorithm>
+#include <thread>
+#include <memory>
+#include <stdexcept>
+#include "HttpClient.h"
+#include "StreamStats.h"
+#include "ResultCache.h"
+#include "ParallelDownload.h"
+
+/** The statistics (in addition to the 2 largest values) reported for
+    each file.  These are set via the --stats command-line option.
+*/
+StreamStats::Config statsConfig;
+
+/** The number of concurrent Range requests used to download a large
+    file.  This value is set via the --parallel command-line option.
+    The default (1) downloads each file with 1 GET request.
+*/
+size_t parallelDownloads = 1;
+
+/** Files smaller than this are always downloaded with 1 GET request. */
+const size_t MinParallelSize = 4 * ParallelDownload::PieceSize;
+
+/** The results of recently processed URLs, shared by all the clients. */
+ResultCache resultCache;
 
 /** A convenience format string to generate results in HTML
     format. Note that this format string has place holders in the form
-    %1%, %2% etc.  These are filled-in with actual values.  For
-    example, you can generate actual values as shown below:
+    %1%, %2% etc.  These are filled-in with actual values.  The %3%
+    place holder is for additional statistics (if any), 1 line each.
+    For example, you can generate actual values as shown below:
 
     \code
 
     int max = 10, max2nd = 20;
-    auto html = boost::str(boost::format(HTMLData) % max % max2nd);
+    auto html = boost::str(boost::format(HTMLData) % max % max2nd % "");
 
     \endcode
 */
@@ -33,7 +58,7 @@ const std::string HTMLData = R"(<html>
     <h2>Analysis results</h2>
     <p>Maximum integer value: %1%</p>
     <p>The 2nd maximum integer value: %2%</p>
-  </body>
+%3%  </body>
 </html>
 )";
 
@@ -57,6 +82,17 @@ const std::string HTTPRespHeader =
     "Content-Type: text/html\r\n"
     "Content-Length: %1%\r\n\r\n";
 
+/** The HTTP response sent to the client when its request could not
+    be processed.  The place holders are for the status (e.g., "400
+    Bad Request"), the length of the message, and the message.
+*/
+const std::string HTTPErrorResp =
+    "HTTP/1.1 %1%\r\n"
+    "Server: localhost\r\n"
+    "Connection: Close\r\n"
+    "Content-Type: text/plain\r\n"
+    "Content-Length: %2%\r\n\r\n%3%";
+
 /**
  * It assumes the input stream is an HTTP GET request (hence it is
  * important to understand the input format before implementing this
@@ -73,7 +109,8 @@ const std::string HTTPRespHeader =
  * "http://localhost:8080/~raodm"
  *
  * @return This method returns the path specified in the GET
- * request.
+ * request (without the leading '/').  It is empty if the request
+ * line is missing or has no path.
  */
 std::string extractURL(std::istream& is) {
     std::string line, url;
@@ -87,13 +124,13 @@ std::string extractURL(std::istream& is) {
     // web-browsers.
     
     for (std::string header; std::getline(is, header) && !header.empty() 
-            && header != "r";) {}
+            && header != "\r";) {}
 
     // Do basic substring operation to extract the URL that is
     // delimited by space from the first line of input.
     
     std::istringstream(line) >> url >> url;
-    return url.substr(1);
+    return (url.empty() ? url : url.substr(1));
 }
 
 /**
@@ -112,6 +149,9 @@ std::string extractURL(std::istream& is) {
  * std::tuple because a method can return only 1 value.  The
  * std::tuple is a convenient class to encapsulate multiple return
  * values into a single return value.
+ *
+ * @exception std::invalid_argument The URL has no "//" before the
+ * hostname, no hostname, or no path after the hostname.
  */
 std::tuple<std::string, std::string, std::string>
 breakDownURL(const std::string& url) {
@@ -123,15 +163,21 @@ breakDownURL(const std::string& url) {
     // problem.  The std::string::find() and std::string::substr() the only
     // tow methods you will really need.
     
-    const size_t hostStart = url.find("//") + 2;
+    const size_t slashes = url.find("//");
+    const size_t hostStart = (slashes == std::string::npos ? slashes :
+                              slashes + 2);
     const size_t pathStart = url.find('/', hostStart);
-    const size_t portPosition   = url.find(':', hostStart);   
-    const size_t hostEnd   = (portPosition == std::string::npos ? pathStart :
-                              portPosition); 
+    if ((pathStart == std::string::npos) || (pathStart == hostStart)) {
+        // E.g., "favicon.ico" requested by web-browsers.
+        throw std::invalid_argument("Invalid URL \"" + url + "\"");
+    }
+    // A ':' in the path (rather than the host) is not a port number.
+    const size_t portPosition = url.find(':', hostStart);
+    const size_t hostEnd   = std::min(portPosition, pathStart);
     hostName = url.substr(hostStart, hostEnd - hostStart);
     path = url.substr(pathStart);
     
-    if (portPosition != std::string::npos) {
+    if (portPosition < pathStart) {
         port = url.substr(portPosition + 1, pathStart - portPosition - 1);
     }
     
@@ -140,57 +186,128 @@ breakDownURL(const std::string& url) {
 }
 
 /**
- * Process HTTP response data obtained from one web-server and send
- * results (as HTTP response) the web-browser.
+ * Process HTTP response data obtained from one web-server and
+ * generate the results (as HTML) to be sent to the web-browser.
  *
- * \param[in] is The input stream from where the HTTP response is to
- * be read and the number of words are to be counted. This method
- * should also compute the total number of characters in the words. In
+ * \param[in] is The input stream from where the body of the HTTP
+ * response is to be read and the number of words are to be
+ * counted. This method should also compute the total number of
+ * characters in the words. In
  * addition, it should also compute average number of characters per
  * word.
  *
- * \param[out] os The output stream to where HTTP response along with
- * HTML data is to be sent back to the client.
+ * \return The HTML data to be sent back to the client.
  */
-void process(std::istream& is, std::ostream& os) {
-    // Get the first HTTP response line and ensure it has 200 OK in it
-    // to indicate that the data stream is good.  However, in this
-    // example, we assume that the data is fine.  First skip over HTTP
-    // response headers.
-    for (std::string hdr; std::getline(is, hdr) &&
-             !hdr.empty() && hdr != "\r";) {}    
-
-    // Track the 1st and 2nd largest numbers so that it can be reported back
-    // to the client (as required in this project).
-    int max, max2nd;
-    is >> max >> max2nd;   // Read first 2 values.
-    // Ensure they are in the correct order
-    if (max < max2nd) {
-        std::swap(max, max2nd);
-    }
+std::string process(std::istream& is) {
+    // The HTTP response headers have already been read (by the
+    // HttpClient), so the stream has just the data.  The numbers are
+    // parsed and summarized in 1 pass, as the data is downloaded.
+    StreamStats stats(statsConfig);
+    stats.process(is);
 
-    // Now process rest of the numbers while tracking the maximum and
-    // 2nd maximum values (as required for this project).
-    
-    int temp;
-    while (is >> temp) {
-        if (temp > max) {
-            max2nd = max;
-            max = temp;
-        } else if (temp > max2nd && temp != max) {
-            max2nd = temp;
-        }
-    }
-    
     // Generate results in correct format and be sent it back to the
     // client in HTML format.  For this see HTMLData and
     // HTTPRespHeader format strings to generate results in correct
     // format.
-    
-    // max = 10;
-    // max2nd = 20;
-    auto htmlData = boost::str(boost::format(HTMLData) % max % max2nd);   
-    os << boost::format(HTTPRespHeader) % htmlData.length() << htmlData;
+    const auto& top = stats.largest();
+    auto largest = [&top](const size_t i) {
+        return (i < top.size() ? std::to_string(top[i]) : "N/A");
+    };
+    std::string extra;
+    for (const auto& row : stats.report()) {
+        extra += "    <p>" + row.first + ": " + row.second + "</p>\n";
+    }
+    return boost::str(boost::format(HTMLData) % largest(0) % largest(1) %
+                      extra);
+}
+
+/**
+ * Helper method to download and process a file, or just to revalidate
+ * the cached results of the file via a conditional request.  With the
+ * --parallel option, large files are downloaded via several concurrent
+ * Range requests (see ParallelDownload) and smaller files with 1 GET.
+ * If a piece of a large file fails (e.g., because the file changed),
+ * the partial results are dropped and the file is downloaded again
+ * with 1 GET.
+ *
+ * \param[in] hostname The host from where the file is downloaded.
+ *
+ * \param[in] port The port number of the host.
+ *
+ * \param[in] path The path of the file.
+ *
+ * \param[in,out] entry The cached results (and validators) of the
+ * file.  The results are updated unless the file has not changed.
+ *
+ * \return This method returns true if the results may be cached, and
+ * false if the file could not be downloaded but (stale) cached
+ * results can be used instead.
+ *
+ * @exception std::runtime_error The file could not be downloaded in
+ * full (e.g., the host is unreachable, the status is not 200, or the
+ * connection dropped) and there are no cached results.
+ */
+bool download(const std::string& hostname, const std::string& port,
+              const std::string& path, ResultCache::Entry& entry) {
+    HttpClient& client = HttpClient::shared();
+    HttpClient::Headers headers;
+    if (!entry.etag.empty()) {
+        headers.emplace_back("If-None-Match", entry.etag);
+    }
+    if (!entry.lastModified.empty()) {
+        headers.emplace_back("If-Modified-Since", entry.lastModified);
+    }
+    if (parallelDownloads > 1) {
+        auto head = client.request("HEAD", hostname, port, path, headers);
+        if (head->status == 304) {
+            return true;  // The cached results are still valid.
+        }
+        const size_t length = std::strtoull(
+            head->header("content-length").c_str(), nullptr, 10);
+        if ((head->status == 200) && (length >= MinParallelSize) &&
+            (head->header("accept-ranges").find("bytes") !=
+             std::string::npos)) {
+            const std::string etag = head->header("etag");
+            const std::string lastModified = head->header("last-modified");
+            head.reset();  // Free the connection for the downloads.
+            ParallelDownload data(client, hostname, port, path, length,
+                                  etag, parallelDownloads);
+            std::istream is(&data);
+            std::string result = process(is);
+            if (data.ok()) {
+                entry.result = std::move(result);
+                entry.etag = etag;
+                entry.lastModified = lastModified;
+                return true;
+            }
+            // The results are for only a part of the file.
+        }
+    }
+    const auto data = client.request("GET", hostname, port, path, headers);
+    if (data->status == 304) {
+        return true;  // The cached results are still valid.
+    }
+    // Have the helper method process the file's data.  Results for
+    // only a part of the file (e.g., the connection dropped) are not
+    // used, so that they are never revalidated as if they were whole.
+    std::string result;
+    if (data->status == 200) {
+        result = process(data->body());
+    }
+    if ((data->status != 200) || !data->complete()) {
+        if (!entry.result.empty()) {
+            return false;  // Keep using the cached results.
+        }
+        throw std::runtime_error("Unable to download " + path + " from " +
+                                 hostname + (data->status != 200 ?
+                                             " (HTTP status " +
+                                             std::to_string(data->status) +
+                                             ")" : " (incomplete data)"));
+    }
+    entry.result = std::move(result);
+    entry.etag = data->header("etag");
+    entry.lastModified = data->header("last-modified");
+    return true;
 }
 
 //-------------------------------------------------------------------------
@@ -216,6 +333,12 @@ void serveClient(const int step, std::istream& is = std::cin,
     // Have helper method extract the URL for downloading data from
     // the input HTTP GET request.
     auto url = extractURL(is);
+    // A request read from a data file (for testing) is the whole file,
+    // so look past its blank line for the end of the file.  This is
+    // not done on a socket, where it would wait for the browser.
+    if (dynamic_cast<boost::asio::ip::tcp::iostream*>(&is) == nullptr) {
+        is.peek();
+    }
     std::cout << "URL to be processed is: " << url << std::endl;
 
     if (step > 1) {
@@ -227,15 +350,17 @@ void serveClient(const int step, std::istream& is = std::cin,
                   << std::quoted(hostname) << ":"
                   << std::quoted(port) << " ...\n";
         if (step > 2) {
-            // Start the download of the file (that the user wants to be
-            // processed) at the specified URL.  We use a BOOST tcp::iostream.
-            boost::asio::ip::tcp::iostream data(hostname, port);
-            data << "GET "   << path     << " HTTP/1.1\r\n"
-                 << "Host: " << hostname << "\r\n"
-                 << "Connection: Close\r\n\r\n";
-            // Have the helper method process the file's data and print/send
-            // results (in HTTP/HTML format) to a given output stream.
-            process(data, os);
+            // Use the cached results for the URL, if any.  Otherwise (or
+            // to revalidate them) start the download of the file (that
+            // the user wants to be processed) at the specified URL.  We
+            // use the shared HttpClient that reuses connections.
+            const std::string htmlData = resultCache.get(url, [&](
+                ResultCache::Entry& entry) {
+                return download(hostname, port, path, entry);
+            });
+            // Send results (in HTTP/HTML format) to a given output stream.
+            os << boost::format(HTTPRespHeader) % htmlData.length()
+               << htmlData;
         }
     }
 }
@@ -245,11 +370,31 @@ void serveClient(const int step, std::istream& is = std::cin,
  * command-line arguments.
  *
  * \param[in] argc The number of command-line arguments.  This test
- * harness can work with zero or one command-line argument.
+ * harness can work with zero or one command-line argument, optionally
+ * preceded by "--stats List" to choose the additional statistics to
+ * be reported (see StreamStats::Config::parse), e.g.,
+ * "--stats count,min,mean,variance,p50,p99", and/or "--parallel N" to
+ * download large files with N concurrent Range requests.
  *
  * \param[in] argv The actual command-line arguments.
  */
 int main(int argc, char *argv[]) {
+    for (; (argc > 2) && (argv[1][0] == '-'); argv += 2, argc -= 2) {
+        const std::string option = argv[1];
+        if (option == "--stats") {
+            statsConfig = StreamStats::Config::parse(argv[2]);
+        } else if (option == "--parallel") {
+            parallelDownloads = std::max(1, std::stoi(argv[2]));
+            // Allow at least 1 connection per piece, but never fewer
+            // than the default, so that other clients don't queue up
+            // behind a parallel download.
+            HttpClient& client = HttpClient::shared();
+            client.setMaxPerHost(std::max<size_t>(client.getMaxPerHost(),
+                                                  parallelDownloads));
+        } else {
+            break;
+        }
+    }
     // Check and use a given input data file for testing.
     if (argc > 1) {
         // In this situation, this program processes inputs from a
@@ -272,8 +417,8 @@ int main(int argc, char *argv[]) {
 
 
     // If a command-line argument has not been specified, we operate
-    // as a web-server that can accept and process 1 request from an
-    // actual web-browser.
+    // as a web-server that accepts and processes requests from actual
+    // web-browsers until it is stopped.
     using namespace boost::asio;
     using namespace boost::asio::ip;
 
@@ -287,11 +432,31 @@ int main(int argc, char *argv[]) {
     std::cout << "Server is listening on port "
               << server.local_endpoint().port() << std::endl;
 
-    // Accept connection from a web-browser
-    tcp::iostream browser;
-    server.accept(*browser.rdbuf());
-    // Have the serveClient method do the processing by reading inputs
-    // from the client and sending results back to the client.
-    serveClient(3, browser, browser);
+    while (true) {
+        // Accept connection from a web-browser
+        auto browser = std::make_shared<tcp::iostream>();
+        server.accept(*browser->rdbuf());
+        // Have the serveClient method do the processing by reading
+        // inputs from the client and sending results back to the
+        // client.  Each client is served by a separate thread so that
+        // a large file does not hold up other clients.  A bad request
+        // (or a file that could not be downloaded) is reported to its
+        // client instead of ending the server.
+        std::thread([browser] {
+            auto sendError = [&browser](const std::string& status,
+                                        const std::exception& exp) {
+                const std::string msg = exp.what() + std::string("\n");
+                *browser << boost::format(HTTPErrorResp) % status %
+                    msg.size() % msg;
+            };
+            try {
+                serveClient(3, *browser, *browser);
+            } catch (const std::logic_error& exp) {
+                sendError("400 Bad Request", exp);
+            } catch (const std::exception& exp) {
+                sendError("502 Bad Gateway", exp);
+            }
+        }).detach();
+    }
     return 0;  // Successful run.
 }
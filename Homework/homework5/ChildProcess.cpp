@@ -9,6 +9,7 @@
  */
 
 // All the necessary #includes are already here
+#include <spawn.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <stdexcept>
@@ -20,16 +21,27 @@
  * class, the class
  */
 
-// This method is just a copy-paste from lecture notes. This is done
-// to illustrate an example.
-void
-ChildProcess::myExec(StrVec argList) {
+// The environment of this process that is passed on to spawned children
+extern char **environ;
+
+// Obtain the pointers to the arguments for execvp/posix_spawnp.
+std::vector<char*>
+ChildProcess::toArgv(const StrVec& argList) {
     std::vector<char*> args;    // list of pointers to args
     for (auto& s : argList) {
-        args.push_back(&s[0]);  // address of 1st character
+        // The exec calls never modify the arguments.
+        args.push_back(const_cast<char*>(s.c_str()));
     }
     // nullptr is very important
     args.push_back(nullptr);
+    return args;
+}
+
+// This method is just a copy-paste from lecture notes. This is done
+// to illustrate an example.
+void
+ChildProcess::myExec(const StrVec& argList) {
+    std::vector<char*> args = toArgv(argList);
     // Make execvp system call to run desired process
     execvp(args[0], &args[0]);
     // In case execvp ever fails, we throw a runtime execption
@@ -37,7 +49,8 @@ ChildProcess::myExec(StrVec argList) {
 }
 
 // Implement the constructor
-ChildProcess::ChildProcess() : childPid(-1) {
+ChildProcess::ChildProcess(const Launcher launcher) :
+    childPid(-1), launcher(launcher) {
     // childPid is initialized and not assigned!  Hence body is empty.
 }
 
@@ -57,6 +70,16 @@ ChildProcess::~ChildProcess() {
 // myExec in the child process and just return the childPid in parent.
 int
 ChildProcess::forkNexec(const StrVec& strVec) {
+    startTime = std::chrono::steady_clock::now();
+    if (launcher == Launcher::Spawn) {
+        std::vector<char*> args = toArgv(strVec);
+        pid_t pid = -1;
+        if (posix_spawnp(&pid, args[0], nullptr, nullptr, &args[0],
+                         environ) != 0) {
+            pid = -1;  // The program could not be run.
+        }
+        return (childPid = pid);
+    }
     // Fork and save the pid of the child process
     childPid = fork();
     // Call the myExec helper method in the child
@@ -69,13 +92,35 @@ ChildProcess::forkNexec(const StrVec& strVec) {
 }
 
 // Use the comments in the header to implement the wait method.  This
-// is a relatively simple method which uses waitpid call to get
+// is a relatively simple method which uses wait4 call to get
 // exitCode as shown in Slide #6 of ForkAndExec.pdf
 int
-ChildProcess::wait() const {
-    int exitCode = 0;  // Child process's exit code
-    waitpid(childPid, &exitCode, 0);  // wait for child to finish
-    return exitCode;
+ChildProcess::wait(ResourceUsage* usage) const {
+    if (childPid == -1) {
+        return 127;  // The program could not be run.
+    }
+    int status = 0;        // Child process's exit status
+    struct rusage ru = {};  // Resources used by the child
+    wait4(childPid, &status, 0, &ru);  // wait for child to finish
+    if (usage != nullptr) {
+        *usage = getUsage(ru);
+    }
+    return exitCode(status);
+}
+
+// Convert the rusage of a reaped child to a ResourceUsage
+ResourceUsage
+ChildProcess::getUsage(const struct rusage& ru,
+                       const std::chrono::steady_clock::time_point end) const {
+    auto seconds = [](const struct timeval& tv) {
+        return tv.tv_sec + tv.tv_usec / 1e6;
+    };
+    ResourceUsage usage;
+    usage.wallTime = std::chrono::duration<double>(end - startTime).count();
+    usage.userTime = seconds(ru.ru_utime);
+    usage.sysTime  = seconds(ru.ru_stime);
+    usage.maxRss   = ru.ru_maxrss;  // Linux reports this in KiB
+    return usage;
 }
 
 #endif
@@ -9,12 +9,25 @@
  * Copyright (C) 2020 raodm@miamiOH.edu
  */
 
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <chrono>
 #include <string>
 #include <vector>
 
 // A convenience shortcut to a vector-of-strings
 using StrVec = std::vector<std::string>;
 
+/**
+ * The resources used by a child process, as reported by wait4.
+ */
+struct ResourceUsage {
+    double wallTime = 0;  // Seconds from launch until the child was reaped
+    double userTime = 0;  // CPU seconds used in user mode
+    double sysTime  = 0;  // CPU seconds used in kernel mode
+    long maxRss     = 0;  // Peak resident set size in KiB
+};
+
 // ------------------------------------------------------------------- //
 // ****  NOTE: NEVER NEVER put "using namespace" IN A HEADER FILE  *** //
 // ------------------------------------------------------------------- //
@@ -26,11 +39,23 @@ using StrVec = std::vector<std::string>;
  */
 class ChildProcess {
 public:
-    /** A simple default (no-argument) constructor.  This constructor
-        merely initializes (so the body of the method should be
-        empty!) the childPid instance variable to -1.
+    /** The different ways in which a child process can be launched.
+        Fork uses the classic fork() followed by execvp() in the child.
+        Spawn uses posix_spawnp(), which (on Linux) creates the child
+        with vfork-like semantics and does not copy the parent's page
+        tables.  Hence Spawn is much faster when the parent is a large
+        process.
+    */
+    enum class Launcher { Fork, Spawn };
+
+    /** A simple constructor.  This constructor merely initializes (so
+        the body of the method should be empty!) the childPid instance
+        variable to -1.
+
+        \param[in] launcher The way in which this object launches its
+        child process.
     */
-    ChildProcess();
+    explicit ChildProcess(const Launcher launcher = Launcher::Fork);
     
     /** The destructor. This method cleans-up any resources (like open
         files etc.). However, this class is very simple and the
@@ -48,6 +73,10 @@ public:
         3. In the parent process, it stores the value in childPid and
            returns the childPid value.
 
+        With the Spawn launcher, steps 1 and 2 are done by a single
+        call to posix_spawnp.  If the program could not be run, wait()
+        reports an exit code of 127 (just as a shell does).
+
         \param[in] argList The list of command-line arguments.  The
         first entry is assumed to be the command to be executed. 
           
@@ -57,14 +86,52 @@ public:
     int forkNexec(const StrVec& argList);
 
     /** Helper method to wait for child process to finish.  This
-        method calls the waitpid system call. It obtains the exit code
-        of the child process from the 2nd argument of the waitpid
+        method calls the wait4 system call. It obtains the exit code
+        of the child process from the 2nd argument of the wait4
         system call.
 
+        \param[out] usage If not nullptr, the resources used by the
+        child process are stored here.
+
         \return This method returns the exit code of the child
-        process.
+        process (see exitCode).
+    */
+    int wait(ResourceUsage* usage = nullptr) const;
+
+    /** Convert a status returned by the wait family of system calls
+        to an exit code.
+
+        \param[in] status The status returned by waitpid or wait4.
+
+        \return The exit code of the process, or 128 plus the signal
+        number if the process was killed by a signal (as a shell
+        reports it).
     */
-    int wait() const;
+    static int exitCode(const int status) {
+        return (WIFEXITED(status) ? WEXITSTATUS(status) :
+                128 + WTERMSIG(status));
+    }
+
+    /** Obtain the resources used by the child process from the
+        rusage reported when it was reaped.
+
+        \param[in] ru The resource usage reported by wait4.
+
+        \param[in] end The time when the child process was reaped.
+
+        \return The resources used, with the wall time measured from
+        when the child process was launched.
+    */
+    ResourceUsage getUsage(const struct rusage& ru,
+                           const std::chrono::steady_clock::time_point end =
+                           std::chrono::steady_clock::now()) const;
+
+    /** Obtain the pid of the child process launched by this object.
+
+        \return The pid of the child process, or -1 if no child
+        process is running.
+    */
+    int getPid() const { return childPid; }
     
 protected:
     /** A helper method to setup pointers and call execvp system call.
@@ -76,14 +143,29 @@ protected:
         \param[in] argList The list of command-line arguments.  The
         first entry is assumed to be the command to be executed.
     */
-    void myExec(StrVec argList);
-    
+    void myExec(const StrVec& argList);
+
+    /** Helper method to obtain the pointers to the C-strings in a
+        list of arguments as needed by the exec and spawn system
+        calls.  The strings are not copied.
+
+        \param[in] argList The list of command-line arguments.
+
+        \return A nullptr terminated list of pointers into argList.
+    */
+    static std::vector<char*> toArgv(const StrVec& argList);
+
 private:
-    /** The only instance variable in this class.  It is initialized
-        to -1 in the constructor.  The value is changed by the
-        forkNexec method.
+    /** The pid of the child process.  It is initialized to -1 in
+        the constructor.  The value is changed by the forkNexec method.
     */
     int childPid;
+
+    /** The way in which this object launches its child process. */
+    Launcher launcher;
+
+    /** The time when the child process was launched. */
+    std::chrono::steady_clock::time_point startTime;
 };
 
 #endif
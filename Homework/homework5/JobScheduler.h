@@ -0,0 +1,152 @@
+#ifndef JOB_SCHEDULER_H
+#define JOB_SCHEDULER_H
+
+/**
+ * A simple scheduler that runs commands in parallel while keeping at
+ * most a given number of them running at any time (similar to make's
+ * -j option).  Finished commands are reaped in the order in which
+ * they finish (via wait4(-1)) and the next command is started as
+ * soon as there is room for it.
+ *
+ * Copyright (C) 2021 zarembmj@miamioh.edu
+ */
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <cerrno>
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+#include <utility>
+#include "ChildProcess.h"
+
+// ------------------------------------------------------------------- //
+// ****  NOTE: NEVER NEVER put "using namespace" IN A HEADER FILE  *** //
+// ------------------------------------------------------------------- //
+
+/**
+ * Runs jobs with bounded concurrency.  This class is not MT-safe but
+ * schedulers may be nested (e.g., a PARALLEL script running another
+ * PARALLEL script): a child reaped by one scheduler on behalf of
+ * another is handed over to its owner.
+ */
+class JobScheduler {
+public:
+    /** The method called with the exit code (see
+        ChildProcess::exitCode) and the resources used by each job when
+        it finishes.
+    */
+    using DoneHandler = std::function<void(const ChildProcess&, int,
+                                           const ResourceUsage&)>;
+
+    /** The constructor.
+
+        \param[in] maxJobs The maximum number of jobs to run at the
+        same time.
+
+        \param[in] onDone The method to be called as each job finishes.
+    */
+    JobScheduler(const size_t maxJobs, DoneHandler onDone) :
+        maxJobs(maxJobs == 0 ? 1 : maxJobs), onDone(std::move(onDone)) {}
+
+    /** The destructor waits for all the jobs to finish. */
+    ~JobScheduler() { finish(); }
+
+    /** Run a job as soon as fewer than maxJobs jobs are running.  This
+        method blocks (reaping finished jobs) until there is room.
+
+        \param[in] launch The method that launches the job and returns
+        the ChildProcess running it.
+    */
+    void add(const std::function<ChildProcess()>& launch) {
+        while (running.size() >= maxJobs) {
+            reapOne();
+        }
+        const ChildProcess child = launch();
+        if (child.getPid() == -1) {
+            // Could not be run at all.
+            onDone(child, child.wait(), ResourceUsage());
+        } else {
+            running.emplace(child.getPid(), child);
+        }
+    }
+
+    /** Wait for all the running jobs to finish. */
+    void finish() {
+        while (!running.empty()) {
+            reapOne();
+        }
+    }
+
+    /** The number of jobs that are currently running. */
+    size_t numRunning() const { return running.size(); }
+
+    /** Wait for any one of the running jobs to finish.  The onDone
+        handler is called for the job before this method returns.
+        This method returns immediately if no jobs are running.
+    */
+    void reapOne() {
+        if (running.empty()) {
+            return;
+        }
+        // First check if another scheduler already reaped one of ours.
+        for (const auto& entry : running) {
+            const auto status = reaped().find(entry.first);
+            if (status != reaped().end()) {
+                const pid_t pid = entry.first;
+                const Reaped info = status->second;
+                reaped().erase(status);
+                done(pid, info);
+                return;
+            }
+        }
+        for (Reaped info;;) {
+            const pid_t pid = wait4(-1, &info.status, 0, &info.ru);
+            info.end = std::chrono::steady_clock::now();
+            if (pid == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                running.clear();  // No more children to wait for?
+                return;
+            }
+            if (running.count(pid) != 0) {
+                done(pid, info);
+                return;
+            }
+            reaped()[pid] = info;  // Belongs to another scheduler
+        }
+    }
+
+private:
+    // What wait4 reported for a child and when it was reaped.
+    struct Reaped {
+        int status = 0;
+        struct rusage ru = {};
+        std::chrono::steady_clock::time_point end;
+    };
+
+    // Helper method to report and forget a finished job.
+    void done(const pid_t pid, const Reaped& info) {
+        const auto job = running.find(pid);
+        onDone(job->second, ChildProcess::exitCode(info.status),
+               job->second.getUsage(info.ru, info.end));
+        running.erase(job);
+    }
+
+    // The children reaped on behalf of other (enclosing) schedulers.
+    static std::unordered_map<pid_t, Reaped>& reaped() {
+        static std::unordered_map<pid_t, Reaped> statuses;
+        return statuses;
+    }
+
+    // The maximum number of jobs to run at the same time.
+    const size_t maxJobs;
+    // The method to be called when a job finishes.
+    const DoneHandler onDone;
+    // The jobs that are currently running, indexed by their pid.
+    std::unordered_map<pid_t, ChildProcess> running;
+};
+
+#endif
@@ -0,0 +1,187 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+/**
+ * A bounded cache of results keyed by the URL of the data they are
+ * obtained from: the analysis results of a data file in homework1,
+ * and the contents of a script in homework5 (see ScriptLoader).  Each
+ * result is stored along with the ETag and Last-Modified headers of
+ * the data so that, once a result is no longer fresh, it can be
+ * revalidated with a conditional GET (which usually just gets a "304
+ * Not Modified" response) instead of downloading (and processing) the
+ * data again.  Concurrent requests for a URL that is not in the cache
+ * (or is being revalidated) are collapsed into 1 download
+ * (single-flight): the other requests wait for and share its result.
+ * The least recently used results are evicted to bound the memory.
+ *
+ * This file is shared (as a copy) by homework1 and homework5.
+ *
+ * Copyright 2021 zarembmj@miamioh.edu
+ */
+
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+// ------------------------------------------------------------------- //
+// ****  NOTE: NEVER NEVER put "using namespace" IN A HEADER FILE  *** //
+// ------------------------------------------------------------------- //
+
+/**
+ * A cache of results with revalidation.  All the methods in this class
+ * are MT-safe.
+ */
+class ResultCache {
+public:
+    /** A cached result along with the validators of its data. */
+    struct Entry {
+        std::string result;        // The computed result, e.g., HTML
+        std::string etag;          // The ETag of the data (if any)
+        std::string lastModified;  // The Last-Modified of the data (if any)
+    };
+
+    /** A method to compute (or revalidate) a result.  The entry has the
+        validators of the cached result (if any) to be used in a
+        conditional GET.  If the data has not changed, the method leaves
+        the entry as is.  Otherwise it sets all the fields of the entry.
+        The method returns true if the entry may be cached (e.g., the
+        download succeeded).  Otherwise the entry is discarded and the
+        cached result (if any) is kept and used, even though it is no
+        longer fresh.
+    */
+    using Fetch = std::function<bool(Entry& entry)>;
+
+    /** The constructor.
+
+        \param[in] maxBytes The maximum total size of cached results.
+
+        \param[in] freshFor How long a result is used without being
+        revalidated.
+    */
+    explicit ResultCache(const size_t maxBytes = 64 * 1024 * 1024,
+                         const std::chrono::seconds freshFor =
+                         std::chrono::seconds(5)) :
+        maxBytes(maxBytes), freshFor(freshFor) {}
+
+    /** Obtain the result for a URL, from the cache if it is fresh.
+        Otherwise the result is fetched (or revalidated) via the given
+        method, unless another thread is already doing that for the
+        same URL, in which case its result is used.
+
+        \param[in] url The URL whose result is needed.
+
+        \param[in] fetch The method to compute/revalidate the result.
+        Exceptions thrown by the method are passed on to all the
+        threads waiting for the result.
+
+        \return The result for the URL.  This is the stale cached result
+        if it could not be revalidated, or the uncached result set by
+        the method if there is no cached result.
+    */
+    std::string get(const std::string& url, const Fetch& fetch) {
+        std::unique_lock<std::mutex> lock(mutex);
+        const auto now = std::chrono::steady_clock::now();
+        std::shared_ptr<const Entry> cached;
+        const auto item = index.find(url);
+        if (item != index.end()) {
+            lru.splice(lru.begin(), lru, item->second);  // Most recent
+            cached = item->second->entry;
+            if (now - item->second->validated < freshFor) {
+                return cached->result;
+            }
+        }
+        const auto flight = inFlight.find(url);
+        if (flight != inFlight.end()) {
+            auto result = flight->second;
+            lock.unlock();
+            return result.get()->result;
+        }
+        std::promise<std::shared_ptr<const Entry>> promise;
+        inFlight.emplace(url, promise.get_future().share());
+        lock.unlock();
+        // Fetch the result without holding the lock.
+        auto entry = std::make_shared<Entry>(cached ? *cached : Entry());
+        bool cacheable = false;
+        try {
+            cacheable = fetch(*entry);
+        } catch (...) {
+            lock.lock();
+            inFlight.erase(url);
+            lock.unlock();
+            promise.set_exception(std::current_exception());
+            throw;
+        }
+        std::shared_ptr<const Entry> result = entry;
+        lock.lock();
+        if (cacheable) {
+            erase(url);
+            store(url, entry, now);
+        } else if (cached) {
+            result = cached;  // Serve the stale result
+        }
+        inFlight.erase(url);
+        lock.unlock();
+        promise.set_value(result);
+        return result->result;
+    }
+
+private:
+    /** A cached result and the time when it was last validated. */
+    struct Item {
+        std::string url;
+        std::shared_ptr<const Entry> entry;
+        std::chrono::steady_clock::time_point validated;
+    };
+
+    // The approximate memory used by an entry.
+    static size_t sizeOf(const Item& item) {
+        return sizeof(Item) + item.url.size() + item.entry->result.size() +
+            item.entry->etag.size() + item.entry->lastModified.size();
+    }
+
+    // Store a result, evicting the least recently used results to stay
+    // within maxBytes.  The lock must be held.
+    void store(const std::string& url, std::shared_ptr<const Entry> entry,
+               const std::chrono::steady_clock::time_point validated) {
+        lru.push_front(Item{url, std::move(entry), validated});
+        index[url] = lru.begin();
+        bytes += sizeOf(lru.front());
+        while ((bytes > maxBytes) && !lru.empty()) {
+            const std::string oldest = lru.back().url;
+            erase(oldest);
+        }
+    }
+
+    // Remove the result for a URL (if any).  The lock must be held.
+    void erase(const std::string& url) {
+        const auto item = index.find(url);
+        if (item != index.end()) {
+            bytes -= sizeOf(*item->second);
+            lru.erase(item->second);
+            index.erase(item);
+        }
+    }
+
+    // The limits on the size and the freshness of results.
+    const size_t maxBytes;
+    const std::chrono::seconds freshFor;
+    // The results, most recently used first, and an index by URL.
+    std::list<Item> lru;
+    std::unordered_map<std::string, std::list<Item>::iterator> index;
+    // The memory used by the results.
+    size_t bytes = 0;
+    // The results being fetched, to be shared with other requests.
+    std::unordered_map<std::string,
+                       std::shared_future<std::shared_ptr<const Entry>>> inFlight;
+    // The mutex that protects the fields above.
+    std::mutex mutex;
+};
+
+#endif
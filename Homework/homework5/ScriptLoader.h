@@ -0,0 +1,234 @@
+#ifndef SCRIPT_LOADER_H
+#define SCRIPT_LOADER_H
+
+/**
+ * A loader for scripts from http:// URLs.  Each script is downloaded
+ * in full (with a pooled HttpClient connection) and cached by URL, so
+ * a script referenced several times is only revalidated (via a
+ * conditional GET) instead of being downloaded again.  When a SERIAL
+ * or PARALLEL script is loaded, the URLs of the scripts that it runs
+ * (via SERIAL, PARALLEL, or DAG lines) are prefetched in the
+ * background by a few worker threads, so that they are usually in the
+ * cache by the time the commands before them have finished.  DAG
+ * scripts only contain commands, so nothing is prefetched for them.
+ *
+ * Copyright 2021 zarembmj@miamioh.edu
+ */
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <istream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "HttpClient.h"
+#include "ResultCache.h"
+
+// ------------------------------------------------------------------- //
+// ****  NOTE: NEVER NEVER put "using namespace" IN A HEADER FILE  *** //
+// ------------------------------------------------------------------- //
+
+/**
+ * A cached, prefetching script loader.  All the methods in this class
+ * are MT-safe.
+ */
+class ScriptLoader {
+public:
+    /** The maximum number of scripts prefetched at the same time. */
+    static constexpr size_t MaxPrefetches = 4;
+
+    /** The constructor.
+
+        \param[in] client The client used to download scripts.
+    */
+    explicit ScriptLoader(HttpClient& client) : client(client) {}
+
+    /** The destructor waits for the prefetches in progress.  Queued
+        prefetches that have not started are dropped.
+    */
+    ~ScriptLoader() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            queue.clear();
+        }
+        queued.notify_all();
+        for (auto& thr : workers) {
+            thr.join();
+        }
+    }
+
+    /** The loader shared by the whole program.  It uses (and hence is
+        destroyed before) the shared HttpClient.
+    */
+    static ScriptLoader& shared() {
+        static ScriptLoader loader(HttpClient::shared());
+        return loader;
+    }
+
+    /** Obtain the contents of a script and start prefetching the
+        scripts that it runs.  If the script is being (or has been)
+        prefetched, the prefetch is waited for instead of downloading
+        the script again, and any error it ran into is reported here.
+        A prefetch that is still queued is run right away by the
+        calling thread.
+
+        \param[in] url The URL of the script.
+
+        \param[in] mode How the script is run: "SERIAL", "PARALLEL",
+        or "DAG".
+
+        \return The contents of the script (the body of the response).
+
+        \exception std::runtime_error The script could not be
+        downloaded.
+    */
+    std::string load(const std::string& url, const std::string& mode) {
+        std::shared_future<std::string> pending;
+        std::packaged_task<std::string()> task;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            const auto entry = prefetches.find(url);
+            if (entry != prefetches.end()) {
+                pending = std::move(entry->second);
+                prefetches.erase(entry);  // Later loads use the cache
+            }
+            const auto waiting = std::find_if(queue.begin(), queue.end(),
+                [&url](const auto& item) { return item.first == url; });
+            if (waiting != queue.end()) {
+                task = std::move(waiting->second);
+                queue.erase(waiting);
+            }
+        }
+        if (task.valid()) {
+            task();
+        }
+        return pending.valid() ? pending.get() : get(url, mode);
+    }
+
+private:
+    // Obtain a script (from the cache if possible) and prefetch the
+    // scripts it runs.
+    std::string get(const std::string& url, const std::string& mode) {
+        const std::string script = cache.get(url, [&](
+            ResultCache::Entry& entry) { return fetch(url, entry); });
+        if (mode != "DAG") {
+            for (const auto& nested : nestedScripts(script)) {
+                prefetch(nested.first, nested.second);
+            }
+        }
+        return script;
+    }
+
+    // Download (or revalidate) a script via a conditional GET.
+    bool fetch(const std::string& url, ResultCache::Entry& entry) {
+        HttpClient::Headers headers;
+        if (!entry.etag.empty()) {
+            headers.emplace_back("If-None-Match", entry.etag);
+        }
+        if (!entry.lastModified.empty()) {
+            headers.emplace_back("If-Modified-Since", entry.lastModified);
+        }
+        const auto resp = client.get(url, headers);
+        if (resp->status == 304) {
+            return true;  // The cached script is still valid.
+        }
+        if (resp->status != 200) {
+            throw std::runtime_error("Unable to download " + url +
+                                     " (HTTP status " +
+                                     std::to_string(resp->status) + ")");
+        }
+        entry.result = resp->readBody();
+        entry.etag = resp->header("etag");
+        entry.lastModified = resp->header("last-modified");
+        return true;
+    }
+
+    // Queue a script to be loaded in the background (once per URL).
+    // A worker is started if all the workers are busy and there are
+    // fewer than MaxPrefetches of them.
+    void prefetch(const std::string& url, const std::string& mode) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping || !prefetched.insert(url).second) {
+            return;
+        }
+        std::packaged_task<std::string()> task([this, url, mode] {
+                return get(url, mode); });
+        prefetches.emplace(url, task.get_future().share());
+        queue.emplace_back(url, std::move(task));
+        if ((idle == 0) && (workers.size() < MaxPrefetches)) {
+            workers.emplace_back([this] { work(); });
+        } else {
+            queued.notify_one();
+        }
+    }
+
+    // The method run by each worker thread to run queued prefetches.
+    // The result (or exception) of a prefetch goes to its future.
+    void work() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            idle++;
+            queued.wait(lock, [this] { return stopping || !queue.empty(); });
+            idle--;
+            if (stopping) {
+                return;
+            }
+            auto task = std::move(queue.front().second);
+            queue.pop_front();
+            lock.unlock();
+            task();
+            lock.lock();
+        }
+    }
+
+    // The scripts (URL and mode) run by a SERIAL or PARALLEL script,
+    // i.e., its lines of the form "MODE http://...", up to its "exit"
+    // line.  These are the lines that processCmds() runs as scripts.
+    static std::vector<std::pair<std::string, std::string>>
+    nestedScripts(const std::string& script) {
+        std::vector<std::pair<std::string, std::string>> scripts;
+        std::istringstream is(script);
+        for (std::string line; std::getline(is, line) && (line != "exit");) {
+            std::istringstream words(line);
+            std::string mode, url;
+            if ((words >> mode >> url) && ((mode == "SERIAL") ||
+                                           (mode == "PARALLEL") ||
+                                           (mode == "DAG")) &&
+                (url.find("http://") == 0)) {
+                scripts.emplace_back(url, mode);
+            }
+        }
+        return scripts;
+    }
+
+    // The client used to download scripts.
+    HttpClient& client;
+    // The scripts downloaded recently.
+    ResultCache cache;
+    // The URLs prefetched so far, and the results of the prefetches
+    // that have not been used by load() yet.
+    std::unordered_set<std::string> prefetched;
+    std::unordered_map<std::string, std::shared_future<std::string>> prefetches;
+    // The prefetches (by URL) waiting for a worker, and the workers.
+    std::deque<std::pair<std::string, std::packaged_task<std::string()>>> queue;
+    std::vector<std::thread> workers;
+    // The number of workers waiting for a prefetch to run.
+    size_t idle = 0;
+    // Flag set when no more prefetches should be run.
+    bool stopping = false;
+    // The mutex that protects the prefetch fields above, and the
+    // condition signalled when a prefetch is queued or on stopping.
+    std::mutex mutex;
+    std::condition_variable queued;
+};
+
+#endif
@@ -8,7 +8,19 @@
  *    shell script are run serially (one after the other).
  *
  *    2. A 'parallel' command where commands in a given
- *    shell script (text file or URL) are run in parallel.
+ *    shell script (text file or URL) are run in parallel.  At most
+ *    N commands (set via the -j N command-line option, defaulting to
+ *    the number of CPUs) are run at the same time.
+ *
+ *    3. A 'dag' command where commands in a given shell script are
+ *    run as soon as the commands they depend on have finished (see
+ *    processDag for the syntax), followed by a report of the critical
+ *    path through the script.
+ *
+ * With the --report option the shell also prints the wall time, CPU
+ * time, and peak memory used by each command along with a summary for
+ * each script.  With "--json File" the same information is written to
+ * the given file as JSON lines (1 JSON object per line).
  */
 
 #include <boost/asio.hpp>
@@ -22,18 +34,42 @@
 #include <vector>
 #include <algorithm>
 #include <iomanip>
+#include <thread>
+#include <chrono>
+#include <deque>
+#include <unordered_map>
 
 using namespace boost::asio;
 using namespace boost::asio::ip;
 
 #include "ChildProcess.h"
+#include "JobScheduler.h"
+#include "ScriptLoader.h"
+
+// The maximum number of commands in a parallel script that are run at
+// the same time.  This value is set via the -j command-line option.
+size_t maxJobs = std::max(1u, std::thread::hardware_concurrency());
+
+// Print the resources used by each command and script if true.
+bool printReport = false;
 
-// Shortcut to refer to a list of child processes
-// This class is defined in ChildProcess.h
-using ProcessList = std::vector<ChildProcess>;
+// The stream where resources used are written as JSON lines (if open).
+std::ofstream jsonReport;
+
+/**
+ * The totals for the commands run by a script, used to report a
+ * summary for the script.
+ */
+struct ScriptStats {
+    // The time when the script was started
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    size_t numCmds = 0, numFailed = 0;  // Number of commands run/failed
+    ResourceUsage total;  // Wall time and CPU used by all the commands
+};
 
 // Early declaration of processScript to establish scope
-void processScript(const std::string& input, bool parallel);
+void processScript(const std::string& input, const std::string& mode);
 
 /** Convenience method to split a given line into individual words.
  *
@@ -73,13 +109,114 @@ ChildProcess runCmds(const StrVec& argList) {
     }
     std::cout << std::endl;
 
-    // Create an instance of ChildProcess to run the command
-    ChildProcess child;
+    // Create an instance of ChildProcess to run the command.  The
+    // command is spawned as it is faster than fork+exec.
+    ChildProcess child(ChildProcess::Launcher::Spawn);
     child.forkNexec(argList);
     // Return child for further operations
     return child;
 }
 
+/**
+ * Helper method to escape a string so that it can be included in a
+ * JSON string literal.
+ *
+ * @param str The string to be escaped.
+ *
+ * @return The escaped string (without the surrounding quotes).
+ */
+std::string jsonEscape(const std::string& str) {
+    std::string result;
+    for (const char c : str) {
+        if ((c == '"') || (c == '\\')) {
+            result += '\\';
+            result += c;
+        } else if (static_cast<unsigned char>(c) < ' ') {
+            result += (boost::format("\\u%04x") % int(c)).str();
+        } else {
+            result += c;
+        }
+    }
+    return result;
+}
+
+/**
+ * Print the exit code of a command that has finished along with the
+ * resources it used (if reports are enabled), and include it in the
+ * totals for the script.
+ *
+ * @param cmd The command (with its arguments) that finished.
+ *
+ * @param exitCode The exit code of the command.
+ *
+ * @param usage The resources used by the command.
+ *
+ * @param stats The totals for the script running the command.
+ *
+ * @param tagged If true, the lines printed are prefixed with the
+ * command (e.g., "[sleep 1] Exit code: 0") so that the results of
+ * commands that run at the same time can be told apart.
+ */
+void cmdDone(const std::string& cmd, const int exitCode,
+             const ResourceUsage& usage, ScriptStats& stats,
+             const bool tagged = false) {
+    const std::string tag = (tagged ? "[" + cmd + "] " : "");
+    std::cout << tag << "Exit code: " << exitCode << std::endl;
+    if (printReport) {
+        std::cout << tag << boost::format("Resources: wall %.3f s, user %.3f s, "
+                                   "sys %.3f s, max RSS %d KiB\n") %
+            usage.wallTime % usage.userTime % usage.sysTime % usage.maxRss;
+    }
+    if (jsonReport.is_open()) {
+        jsonReport << boost::format("{\"type\": \"cmd\", \"cmd\": \"%s\", "
+                                    "\"exit\": %d, \"wall\": %.6f, "
+                                    "\"user\": %.6f, \"sys\": %.6f, "
+                                    "\"maxRssKiB\": %d}\n") %
+            jsonEscape(cmd) % exitCode % usage.wallTime % usage.userTime %
+            usage.sysTime % usage.maxRss << std::flush;
+    }
+    stats.numCmds++;
+    stats.numFailed += (exitCode != 0);
+    stats.total.wallTime += usage.wallTime;
+    stats.total.userTime += usage.userTime;
+    stats.total.sysTime  += usage.sysTime;
+    stats.total.maxRss    = std::max(stats.total.maxRss, usage.maxRss);
+}
+
+/**
+ * Print the summary of the resources used by all the commands in a
+ * script (if reports are enabled).  The speedup is the total wall time
+ * of the commands divided by the wall time taken by the script, i.e.,
+ * how much running commands in parallel helped.
+ *
+ * @param script The file or URL of the script.
+ *
+ * @param stats The totals for the script.
+ */
+void scriptDone(const std::string& script, const ScriptStats& stats) {
+    const double wall = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - stats.start).count();
+    const double speedup = (wall > 0 ? stats.total.wallTime / wall : 0);
+    if (printReport) {
+        std::cout << boost::format("Script %s: %d command(s), %d failed, "
+                                   "wall %.3f s, user %.3f s, sys %.3f s, "
+                                   "speedup %.2fx, max RSS %d KiB\n") %
+            script % stats.numCmds % stats.numFailed % wall %
+            stats.total.userTime % stats.total.sysTime % speedup %
+            stats.total.maxRss;
+    }
+    if (jsonReport.is_open()) {
+        jsonReport << boost::format("{\"type\": \"script\", \"script\": "
+                                    "\"%s\", \"cmds\": %d, \"failed\": %d, "
+                                    "\"wall\": %.6f, \"cmdWall\": %.6f, "
+                                    "\"user\": %.6f, \"sys\": %.6f, "
+                                    "\"speedup\": %.3f, \"maxRssKiB\": %d}\n")
+            % jsonEscape(script) % stats.numCmds % stats.numFailed % wall %
+            stats.total.wallTime % stats.total.userTime % stats.total.sysTime
+            % speedup % stats.total.maxRss << std::flush;
+    }
+}
+
 /**
  * The primary method to read and run commands.
  *
@@ -90,11 +227,22 @@ ChildProcess runCmds(const StrVec& argList) {
  * 
  * @param parallel If true, then the commands are run in parallel. 
  * If false, the commands are run serially.
+ *
+ * @return The totals for the commands that were run.
  */
-void processCmds(std::istream& is, const std::string& prompt = "> ",
+ScriptStats processCmds(std::istream& is, const std::string& prompt = "> ",
         const bool parallel = false) {
-    // Parallel only
-    ProcessList childList;
+    ScriptStats stats;
+    // Parallel only.  Commands are started as they are read, as long
+    // as fewer than maxJobs are running.  Exit codes are printed in
+    // the order in which the commands finish, tagged with the command.
+    std::unordered_map<int, std::string> cmds;  // The command of each pid
+    JobScheduler jobs(maxJobs, [&](const ChildProcess& child,
+                                   const int exitCode,
+                                   const ResourceUsage& usage) {
+        cmdDone(cmds[child.getPid()], exitCode, usage, stats, true);
+        cmds.erase(child.getPid());
+    });
 
     // Process each line until we encounter the exit command.
     std::string line;
@@ -107,88 +255,262 @@ void processCmds(std::istream& is, const std::string& prompt = "> ",
         const StrVec argList = split(line);
 
         // Operations differ depending on command
-        if ((argList[0] == "SERIAL") || (argList[0] == "PARALLEL")) {
+        if ((argList[0] == "SERIAL") || (argList[0] == "PARALLEL") ||
+            (argList[0] == "DAG")) {
             // Process input
-            processScript(argList[1], argList[0] == "PARALLEL");
+            processScript(argList[1], argList[0]);
 
-        } else {
-            // Create a child process and run the command.
+        } else if (!parallel) {
+            // Serial only
+            // We have to wait for child to finish and print the exit code
             ChildProcess child = runCmds(argList);
-            if (!parallel) {
-                // Serial only
-                // We have to wait for child to finish and print the exit code
-                std::cout << "Exit code: " << child.wait() << std::endl;
-
-            } else {
-                // Parallel only
-                // We have to track each child process created, so we add it
-                // to this convenient vector.
-                childList.push_back(child);
-            }
+            ResourceUsage usage;
+            const int exitCode = child.wait(&usage);
+            cmdDone(line, exitCode, usage, stats);
+
+        } else {
+            // Parallel only
+            // The scheduler runs the child process (once there is room)
+            // and reports its exit code when it finishes.
+            jobs.add([&] {
+                ChildProcess child = runCmds(argList);
+                cmds[child.getPid()] = line;
+                return child;
+            });
         }
     }
     // Parallel only
-    // After all of the child processes have been created, we need to wait for
-    // each one to finish.
-    for (auto& proccess : childList) {
-        std::cout << "Exit code: " << proccess.wait() << std::endl;
-    }
+    // After all of the commands have been started, we need to wait for
+    // the remaining ones to finish.
+    jobs.finish();
+    return stats;
 }
 
 /**
- * Helper method to break down a URL into hostname, port and path. For
- * example, given the url: "https://localhost:8080/~raodm/one.txt"
- * this method returns <"localhost", "8080", "/~raodm/one.txt">
+ * A command in a DAG script along with the commands it depends on and
+ * the times (in seconds since the script was started) when it ran.
+ */
+struct DagJob {
+    std::string name;            // The name used to report this job
+    StrVec argList;              // The command and its arguments
+    std::vector<size_t> deps;    // The jobs this job depends on
+    std::vector<size_t> next;    // The jobs that depend on this job
+    size_t waitingFor = 0;       // The number of deps yet to finish
+    bool ran = false;            // True if the job ran successfully
+    double start = 0, end = 0;   // When the job was started & finished
+};
+
+// Shortcut to refer to the list of jobs in a DAG script
+using DagJobs = std::vector<DagJob>;
+
+/**
+ * Helper method to read the jobs in a DAG script.  Each line in the
+ * script is one of:
  *
- * Similarly, given the url: "ftp://ftp.files.miamioh.edu/index.html"
- * this method returns <"ftp.files.miamioh.edu", "80", "/index.html">
+ *    1. A command to be run. It depends on all the jobs before the
+ *       most recent WAIT line.
  *
- * @param url A string containing a valid URL. The port number in URL
- * is always optional.  The default port number is assumed to be 80.
+ *    2. "JOB name [dep ...] : command [args ...]" to run a command that
+ *       also depends on the (earlier) jobs with the given names.
  *
- * @return This method returns a std::tuple with 3 strings. The 3
- * strings are in the order: hostname, port, and path.  Here we use
- * std::tuple because a method can return only 1 value.  The
- * std::tuple is a convenient class to encapsulate multiple return
- * values into a single return value.
+ *    3. "WAIT" to make all the subsequent jobs depend on all the jobs
+ *       since the previous WAIT.
+ *
+ * @param is The input stream from where the script is to be read.
+ *
+ * @return The list of jobs in the order in which they appear.
  */
-std::tuple<std::string, std::string, std::string>
-breakDownURL(const std::string& url) {
-    std::string hostName, port = "80", path = "/";
-
-    const size_t hostStart = url.find("//") + 2;
-    const size_t pathStart = url.find('/', hostStart);
-    const size_t portPos = url.find(':', hostStart);
-    const size_t hostEnd = (portPos == std::string::npos ? pathStart :
-            portPos);
+DagJobs readDag(std::istream& is) {
+    DagJobs jobs;
+    std::unordered_map<std::string, size_t> named;  // JOB name -> index
+    std::vector<size_t> barrier;   // The jobs before the last WAIT
+    size_t sinceWait = 0;          // First job after the last WAIT
+    std::string line;
+    while (std::getline(is, line) && (line != "exit")) {
+        StrVec words = split(line);
+        if (words.empty() || (words[0][0] == '#')) {
+            continue;
+        }
+        if (words[0] == "WAIT") {
+            if (sinceWait < jobs.size()) {
+                barrier.clear();
+                for (; sinceWait < jobs.size(); sinceWait++) {
+                    barrier.push_back(sinceWait);
+                }
+            }
+            continue;
+        }
+        DagJob job;
+        job.deps = barrier;
+        if (words[0] == "JOB") {
+            // The line must have a name before the ':' and a command
+            // after it.
+            const auto colon = std::find(words.begin(), words.end(), ":");
+            if ((colon - words.begin() < 2) || (colon == words.end()) ||
+                (colon + 1 == words.end())) {
+                std::cerr << "Invalid JOB line: " << line << std::endl;
+                continue;
+            }
+            job.name = words[1];
+            for (auto dep = words.begin() + 2; (dep != colon); dep++) {
+                if (named.find(*dep) == named.end()) {
+                    std::cerr << "Unknown job " << *dep << " in: " << line
+                              << std::endl;
+                } else {
+                    job.deps.push_back(named[*dep]);
+                }
+            }
+            words.erase(words.begin(), colon + 1);
+            named[job.name] = jobs.size();
+        } else {
+            job.name = line.substr(line.find_first_not_of(" \t"));
+        }
+        // Remove duplicate dependencies and link the jobs both ways.
+        std::sort(job.deps.begin(), job.deps.end());
+        job.deps.erase(std::unique(job.deps.begin(), job.deps.end()),
+                       job.deps.end());
+        for (const size_t dep : job.deps) {
+            jobs[dep].next.push_back(jobs.size());
+        }
+        job.waitingFor = job.deps.size();
+        job.argList = std::move(words);
+        jobs.push_back(std::move(job));
+    }
+    return jobs;
+}
 
-    hostName = url.substr(hostStart, hostEnd - hostStart);
-    path = url.substr(pathStart);
-    if (portPos != std::string::npos) {
-        port = url.substr(portPos + 1, pathStart - portPos - 1);
+/**
+ * Helper method to print the critical path through a DAG script that
+ * has run, i.e., the chain of jobs, each of which was the last one
+ * that the next one had to wait for, ending with the job that
+ * finished last.  The Waited column shows the time a job waited (for
+ * a free slot, see -j) after the job it depends on had finished.
+ *
+ * @param jobs The jobs in the script after they have been run.
+ *
+ * @param total The wall-clock time (in seconds) taken by the script.
+ */
+void printCriticalPath(const DagJobs& jobs, const double total) {
+    // Find the job that finished last
+    size_t last = jobs.size();
+    for (size_t i = 0; (i < jobs.size()); i++) {
+        if (jobs[i].ran && ((last == jobs.size()) ||
+                            (jobs[i].end > jobs[last].end))) {
+            last = i;
+        }
     }
+    // Walk backwards to the dependency that finished last each time.
+    std::vector<size_t> path;
+    for (size_t cur = last; (cur != jobs.size());) {
+        path.push_back(cur);
+        size_t prev = jobs.size();
+        for (const size_t dep : jobs[cur].deps) {
+            if ((prev == jobs.size()) || (jobs[dep].end > jobs[prev].end)) {
+                prev = dep;
+            }
+        }
+        cur = prev;
+    }
+    std::cout << boost::format("Critical path: %d job(s), total time %.3f s\n"
+                               "%9s %9s %9s  %s\n") % path.size() % total
+                               % "Start" % "Waited" % "Ran" % "Job";
+    double prevEnd = 0;
+    for (auto job = path.rbegin(); (job != path.rend()); job++) {
+        const DagJob& dj = jobs[*job];
+        std::cout << boost::format("%9.3f %9.3f %9.3f  %s\n") % dj.start
+            % (dj.start - prevEnd) % (dj.end - dj.start) % dj.name;
+        prevEnd = dj.end;
+    }
+}
 
-    return {hostName, port, path};
+/**
+ * Run the jobs in a DAG script (see readDag for the syntax).  Each job
+ * is started as soon as all the jobs it depends on have finished
+ * successfully, with at most maxJobs jobs running at the same time.
+ * Jobs that depend on a failed job are skipped.
+ *
+ * @param is The input stream from where the script is to be read.
+ *
+ * @return The totals for the commands that were run.
+ */
+ScriptStats processDag(std::istream& is) {
+    DagJobs jobs = readDag(is);
+    ScriptStats stats;
+    const auto startTime = std::chrono::steady_clock::now();
+    auto elapsed = [&startTime] {
+        return std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - startTime).count();
+    };
+    // The jobs whose dependencies have all finished
+    std::deque<size_t> ready;
+    for (size_t i = 0; (i < jobs.size()); i++) {
+        if (jobs[i].waitingFor == 0) {
+            ready.push_back(i);
+        }
+    }
+    // Helper to make the jobs that depend on a job ready as needed
+    auto finished = [&jobs, &ready](const size_t job) {
+        for (const size_t next : jobs[job].next) {
+            if (--jobs[next].waitingFor == 0) {
+                ready.push_back(next);
+            }
+        }
+    };
+    // The job run by each child process
+    std::unordered_map<int, size_t> pidJob;
+    JobScheduler scheduler(maxJobs, [&](const ChildProcess& child,
+                                        const int exitCode,
+                                        const ResourceUsage& usage) {
+        DagJob& job = jobs[pidJob[child.getPid()]];
+        job.end = elapsed();
+        job.ran = (exitCode == 0);
+        cmdDone(job.name, exitCode, usage, stats, true);
+        finished(pidJob[child.getPid()]);
+    });
+    // Run the jobs as they become ready
+    while (!ready.empty() || (scheduler.numRunning() > 0)) {
+        if (ready.empty()) {
+            scheduler.reapOne();
+            continue;
+        }
+        const size_t job = ready.front();
+        ready.pop_front();
+        if (std::any_of(jobs[job].deps.begin(), jobs[job].deps.end(),
+                        [&jobs](const size_t dep) { return !jobs[dep].ran; })) {
+            std::cout << "Skipped: " << jobs[job].name << std::endl;
+            finished(job);
+            continue;
+        }
+        scheduler.add([&, job] {
+            jobs[job].start = elapsed();
+            ChildProcess child = runCmds(jobs[job].argList);
+            pidJob[child.getPid()] = job;
+            return child;
+        });
+    }
+    printCriticalPath(jobs, elapsed());
+    return stats;
 }
 
 /**
- * Helper method that sets up an HTTP stream to download the
- * script to be run from a supplied URL. Basically copied from HW 1.
+ * Helper method that downloads the script to be run from a supplied
+ * URL.  The shared ScriptLoader downloads the whole script (reusing
+ * pooled connections), caches it so a script run several times is
+ * only revalidated, and prefetches the scripts it runs in the
+ * background.  The whole script is read up front so that the
+ * connection goes back to the pool before the commands in the script
+ * are run.
  *
  * @param url The URL to be processed.
+ *
+ * @param mode How the script is run: "SERIAL", "PARALLEL", or "DAG".
+ *
+ * @return The contents of the script.
+ *
+ * @exception std::runtime_error The script could not be downloaded.
  */
-void serveClient(const std::string& url, tcp::iostream& client) {
-    std::string hostname, port, path;
-    std::tie(hostname, port, path) = breakDownURL(url);
-
-    client.connect(hostname, port);
-    client << "GET " << path << " HTTP/1.1\r\n"
-            << "Host: " << hostname << "\r\n"
-            << "Connection: Close\r\n\r\n";
-
-    for (std::string hdr; std::getline(client, hdr) &&
-            !hdr.empty() && hdr != "\r";) {
-    }
+std::string serveClient(const std::string& url, const std::string& mode) {
+    return ScriptLoader::shared().load(url, mode);
 }
 
 /**
@@ -199,25 +521,57 @@ void serveClient(const std::string& url, tcp::iostream& client) {
  *
  * @param input The file or URL to be processed.
  *
- * @param parallel If true then this method processes 
- * each command in the script in parallel.
+ * @param mode One of "SERIAL", "PARALLEL", or "DAG" to indicate how
+ * the commands in the script are to be run.
  */
-void processScript(const std::string& input, bool parallel) {
+void processScript(const std::string& input, const std::string& mode) {
+    // Helper to run the commands read from a given stream
+    auto process = [&](std::istream& is) {
+        scriptDone(input, (mode == "DAG") ? processDag(is) :
+                   processCmds(is, "", mode == "PARALLEL"));
+    };
     if (input.find("http://") == 0) {
-        tcp::iostream client;
-        serveClient(input, client);
-        processCmds(client, "", parallel);
+        std::string contents;
+        try {
+            contents = serveClient(input, mode);
+        } catch (const std::exception& exp) {
+            std::cerr << exp.what() << std::endl;
+            return;
+        }
+        std::istringstream script(contents);
+        process(script);
 
     } else {
         std::ifstream script(input);
-        processCmds(script, "", parallel);
+        process(script);
     }
 }
 
 /**
  * The main method just calls the processCmds method 
  * to run the commands from the console.
+ *
+ * @param argc The number of command-line arguments.
+ *
+ * @param argv The command-line arguments.  The optional arguments are:
+ * "-j N" to set the maximum number of commands that a parallel script
+ * runs at the same time, "--report" to print the resources used, and
+ * "--json File" to write the resources used as JSON lines to File.
  */
-int main() {
+int main(int argc, char *argv[]) {
+    for (int i = 1; (i < argc); i++) {
+        const std::string arg = argv[i];
+        if ((arg == "-j") && (i + 1 < argc)) {
+            maxJobs = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--report") {
+            printReport = true;
+        } else if ((arg == "--json") && (i + 1 < argc)) {
+            jsonReport.open(argv[++i]);
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [-j MaxParallelJobs] "
+                      << "[--report] [--json File]\n";
+            return 1;
+        }
+    }
     processCmds(std::cin);
 }
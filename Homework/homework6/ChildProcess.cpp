@@ -9,6 +9,8 @@
  */
 
 // All the necessary #includes are already here
+#include <fcntl.h>
+#include <spawn.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <stdexcept>
@@ -21,6 +23,9 @@
 // Named-constants to keep pipe code readable below
 const int READ = 0, WRITE = 1;
 
+// The environment of this process that is passed on to spawned children
+extern char **environ;
+
 
 /** NOTE: Unlike Java, C++ does not require class names and file names
  * should match.  Hence when defining methods pertaining to a specific
@@ -29,24 +34,63 @@ const int READ = 0, WRITE = 1;
  */
 
 
-// This method is just a copy-paste from lecture notes. This is done
-// to illustrate an example.
-void
-ChildProcess::myExec(StrVec argList) {
+// Obtain the pointers to the arguments for execvp/posix_spawnp.
+std::vector<char*>
+ChildProcess::toArgv(const StrVec& argList) {
     std::vector<char*> args;    // list of pointers to args
     for (auto& s : argList) {
-        args.push_back(&s[0]);  // address of 1st character
+        // The exec calls never modify the arguments.
+        args.push_back(const_cast<char*>(s.c_str()));
     }
     // nullptr is very important
     args.push_back(nullptr);
+    return args;
+}
+
+// This method is just a copy-paste from lecture notes. This is done
+// to illustrate an example.
+void
+ChildProcess::myExec(const StrVec& argList) {
+    std::vector<char*> args = toArgv(argList);
     // Make execvp system call to run desired process
     execvp(args[0], &args[0]);
     // In case execvp ever fails, we throw a runtime execption
     throw std::runtime_error("Call to execvp failed for: " + argList[0]);
 }
 
+// Launch the child process with posix_spawnp
+int
+ChildProcess::spawn(const StrVec& argList, const int outFd,
+                    const bool withStderr) {
+    // The redirections to be done in the child before running the
+    // program.  dup2 clears the close-on-exec flag on the new fd.
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (outFd != -1) {
+        posix_spawn_file_actions_adddup2(&actions, outFd, 1);
+        if (withStderr) {
+            posix_spawn_file_actions_adddup2(&actions, outFd, 2);
+        }
+    }
+#if defined(__GLIBC__) && \
+    ((__GLIBC__ > 2) || ((__GLIBC__ == 2) && (__GLIBC_MINOR__ >= 34)))
+    // Do not leak any other descriptors (such as sockets accepted by
+    // other threads that are not yet close-on-exec) into the child.
+    posix_spawn_file_actions_addclosefrom_np(&actions, 3);
+#endif
+    std::vector<char*> args = toArgv(argList);
+    pid_t pid = -1;
+    if (posix_spawnp(&pid, args[0], &actions, nullptr, &args[0],
+                     environ) != 0) {
+        pid = -1;  // The program could not be run.
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    return pid;
+}
+
 // Implement the constructor
-ChildProcess::ChildProcess() : childPid(-1), childOutput(&pipeBuf) {
+ChildProcess::ChildProcess(const Launcher launcher) :
+    childPid(-1), launcher(launcher), childOutput(&pipeBuf) {
     // childPid is initialized and not assigned!  Hence body is empty.
 }
 
@@ -78,6 +122,9 @@ ChildProcess::split(const std::string& words) {
 // myExec in the child process and just return the childPid in parent.
 int
 ChildProcess::forkNexec(const StrVec& argList) {
+    if (launcher == Launcher::Spawn) {
+        return (childPid = spawn(argList));
+    }
     // Fork and save the pid of the child process
     childPid = fork();
     // Call the myExec helper method in the child
@@ -94,9 +141,12 @@ ChildProcess::forkNexec(const StrVec& argList) {
 // exitCode as shown in Slide #6 of ForkAndExec.pdf
 int
 ChildProcess::wait() const {
-    int exitCode = 0;  // Child process's exit code
-    waitpid(childPid, &exitCode, 0);  // wait for child to finish
-    return exitCode;
+    if (childPid == -1) {
+        return 127;  // The program could not be run.
+    }
+    int status = 0;  // Child process's exit status
+    waitpid(childPid, &status, 0);  // wait for child to finish
+    return exitCode(status);
 }
 
 // Method to first redirect output of child process via a pipe. Then
@@ -104,25 +154,36 @@ ChildProcess::wait() const {
 // output of the cild process can be read in the parent process via
 // the childProcess stream.
 int
-ChildProcess::forkNexecIO(const StrVec& argList) {
+ChildProcess::forkNexecIO(const StrVec& argList, const bool withStderr) {
     int pipefd[2];  // The pipe file descriptors
-    pipe(pipefd);   // Make system call to get pipe file descriptors
-
-    // Fork and save the pid of the child process.
-    childPid = fork();
+    // Make system call to get pipe file descriptors.  They are closed
+    // on exec so that other (concurrently forked) child processes
+    // don't hold on to this pipe.  dup2 below clears the flag.
+    pipe2(pipefd, O_CLOEXEC);
+
+    if (launcher == Launcher::Spawn) {
+        // The redirection is done by the file actions in spawn.
+        childPid = spawn(argList, pipefd[WRITE], withStderr);
+    } else {
+        // Fork and save the pid of the child process.
+        childPid = fork();
+    }
 
     // Appropriately tie the I/O streams of the parent and child processes.
     if (childPid == 0) {
         // In the child process
         close(pipefd[READ]);     // Close unused end (in child)
         dup2(pipefd[WRITE], 1);  // Tie/redirect std::cout of command
+        if (withStderr) {
+            dup2(pipefd[WRITE], 2);  // Also tie/redirect std::cerr
+        }
         myExec(argList);         // Run a different program
     }
 
     // When control drops here we are in the parent process.  In the
     // parent process. Wrap the pipe's end into a buffer so we can
     // read the output of our child process.
-    pipeBuf = {pipefd[READ], std::ios::in, sizeof(char)};
+    pipeBuf = {pipefd[READ], std::ios::in, BUFSIZ};
     // Note the above pipeBuf is already set to be used by
     // childOutput stream in the constructor of ChildProcess
     
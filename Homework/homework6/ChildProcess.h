@@ -9,6 +9,7 @@
  * Copyright (C) 2020 raodm@miamiOH.edu
  */
 
+#include <sys/wait.h>
 #include <ext/stdio_filebuf.h>
 #include <iostream>
 #include <string>
@@ -28,11 +29,23 @@ using StrVec = std::vector<std::string>;
  */
 class ChildProcess {
 public:
-    /** A simple default (no-argument) constructor.  This constructor
-        merely initializes (so the body of the method should be
-        empty!) the childPid instance variable to -1.
+    /** The different ways in which a child process can be launched.
+        Fork uses the classic fork() followed by execvp() in the child.
+        Spawn uses posix_spawnp(), which (on Linux) creates the child
+        with vfork-like semantics and does not copy the parent's page
+        tables.  Hence Spawn is much faster when the parent is a large
+        (multithreaded) process such as a server.
     */
-    ChildProcess();
+    enum class Launcher { Fork, Spawn };
+
+    /** A simple constructor.  This constructor merely initializes (so
+        the body of the method should be empty!) the childPid instance
+        variable to -1.
+
+        \param[in] launcher The way in which this object launches its
+        child process.
+    */
+    explicit ChildProcess(const Launcher launcher = Launcher::Fork);
     
     /** The destructor. This method cleans-up any resources (like open
         files etc.). However, this class is very simple and the
@@ -62,8 +75,12 @@ public:
      *
      * \param[in] argList The list of command-line arguments.  The
      *   first entry is assumed to be the command to be executed. 
+     *
+     * \param[in] withStderr If true, the child's standard error is
+     *   redirected to the same pipe, so that error messages are
+     *   interleaved with outputs in the order they are written.
      */
-    int forkNexecIO(const StrVec& argList);
+    int forkNexecIO(const StrVec& argList, const bool withStderr = false);
 
     /** The primary method in this class that:
 
@@ -72,6 +89,10 @@ public:
         3. In the parent process, it stores the value in childPid and
            returns the childPid value.
 
+        With the Spawn launcher, steps 1 and 2 are done by a single
+        call to posix_spawnp.  If the program could not be run, wait()
+        reports an exit code of 127 (just as a shell does).
+
         \param[in] argList The list of command-line arguments.  The
         first entry is assumed to be the command to be executed. 
           
@@ -86,10 +107,24 @@ public:
         system call.
 
         \return This method returns the exit code of the child
-        process.
+        process (see exitCode), or 127 if it could not be run.
     */
     int wait() const;
 
+    /** Convert a status returned by the wait family of system calls
+        to an exit code.
+
+        \param[in] status The status returned by waitpid or wait4.
+
+        \return The exit code of the process, or 128 plus the signal
+        number if the process was killed by a signal (as a shell
+        reports it).
+    */
+    static int exitCode(const int status) {
+        return (WIFEXITED(status) ? WEXITSTATUS(status) :
+                128 + WTERMSIG(status));
+    }
+
     /**
      * Get the stream from where the child-process's outputs can be
      * read in the parent process.  The stream returned by this method
@@ -103,6 +138,19 @@ public:
      * be read.
      */
     std::istream& getChildOutput() { return childOutput; }
+
+    /**
+     * Get the file descriptor of the pipe from where the
+     * child-process's outputs can be read.  This is useful to read
+     * the outputs in large blocks (as they are produced) rather than
+     * via the stream.  Don't mix reads from the stream and from this
+     * file descriptor.
+     *
+     * \note First call forkNexecIO() before using this method.
+     *
+     * \return The file descriptor of the read end of the pipe.
+     */
+    int getChildOutputFd() { return pipeBuf.fd(); }
     
 protected:
     /** A helper method to setup pointers and call execvp system call.
@@ -114,7 +162,35 @@ protected:
         \param[in] argList The list of command-line arguments.  The
         first entry is assumed to be the command to be executed.
     */
-    void myExec(StrVec argList);
+    void myExec(const StrVec& argList);
+
+    /** A helper method to launch the child process using
+        posix_spawnp.
+
+        \param[in] argList The list of command-line arguments.  The
+        first entry is assumed to be the command to be executed.
+
+        \param[in] outFd If not -1, the child's standard output is
+        redirected to this file descriptor.
+
+        \param[in] withStderr If true, the child's standard error is
+        also redirected to outFd.
+
+        \return The pid of the child process, or -1 if the program
+        could not be run.
+    */
+    int spawn(const StrVec& argList, const int outFd = -1,
+              const bool withStderr = false);
+
+    /** Helper method to obtain the pointers to the C-strings in a
+        list of arguments as needed by the exec and spawn system
+        calls.  The strings are not copied.
+
+        \param[in] argList The list of command-line arguments.
+
+        \return A nullptr terminated list of pointers into argList.
+    */
+    static std::vector<char*> toArgv(const StrVec& argList);
 
 private:
     /** The only instance variable in this class.  It is initialized
@@ -123,6 +199,9 @@ private:
     */
     int childPid;
 
+    /** The way in which this object launches its child process. */
+    Launcher launcher;
+
     /**
      * A wrapper class that is needed to convert a pipe handle (which
      * is an integer) to an std::istream so that we can conveniently
@@ -0,0 +1,134 @@
+#ifndef FILE_CACHE_CPP
+#define FILE_CACHE_CPP
+
+/**
+ * An in-memory cache of small static files used by http::file.
+ *
+ * Copyright 2021 zarembmj@miamioh.edu
+ */
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include "FileCache.h"
+#include "HTTPFile.h"
+
+// Helper method to check if an entry is still current for a file.
+static bool isCurrent(const http::FileCache::Entry& entry,
+                      const struct stat& info) {
+    return (entry.size == info.st_size) && (entry.inode == info.st_ino) &&
+        (entry.mtime.tv_sec == info.st_mtim.tv_sec) &&
+        (entry.mtime.tv_nsec == info.st_mtim.tv_nsec);
+}
+
+// Look up a file, loading it into the cache if needed.
+http::FileCache::EntryPtr
+http::FileCache::get(const std::string& path, const std::string& headers) {
+    struct stat info;
+    if ((stat(path.c_str(), &info) == -1) || !S_ISREG(info.st_mode) ||
+        (static_cast<size_t>(info.st_size) > maxFileSize)) {
+        return nullptr;  // Nothing to cache
+    }
+    // The same file may be sent with different headers.
+    const std::string key = headers + '\n' + path;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        const auto entry = index.find(key);
+        if (entry != index.end()) {
+            if (isCurrent(*entry->second->second, info)) {
+                // Move the entry to the front of the LRU list.
+                lru.splice(lru.begin(), lru, entry->second);
+                return entry->second->second;
+            }
+            erase(key);  // The file has changed on disk.
+        }
+    }
+    // Read the file without holding the lock.  Concurrent misses on
+    // the same file may read it more than once, but that is harmless.
+    EntryPtr entry = load(path, headers);
+    if (entry != nullptr) {
+        std::lock_guard<std::mutex> lock(mutex);
+        erase(key);  // In case another thread loaded it meanwhile
+        insert(key, entry);
+    }
+    return entry;
+}
+
+// Remove all entries.
+void
+http::FileCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    lru.clear();
+    index.clear();
+    bytes = 0;
+}
+
+// Read a file and serialize its headers.
+http::FileCache::EntryPtr
+http::FileCache::load(const std::string& path,
+                      const std::string& headers) const {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return nullptr;
+    }
+    // Validate against the file that was actually opened.
+    struct stat info;
+    auto entry = std::make_shared<Entry>();
+    bool ok = (fstat(fd, &info) == 0) && S_ISREG(info.st_mode) &&
+        (static_cast<size_t>(info.st_size) <= maxFileSize);
+    if (ok) {
+        entry->data.resize(info.st_size);
+        for (size_t done = 0; ok && (done < entry->data.size());) {
+            const ssize_t len = read(fd, &entry->data[done],
+                                     entry->data.size() - done);
+            ok = (len > 0);
+            done += (ok ? len : 0);
+        }
+    }
+    close(fd);
+    if (!ok) {
+        return nullptr;  // Changed while being read. Don't cache it.
+    }
+    entry->headers = headers + http::getContentType(path) +
+        "\r\nContent-Length: " + std::to_string(info.st_size) + "\r\n\r\n";
+    entry->mtime = info.st_mtim;
+    entry->size  = info.st_size;
+    entry->inode = info.st_ino;
+    return entry;
+}
+
+// Add an entry, evicting the least recently used ones as needed.
+void
+http::FileCache::insert(const std::string& key, EntryPtr entry) {
+    const size_t size = entry->data.size() + entry->headers.size();
+    while (!lru.empty() && (bytes + size > maxBytes)) {
+        erase(std::string(lru.back().first));
+    }
+    if (size <= maxBytes) {
+        lru.push_front({key, std::move(entry)});
+        index[key] = lru.begin();
+        bytes += size;
+    }
+}
+
+// Remove an entry if it exists.
+void
+http::FileCache::erase(const std::string& key) {
+    const auto entry = index.find(key);
+    if (entry != index.end()) {
+        const EntryPtr& value = entry->second->second;
+        bytes -= value->data.size() + value->headers.size();
+        lru.erase(entry->second);
+        index.erase(entry);
+    }
+}
+
+// The cache shared by all http::file objects.
+http::FileCache&
+http::fileCache() {
+    static FileCache cache;
+    return cache;
+}
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+/**
+ * An in-memory cache of small static files used by http::file.  Each
+ * entry holds the contents of a file together with the fully
+ * serialized HTTP response headers for it, so a cache hit can be sent
+ * to the client with a single system call.
+ *
+ * Copyright 2021 zarembmj@miamioh.edu
+ */
+
+#include <sys/types.h>
+#include <ctime>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace http {
+    /**
+     * A size-bounded LRU cache of files.  Entries are validated against
+     * the file's modification time, size, and inode (via one stat()
+     * call) on every lookup, so a file that is changed or replaced on
+     * disk is re-read on the next request.
+     *
+     * \note All the methods in this class are MT-safe.
+     */
+    class FileCache {
+    public:
+        /** A file in the cache.  Entries are never changed once they
+            are created, so they can be sent without holding any lock.
+        */
+        struct Entry {
+            // The complete 200 OK headers (with Content-Length).
+            std::string headers;
+            // The contents of the file.
+            std::string data;
+            // The properties of the file used to validate the entry.
+            struct timespec mtime;
+            off_t size;
+            ino_t inode;
+        };
+
+        /** Shortcut to a shared pointer to an immutable entry. */
+        using EntryPtr = std::shared_ptr<const Entry>;
+
+        /** The constructor.
+
+            \param[in] maxBytes The maximum total size of the files in
+            the cache.
+
+            \param[in] maxFileSize The size of the largest file that is
+            cached. Larger files are always sent from disk.
+        */
+        explicit FileCache(size_t maxBytes = 32 << 20,
+                           size_t maxFileSize = 1 << 20) :
+            maxBytes(maxBytes), maxFileSize(maxFileSize), bytes(0) {}
+
+        /** Obtain the cached entry for a file, reading the file into
+            the cache if it is not already there (or has changed).
+
+            \param[in] path The path to the file.
+
+            \param[in] headers The 200 OK headers (ending with
+            "Content-Type: ") to be used for the file.
+
+            \return The entry for the file.  This method returns
+            nullptr if the file does not exist or is not cacheable
+            (e.g., it is too big or is not a regular file).
+        */
+        EntryPtr get(const std::string& path, const std::string& headers);
+
+        /** Remove all the entries from the cache. */
+        void clear();
+
+    private:
+        // Helper method to read a file and create an entry for it.
+        EntryPtr load(const std::string& path,
+                      const std::string& headers) const;
+
+        // Helper method to add an entry, evicting the least recently
+        // used entries to make room for it.  Caller must hold mutex.
+        void insert(const std::string& key, EntryPtr entry);
+
+        // Helper method to remove an entry.  Caller must hold mutex.
+        void erase(const std::string& key);
+
+        // The list of (key, entry) pairs with the most recently used
+        // entries at the front.
+        using LruList = std::list<std::pair<std::string, EntryPtr>>;
+
+        // The limits on the size of the cache and of cached files.
+        const size_t maxBytes, maxFileSize;
+        // The total size of the files currently in the cache.
+        size_t bytes;
+        // The entries in the order in which they were used.
+        LruList lru;
+        // The entries indexed by their key (the headers and the path).
+        std::unordered_map<std::string, LruList::iterator> index;
+        // The mutex that protects all of the above instance variables.
+        std::mutex mutex;
+    };
+
+    /** The cache used by http::file for all the files it sends. */
+    FileCache& fileCache();
+}  // namespace http
+
+#endif
@@ -7,15 +7,28 @@
  *
  * Copyright (C) 2020 raodm@miamioh.edu
  */
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <cerrno>
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <vector>
 #include "HTTPFile.h"
+#include "FileCache.h"
 
 // Convenience method to determine the content-type of a given file.
 std::string http::getContentType(const std::string& path) {
-    // Extract the extension from the path.
-    const std::string ext = path.substr(path.rfind('.'));
+    // Extract the extension (if any) from the path.
+    const size_t dot = path.rfind('.');
+    const std::string ext = (dot == std::string::npos ? "" : path.substr(dot));
     // Return suitable content types for the different types that we know.
     if (ext == ".html") {
         return "text/html";
@@ -32,33 +45,203 @@ std::string http::getContentType(const std::string& path) {
     return "text/plain";
 }
 
+// Helper method to open a file to be sent and obtain its size.  The
+// file descriptor is -1 if the file cannot be opened or is a
+// directory.
+static int openFile(const std::string& path, struct stat& info) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if ((fd != -1) && ((fstat(fd, &info) == -1) || S_ISDIR(info.st_mode))) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Helper method to generate the 404 response for a missing file.
+static std::string notFound(const std::string& path) {
+    const std::string msg = "File not found: " + path;
+    std::ostringstream os;
+    os << http::Http404Headers << std::hex << msg.size() << "\r\n"
+       << msg << "\r\n0\r\n\r\n";
+    return os.str();
+}
+
+// Helper method to generate the 200 headers for a file.  Regular
+// files are sent with a Content-Length.  Otherwise the size is not
+// known up front and the data is sent in chunks.
+static std::string okHeaders(const std::string& path,
+                             const std::string& headers,
+                             const struct stat& info) {
+    std::ostringstream os;
+    os << headers << http::getContentType(path) << "\r\n";
+    if (S_ISREG(info.st_mode)) {
+        os << "Content-Length: " << info.st_size << "\r\n\r\n";
+    } else {
+        os << "Transfer-Encoding: chunked\r\n\r\n";
+    }
+    return os.str();
+}
+
+// Helper method to send the data read from a file (whose size is not
+// known) as large HTTP chunks via a given write function that returns
+// false on errors.
+template <typename WriteFunc>
+static bool sendChunks(const int fd, WriteFunc write) {
+    std::vector<char> buf(http::ChunkSize);
+    std::ostringstream size;
+    ssize_t len;
+    while ((len = read(fd, buf.data(), buf.size())) > 0) {
+        size.str("");
+        size << std::hex << len << "\r\n";
+        if (!write(size.str().data(), size.str().size()) ||
+            !write(buf.data(), len) || !write("\r\n", 2)) {
+            return false;
+        }
+    }
+    // Finally send the trailing "0" chunk to finish the HTTP-response.
+    return write("0\r\n\r\n", 5);
+}
+
 // The operator that HTTP-streams the file if valid or sends a 404 error.
 std::ostream& http::operator<<(std::ostream& os, const http::file& file) {
-    // First open the data file and if the stream is not good return 404
-    std::ifstream data(file.path);
-    if (!data.good()) {
+    // Small files are sent straight from the cache.
+    if (const auto entry = http::fileCache().get(file.path, file.headers)) {
+        os << entry->headers;
+        return os.write(entry->data.data(), entry->data.size());
+    }
+    // First open the data file and if it is not valid return 404
+    struct stat info;
+    const int fd = openFile(file.path, info);
+    if (fd == -1) {
         // The file name is invalid. Send HTTP 404 error message.
-        const std::string msg = "File not found: " + file.path;
-        os << http::Http404Headers;  // Send headers
-        os << std::hex << msg.size() << "\r\n" << msg << "\r\n";
-    } else {
-        // The file is valid. Let's send the 200 header and stream the
-        // contents of the file to the client.
-        os << file.headers << http::getContentType(file.path) << "\r\n\r\n";
-        // Now stream the contents out.
-        for (std::string line; std::getline(data, line);) {
-            // Note that std::getline() consumes/removes '\n'. So,
-            // below we add the '\n' back because that was actually
-            // present in the original data and it must be included.
-            line += '\n';
-            // Write the line of data as an HTTP-chunk
-            os << std::hex << line.size() << "\r\n" << line << "\r\n";
+        return os << notFound(file.path);
+    }
+    // The file is valid. Let's send the 200 header and the contents
+    // of the file to the client.
+    os << okHeaders(file.path, file.headers, info);
+    if (!S_ISREG(info.st_mode)) {
+        sendChunks(fd, [&os](const char* data, const size_t len) {
+                return os.write(data, len).good(); });
+    } else if (info.st_size > 0) {
+        // Map the file and write it out in one shot.  The bytes are
+        // written as is, so binary files are sent exactly.
+        void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE,
+                          fd, 0);
+        if (data != MAP_FAILED) {
+            madvise(data, info.st_size, MADV_SEQUENTIAL);
+            os.write(static_cast<const char*>(data), info.st_size);
+            munmap(data, info.st_size);
+        } else {
+            std::vector<char> buf(http::ChunkSize);
+            for (ssize_t len; (len = read(fd, buf.data(), buf.size())) > 0;) {
+                os.write(buf.data(), len);
+            }
         }
     }
-    // Finally send the trailing "0" chunk to finish the HTTP-response.
-    os << "0\r\n\r\n";
+    close(fd);
     // Return stream as part of the operator<< API requirement
     return os;
 }
 
+// The longest time to wait for a client to accept more data.
+static const int SendTimeoutMillis = 30000;
+
+// Helper method to check the result of a write to a socket.  The
+// sockets of boost::asio streams are non-blocking, so a full socket
+// buffer (EAGAIN) is waited out here.  This method returns true if the
+// write should be retried and false if the client is gone (e.g., EPIPE).
+static bool canRetry(const int sock, const ssize_t sent) {
+    if (sent > 0) {
+        return true;
+    }
+    if ((sent == -1) && (errno == EINTR)) {
+        return true;
+    }
+    if ((sent == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+        pollfd pfd = {sock, POLLOUT, 0};
+        return poll(&pfd, 1, SendTimeoutMillis) > 0;
+    }
+    return false;
+}
+
+// Helper method to write all the given bytes to a socket.  If the
+// client has closed the connection, this method just returns false
+// (EPIPE) instead of raising SIGPIPE.
+static bool writeAll(const int sock, const char* data, size_t len) {
+    while (len > 0) {
+        const ssize_t sent = send(sock, data, len, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            if (canRetry(sock, sent)) {
+                continue;
+            }
+            return false;
+        }
+        data += sent;
+        len  -= sent;
+    }
+    return true;
+}
+
+// Helper method to write the headers and data of a cached file to a
+// socket with a single system call (unless the socket is congested).
+// Just like writeAll, a closed connection is reported as false.
+static bool writeEntry(const int sock, const http::FileCache::Entry& entry) {
+    iovec iov[2] = {{const_cast<char*>(entry.headers.data()),
+                     entry.headers.size()},
+                    {const_cast<char*>(entry.data.data()), entry.data.size()}};
+    for (int first = 0; (first < 2);) {
+        msghdr msg = {};
+        msg.msg_iov    = iov + first;
+        msg.msg_iovlen = 2 - first;
+        const ssize_t sent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            if (canRetry(sock, sent)) {
+                continue;
+            }
+            return false;
+        }
+        // Skip over the bytes that were written.
+        size_t left = sent;
+        for (; (first < 2) && (left >= iov[first].iov_len); first++) {
+            left -= iov[first].iov_len;
+        }
+        if (first < 2) {
+            iov[first].iov_base = static_cast<char*>(iov[first].iov_base) +
+                left;
+            iov[first].iov_len -= left;
+        }
+    }
+    return true;
+}
+
+// Send the response for the file to a socket using sendfile().
+bool http::file::sendTo(const int sock) const {
+    // Small files are sent straight from the cache.
+    if (const auto entry = http::fileCache().get(path, headers)) {
+        return writeEntry(sock, *entry);
+    }
+    struct stat info;
+    const int fd = openFile(path, info);
+    if (fd == -1) {
+        const std::string msg = notFound(path);
+        return writeAll(sock, msg.data(), msg.size());
+    }
+    const std::string hdrs = okHeaders(path, headers, info);
+    bool ok = writeAll(sock, hdrs.data(), hdrs.size());
+    if (ok && !S_ISREG(info.st_mode)) {
+        ok = sendChunks(fd, [sock](const char* data, const size_t len) {
+                return writeAll(sock, data, len); });
+    } else if (ok) {
+        // Have the kernel copy the file from the page cache.  Note that
+        // sendfile() raises SIGPIPE (see sendTo in HTTPFile.h).
+        for (off_t offset = 0; ok && (offset < info.st_size);) {
+            const ssize_t sent = sendfile(sock, fd, &offset,
+                                          info.st_size - offset);
+            ok = canRetry(sock, sent);
+        }
+    }
+    close(fd);
+    return ok;
+}
+
 # endif
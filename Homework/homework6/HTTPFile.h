@@ -18,14 +18,20 @@ namespace http {
      * The defaut HTTP headers used when sending file contents to a
      * web-client.  NOTE: The content-type header must always be the
      * last in the set of headers so that this class can easily write
-     * content-type.
+     * content-type.  These headers must not include Content-Length or
+     * Transfer-Encoding as this class adds the suitable one.
      */
     const std::string DefaultHttpHeaders =
         "HTTP/1.1 200 OK\r\n"
-        "Transfer-Encoding: chunked\r\n"
         "Connection: Close\r\n"
         "Content-Type: ";
 
+    /**
+     * The size of the chunks in which the file is sent when its size
+     * is not known up front (e.g., if the path is a named pipe).
+     */
+    const size_t ChunkSize = 65536;
+
     /**
      * A fixed HTTP-404 error HTTP header that is sent to the client
      * if a specified file was not found on the server.
@@ -61,6 +67,27 @@ namespace http {
              const std::string& headers = DefaultHttpHeaders) :
             path(path), headers(headers) {}
 
+        /** Send the HTTP response for the file directly to a socket.
+            Regular files are sent using sendfile() so that the data
+            is copied from the page cache to the socket by the kernel,
+            without passing through this process.
+
+            \note Any data buffered in a stream on the socket must be
+            flushed before calling this method.
+
+            \note sendfile() cannot be told not to raise SIGPIPE.  So
+            the program must ignore SIGPIPE; otherwise a client that
+            closes its connection during a download kills the program.
+
+            \param[in] sock The file descriptor of the socket to which
+            the response is to be written.
+
+            \return This method returns false if the response could
+            not be completely written to the socket, e.g., because the
+            client closed the connection (EPIPE).
+        */
+        bool sendTo(int sock) const;
+
     private:
         /**
          * Path to the file to be streamed out by this class. This
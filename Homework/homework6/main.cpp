@@ -1,5 +1,17 @@
 #include <boost/asio.hpp>
 #include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <queue>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <unistd.h>
+#include <fcntl.h>
 #include "HTTPFile.h"
 #include "ChildProcess.h"
 
@@ -13,6 +25,145 @@ using namespace boost::asio::ip;
 // students).
 std::string url_decode(std::string url);
 
+// Shortcut to smart pointer with TcpStream
+using TcpStreamPtr = std::shared_ptr<tcp::iostream>;
+
+/** The prefix of URLs that are requests to run a command. */
+const std::string CgiPrefix = "/cgi-bin/exec?cmd=";
+
+/** The HTTP headers sent along with the outputs of a command. */
+const std::string CgiHttpHeaders =
+    "HTTP/1.1 200 OK\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "Trailer: X-Exit-Code\r\n"
+    "Connection: Close\r\n"
+    "Content-Type: text/plain\r\n\r\n";
+
+/** The size of the blocks in which the outputs of a command are read. */
+const size_t CgiBlockSize = 65536;
+
+/**
+ * A simple unbounded MT-safe queue to hand off connections from one
+ * set of threads to another.
+ */
+template <typename T>
+class WorkQueue {
+public:
+    /** Add an entry to the queue and wake up one waiting thread.
+
+        \param[in] item The entry to be added.
+    */
+    void push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        items.push(std::move(item));
+        lock.unlock();
+        notEmpty.notify_one();
+    }
+
+    /** Remove the oldest entry, waiting until one is available.
+
+        \return The oldest entry in the queue.
+    */
+    T pop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this] { return !items.empty(); });
+        T item = std::move(items.front());
+        items.pop();
+        return item;
+    }
+
+private:
+    // The entries in the queue.
+    std::queue<T> items;
+    // The mutex that protects the entries.
+    std::mutex mutex;
+    // Signaled when an entry is added.
+    std::condition_variable notEmpty;
+};
+
+/**
+ * Read a HTTP request (the first line & headers) from the client.
+ *
+ * @param is The input stream to read HTTP reqeust data from client
+ * (or web-browser).
+ *
+ * @return The decoded path from the GET request, e.g.,
+ * "/cgi-bin/exec?cmd=ls -l".  The path is empty if the request
+ * could not be read.
+ */
+std::string readRequest(std::istream& is) {
+    std::string method, path, line;
+    is >> method >> path;
+    // Skip over the rest of the first line and the headers
+    while (std::getline(is, line) && !line.empty() && (line != "\r")) {}
+    return url_decode(path);
+}
+
+/**
+ * Send the contents of a file as the HTTP response.  If the output
+ * stream is connected to a socket, the file is sent directly to the
+ * socket (via sendfile or from the file cache).
+ *
+ * @param path The path of the file (with the leading '/').
+ *
+ * @param os The output stream to send the HTTP response to.
+ */
+void serveFile(const std::string& path, std::ostream& os) {
+    const http::file file(path.substr(1));
+    auto client = dynamic_cast<tcp::iostream*>(&os);
+    if (client != nullptr) {
+        client->flush();
+        if (!file.sendTo(client->rdbuf()->native_handle())) {
+            client->setstate(std::ios::badbit);  // The client is gone
+        }
+    } else {
+        os << file;
+    }
+}
+
+/**
+ * Run a command and stream its outputs (and error messages) to the
+ * client as HTTP chunks.  The outputs are read from the pipe in large
+ * blocks and each block is sent as soon as it is read, so the client
+ * sees outputs while the command is still running.  The exit code of
+ * the command is sent in an "X-Exit-Code" trailer.
+ *
+ * @param cmd The command with its command-line arguments, e.g.,
+ * "ls -l".
+ *
+ * @param os The output stream to send the HTTP response to.
+ */
+void serveCgi(const std::string& cmd, std::ostream& os) {
+    // Spawn the command to avoid copying this (big) server process.
+    ChildProcess child(ChildProcess::Launcher::Spawn);
+    child.forkNexecIO(ChildProcess::split(cmd), true);
+    os << CgiHttpHeaders << std::flush;
+    // Send whatever the command has written so far as 1 chunk.  The
+    // data is read leaving room in front for the chunk's size so that
+    // the whole chunk is sent with 1 write.
+    const size_t HeadRoom = 10;  // Up to 8 hex digits + "\r\n"
+    std::vector<char> buf(HeadRoom + CgiBlockSize + 2);
+    for (ssize_t len; (len = read(child.getChildOutputFd(), &buf[HeadRoom],
+                                  CgiBlockSize)) != 0;) {
+        if (len == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        char size[HeadRoom + 1];
+        const int sizeLen = snprintf(size, sizeof(size), "%zx\r\n", len);
+        std::copy_n(size, sizeLen, &buf[HeadRoom - sizeLen]);
+        std::copy_n("\r\n", 2, &buf[HeadRoom + len]);
+        os.write(&buf[HeadRoom - sizeLen], sizeLen + len + 2) << std::flush;
+    }
+    const int exitCode = child.wait();
+    // Finally send the trailing "0" chunk and the exit code.
+    const std::string trailer = "0\r\nX-Exit-Code: " +
+        std::to_string(exitCode) + "\r\n\r\n";
+    os.write(trailer.data(), trailer.size()) << std::flush;
+}
+
 /**
  * Process HTTP request (from first line & headers) and provide
  * suitable HTTP response back to the client.  This method handles
@@ -33,27 +184,76 @@ std::string url_decode(std::string url);
  * to the client (or web-browser).
  */
 void serveClient(std::istream& is, std::ostream& os) {
-    // Process the GET request from the input stream. See example
-    // inputs for the format of the URLs that you will be provided.
-    
-    // To send contents of a file as HTTP chunks, the code is very
-    // simple:
-    //   const std::string path = file_name_from_GET_resut
-    //   os << http::file(path);
+    const std::string path = readRequest(is);
+    if (path.find(CgiPrefix) == 0) {
+        serveCgi(path.substr(CgiPrefix.size()), os);
+    } else if (!path.empty()) {
+        serveFile(path, os);
+    }
 }
 
+/**
+ * The top-level method for each thread that runs commands.  The
+ * number of these threads limits the number of commands that run at
+ * the same time.
+ *
+ * @param cgiQueue The queue of connections (and the command to be
+ * run for each) waiting to run a command.
+ */
+void cgiThread(WorkQueue<std::pair<TcpStreamPtr, std::string>>& cgiQueue) {
+    while (true) {
+        const auto request = cgiQueue.pop();
+        serveCgi(request.second, *request.first);
+    }
+}
 
-//------------------------------------------------------------------
-//  DO  NOT  MODIFY  CODE  BELOW  THIS  LINE
-//------------------------------------------------------------------
+/**
+ * The top-level method for each thread that reads requests.  File
+ * requests are served right away.  Command requests are handed off to
+ * the CGI threads so that they never hold up file requests.
+ *
+ * @param clients The queue of accepted connections.
+ *
+ * @param cgiQueue The queue of connections waiting to run a command.
+ */
+void clientThread(WorkQueue<TcpStreamPtr>& clients,
+                  WorkQueue<std::pair<TcpStreamPtr, std::string>>& cgiQueue) {
+    while (true) {
+        const TcpStreamPtr client = clients.pop();
+        const std::string path = readRequest(*client);
+        if (path.find(CgiPrefix) == 0) {
+            cgiQueue.push({client, path.substr(CgiPrefix.size())});
+        } else if (!path.empty()) {
+            serveFile(path, *client);
+        }
+    }
+}
 
 /**
- * Runs the program as a server.  It accepts connections and listens
- * to incoming connections.
+ * Mark a socket close-on-exec so that the commands run by the CGI
+ * threads do not inherit it.  Otherwise a command holds on to other
+ * clients' connections (and the listening port) until it finishes.
+ *
+ * @param fd The socket's file descriptor.
+ */
+void setCloseOnExec(const int fd) {
+    fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+}
+
+/**
+ * Runs the program as a server.  It accepts connections and hands
+ * them off to a pool of worker threads, so that connections are
+ * processed concurrently.
  * 
  * @param port The port number on which the server should listen.
+ *
+ * @param numThreads The number of threads that read requests and
+ * serve files.
+ *
+ * @param maxCgi The maximum number of commands that can run at the
+ * same time.  Further command requests wait for one to finish.
  */
-void runServer(int port) {
+void runServer(int port, const int numThreads, const int maxCgi) {
     // Setup a server socket to accept connections on the socket
     io_service service;
     // Create end point.  If the port number is zero, then myEndpoint
@@ -62,21 +262,35 @@ void runServer(int port) {
     tcp::endpoint myEndpoint(tcp::v4(), port);
     // Create a socket that accepts connections
     tcp::acceptor server(service, myEndpoint);
+    setCloseOnExec(server.native_handle());
     std::cout << "Server is listening on "
               << server.local_endpoint().port()
               << " & ready to process clients...\n";
-    // Process client connections one-by-one...forever
+    // Start the worker threads.  They refer to the queues, which is
+    // safe because this method never returns.
+    WorkQueue<TcpStreamPtr> clients;
+    WorkQueue<std::pair<TcpStreamPtr, std::string>> cgiQueue;
+    for (int i = 0; (i < numThreads); i++) {
+        std::thread(clientThread, std::ref(clients),
+                    std::ref(cgiQueue)).detach();
+    }
+    for (int i = 0; (i < maxCgi); i++) {
+        std::thread(cgiThread, std::ref(cgiQueue)).detach();
+    }
+    // Accept client connections...forever
     while (true) {
-        // Wait for a client to connect.
-        tcp::iostream client;
-        // The following method calls waits (could wait forever) until
-        // a client connects.
-        server.accept(*client.rdbuf());
-        // Have helper method process the client connection.
-        serveClient(client, client);
+        // Wait for a client to connect and hand it off to a worker.
+        TcpStreamPtr client = std::make_shared<tcp::iostream>();
+        server.accept(*client->rdbuf());
+        setCloseOnExec(client->rdbuf()->native_handle());
+        clients.push(client);
     }
 }
 
+//------------------------------------------------------------------
+//  DO  NOT  MODIFY  CODE  BELOW  THIS  LINE
+//------------------------------------------------------------------
+
 /** Convenience method to decode HTML/URL encoded strings.
 
     This method must be used to decode query string parameters
@@ -108,16 +322,22 @@ std::string url_decode(std::string str) {
     return str;
 }
 
+// The benchmarks (see ../benchmarks) link this file without main().
+#ifndef BENCHMARK
+
 /**
  * The main function that serves as a test harness based on
  * command-line arguments.
  *
  * \param[in] argc The number of command-line arguments.  This test
- * harness can work with zero or one command-line argument.
+ * harness can work with zero to three command-line arguments.
  *
- * \param[in] argv The actual command-line arguments.  If this is an
- * number it is assumed to be a port number.  Otherwise it is assumed
- * to be an file name that contains inputs for testing.
+ * \param[in] argv The actual command-line arguments.  If the first
+ * one is an number it is assumed to be a port number.  Otherwise it
+ * is assumed to be an file name that contains inputs for testing.
+ * When running as a server, the optional second and third arguments
+ * are the number of worker threads (default 16) and the maximum
+ * number of commands that can run at the same time (default 4).
  */
 int main(int argc, char *argv[]) {
     // Check and use first command-line argument if any as port or file
@@ -126,8 +346,12 @@ int main(int argc, char *argv[]) {
     // Check and use a given input data file for testing.
     if (arg.find_first_not_of("1234567890") == std::string::npos) {
         // All characters are digits. So we assume this is a port
-        // number and run as a standard web-server
-        runServer(std::stoi(arg));
+        // number and run as a standard web-server.  A client that
+        // closes its connection early must not kill the server via
+        // SIGPIPE (see http::file::sendTo).
+        signal(SIGPIPE, SIG_IGN);
+        runServer(std::stoi(arg), (argc > 2 ? std::stoi(argv[2]) : 16),
+                  (argc > 3 ? std::stoi(argv[3]) : 4));
     } else {
         // In this situation, this program processes inputs from a
         // given data file for testing.  That is, instead of a
@@ -144,3 +368,5 @@ int main(int argc, char *argv[]) {
     // All done.
     return 0;
 }
+
+#endif  // BENCHMARK
@@ -0,0 +1,516 @@
+#ifndef HTTP_CLIENT_H
+#define HTTP_CLIENT_H
+
+/**
+ * A simple HTTP/1.1 client that reuses connections.  Connections to
+ * each host are kept open (keep-alive) in a pool after a response has
+ * been read so that subsequent requests to the same host do not pay
+ * for a new connection.  The addresses of hosts are cached for a
+ * while so that they are not resolved for every request.  The number
+ * of concurrent connections to each host is limited.  The body of a
+ * response is read as a std::istream that handles both Content-Length
+ * and chunked responses.
+ *
+ * This file is shared (as a copy) by homework1, homework5, and
+ * homework7.
+ *
+ * Copyright 2021 zarembmj@miamioh.edu
+ */
+
+#include <boost/asio.hpp>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <condition_variable>
+#include <istream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// ------------------------------------------------------------------- //
+// ****  NOTE: NEVER NEVER put "using namespace" IN A HEADER FILE  *** //
+// ------------------------------------------------------------------- //
+
+/**
+ * An HTTP client with a per-host connection pool and a DNS cache.
+ * All the methods in this class are MT-safe.
+ */
+class HttpClient {
+public:
+    /** Shortcut to a connection to a server. */
+    using Connection = boost::asio::ip::tcp::iostream;
+
+    /** Shortcut to a list of (name, value) request headers. */
+    using Headers = std::vector<std::pair<std::string, std::string>>;
+
+    /** A response from a server.  The connection used for the response
+        is returned to the pool when this object is destroyed, provided
+        the whole body has been read (or is small enough to be skipped)
+        and the server did not close the connection.
+    */
+    class Response {
+    public:
+        /** The status code of the response (0 if there was no valid
+            response).
+        */
+        int status = 0;
+
+        /** The headers of the response.  The names are in lowercase. */
+        std::unordered_map<std::string, std::string> headers;
+
+        /** The destructor returns the connection to the pool. */
+        ~Response() {
+            if (client != nullptr) {
+                // Check the connection before it is moved out of conn.
+                const bool reuse = reusable();
+                client->release(key, std::move(conn), reuse);
+            }
+        }
+
+        /** The stream from where the body of the response is read.
+            This stream reaches EOF at the end of the body, or earlier
+            if the body could not be read in full (see complete()).
+        */
+        std::istream& body() { return bodyStream; }
+
+        /** Check, after reading the body, if the whole body arrived.
+
+            \return This method returns false if the body was cut short,
+            e.g., because the connection was closed before the end of
+            the body or the server stayed silent for too long.
+        */
+        bool complete() const { return bodyBuf.complete(); }
+
+        /** Obtain the value of a header.
+
+            \param[in] name The name of the header in lowercase.
+
+            \return The value of the header ("" if it is not present).
+        */
+        std::string header(const std::string& name) const {
+            const auto entry = headers.find(name);
+            return (entry == headers.end() ? "" : entry->second);
+        }
+
+        /** Convenience method to read the whole body into a string. */
+        std::string readBody() {
+            return {std::istreambuf_iterator<char>(bodyStream), {}};
+        }
+
+    private:
+        friend class HttpClient;
+
+        /** A stream buffer that reads the body of a response from a
+            connection, stopping at its end.
+        */
+        class BodyBuf : public std::streambuf {
+        public:
+            // Read nothing (and be incomplete) until setup() is called.
+            BodyBuf() { setg(buf, buf, buf); }
+
+            // Set the connection, how the end of the body is found, and
+            // how long each read may wait for data.
+            void setup(Connection* conn, const long long length,
+                       const bool chunked,
+                       const std::chrono::seconds idleTimeout) {
+                this->conn = conn;
+                remaining  = length;
+                this->chunked = chunked;
+                this->idleTimeout = idleTimeout;
+                done   = (!chunked && (length == 0));
+                failed = false;
+            }
+
+            // True if the whole body has been read without errors.
+            bool complete() const { return done && !failed; }
+
+            // Read and discard the rest of the body if it's small.
+            bool skipRest() {
+                for (size_t skipped = 0; !done && !failed &&
+                         (skipped < MaxSkip); skipped += egptr() - gptr()) {
+                    setg(buf, egptr(), egptr());
+                    underflow();
+                }
+                return complete();
+            }
+
+        protected:
+            int_type underflow() override {
+                if (gptr() < egptr()) {
+                    return traits_type::to_int_type(*gptr());
+                }
+                if (!done && !failed) {
+                    // The timeout is for the next data, not the body.
+                    conn->expires_after(idleTimeout);
+                }
+                if (!done && !failed && chunked && (remaining == 0)) {
+                    nextChunk();
+                }
+                if (done || failed) {
+                    return traits_type::eof();
+                }
+                long long want = sizeof(buf);
+                if (remaining >= 0) {
+                    want = std::min(want, remaining);
+                }
+                // Wait only for the first byte, and then take what has
+                // arrived, so that the timeout applies to each read.
+                std::streambuf* const sock = conn->rdbuf();
+                long long got = 0;
+                if (sock->sgetc() != traits_type::eof()) {
+                    got = sock->sgetn(buf, std::min<long long>(
+                                          want, sock->in_avail()));
+                }
+                if (got == 0) {
+                    // The server closed the connection (or timed out).
+                    // A close is the end of the body only if its
+                    // length is not known.
+                    done = true;
+                    failed = (remaining >= 0) ||
+                        (conn->error() != boost::asio::error::eof);
+                    return traits_type::eof();
+                }
+                if (remaining >= 0) {
+                    remaining -= got;
+                    done = !chunked && (remaining == 0);
+                }
+                setg(buf, buf, buf + got);
+                return traits_type::to_int_type(*gptr());
+            }
+
+        private:
+            // Read the size of the next chunk (and the trailers after
+            // the last chunk).
+            void nextChunk() {
+                std::string line;
+                if (started) {
+                    std::getline(*conn, line);  // CRLF after the data
+                }
+                started = true;
+                if (!std::getline(*conn, line)) {
+                    failed = true;
+                    return;
+                }
+                remaining = std::strtoll(line.c_str(), nullptr, 16);
+                if (remaining == 0) {
+                    while (std::getline(*conn, line) && (line != "\r") &&
+                           !line.empty()) {}
+                    done = true;
+                    failed = !*conn;
+                }
+            }
+
+            // The largest body remainder skipped to reuse a connection.
+            static constexpr size_t MaxSkip = 64 * 1024;
+
+            Connection* conn = nullptr;
+            char buf[16 * 1024];
+            long long remaining = -1;  // Bytes left (in chunk) or -1
+            std::chrono::seconds idleTimeout{0};
+            bool chunked = false, started = false;
+            // A response without a body set up (e.g., no response was
+            // read) is never complete.
+            bool done = true, failed = true;
+        };
+
+        // Only HttpClient creates responses.
+        Response() : bodyStream(&bodyBuf) {}
+
+        // True if the connection can be used for another request.
+        bool reusable() {
+            return keepAlive && (conn != nullptr) && bodyBuf.skipRest();
+        }
+
+        HttpClient* client = nullptr;     // The client to return conn to
+        std::string key;                  // The pool for the connection
+        std::unique_ptr<Connection> conn;  // The connection
+        bool keepAlive = false;  // False if server closes the connection
+        BodyBuf bodyBuf;
+        std::istream bodyStream;
+    };
+
+    /** Shortcut to a pointer to a response. */
+    using ResponsePtr = std::unique_ptr<Response>;
+
+    /** The constructor.
+
+        \param[in] maxPerHost The maximum number of concurrent
+        connections to each host.  Requests wait for a free connection
+        when this many requests to the host are in progress.
+
+        \param[in] dnsTtl How long the addresses of a host are cached.
+
+        \param[in] timeout The maximum time a request may wait for the
+        server: to connect, to send the response headers, and for each
+        further part of the body.  A body that keeps arriving may take
+        longer.
+    */
+    explicit HttpClient(const size_t maxPerHost = 8,
+                        const std::chrono::seconds dnsTtl =
+                        std::chrono::seconds(60),
+                        const std::chrono::seconds timeout =
+                        std::chrono::seconds(30)) :
+        maxPerHost(std::max<size_t>(1, maxPerHost)), dnsTtl(dnsTtl),
+        timeout(timeout) {}
+
+    /** Change the maximum number of concurrent connections to each
+        host.
+
+        \param[in] maxPerHost The new limit (at least 1).
+    */
+    void setMaxPerHost(const size_t maxPerHost) {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->maxPerHost = std::max<size_t>(1, maxPerHost);
+        for (auto& host : hosts) {
+            host.second.available.notify_all();
+        }
+    }
+
+    /** Obtain the maximum number of concurrent connections to each
+        host. */
+    size_t getMaxPerHost() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return maxPerHost;
+    }
+
+    /** The client shared by the whole program. */
+    static HttpClient& shared() {
+        static HttpClient client;
+        return client;
+    }
+
+    /** Send a request and read the response headers.  A connection
+        from the pool is used if one is available.  If a pooled
+        connection turns out to have been closed by the server, the
+        request is retried once on a newly opened connection.
+
+        \param[in] method The HTTP method, e.g., "GET" or "HEAD".
+
+        \param[in] host The host name of the server.
+
+        \param[in] port The port number (or service name) of the server.
+
+        \param[in] path The path of the resource, e.g., "/~raodm/a.txt".
+
+        \param[in] extra Additional request headers, e.g., Range.
+
+        \return The response (never nullptr).  Its status is 0 if no
+        valid response could be obtained, e.g., if the server could
+        not be reached.  Read its body via Response::body().
+        The response holds 1 of the host's connections until it is
+        destroyed, so a thread should not hold several responses from
+        the same host at once (it could wait forever for itself).
+    */
+    ResponsePtr request(const std::string& method, const std::string& host,
+                        const std::string& port, const std::string& path,
+                        const Headers& extra = {}) {
+        const std::string key = host + ":" + port;
+        // The retry never uses a pooled connection, so it is the last.
+        for (bool fresh = false; ; fresh = true) {
+            bool reused = false;
+            ResponsePtr resp(new Response());
+            resp->client = this;
+            resp->key    = key;
+            resp->conn   = acquire(host, port, fresh, reused);
+            Connection& conn = *resp->conn;
+            conn.expires_after(timeout);
+            conn << method << ' ' << path << " HTTP/1.1\r\n"
+                 << "Host: " << host << "\r\n";
+            for (const auto& hdr : extra) {
+                conn << hdr.first << ": " << hdr.second << "\r\n";
+            }
+            conn << "Connection: keep-alive\r\n\r\n" << std::flush;
+            if (readHeaders(*resp, method == "HEAD", timeout) || !reused) {
+                return resp;
+            }
+            resp->keepAlive = false;  // The pooled connection was stale.
+        }
+    }
+
+    /** Convenience method to send a GET request for a URL of the form
+        "http://host[:port]/path".
+
+        \param[in] url The URL to be fetched.
+
+        \param[in] extra Additional request headers.
+
+        \return The response.
+    */
+    ResponsePtr get(const std::string& url, const Headers& extra = {}) {
+        std::string host, port, path;
+        std::tie(host, port, path) = splitUrl(url);
+        return request("GET", host, port, path, extra);
+    }
+
+    /** Break down a URL into host, port, and path.  For example,
+        given "http://localhost:8080/~raodm/one.txt" this method returns
+        {"localhost", "8080", "/~raodm/one.txt"}.  The default port is
+        80 and the default path is "/".
+    */
+    static std::tuple<std::string, std::string, std::string>
+    splitUrl(const std::string& url) {
+        const size_t scheme = url.find("//");
+        const size_t hostStart = (scheme == std::string::npos ? 0 : scheme + 2);
+        const size_t pathStart = std::min(url.find('/', hostStart), url.size());
+        const size_t portPos   = url.find(':', hostStart);
+        const bool hasPort = (portPos < pathStart);
+        const std::string host = url.substr(hostStart, (hasPort ? portPos :
+                                                        pathStart) - hostStart);
+        const std::string port = (hasPort ? url.substr(portPos + 1, pathStart -
+                                                        portPos - 1) : "80");
+        const std::string path = (pathStart < url.size() ?
+                                  url.substr(pathStart) : "/");
+        return {host, port, path};
+    }
+
+private:
+    /** The connections and cached addresses of a host. */
+    struct Host {
+        std::vector<std::unique_ptr<Connection>> idle;  // Pooled connections
+        size_t inUse = 0;  // Connections being used by requests
+        std::condition_variable available;  // Signalled on release
+        std::vector<boost::asio::ip::tcp::endpoint> endpoints;
+        std::chrono::steady_clock::time_point expires;  // Of endpoints
+    };
+
+    // Obtain a connection to a host, waiting if too many requests to
+    // the host are in progress.  If fresh is true, a new connection is
+    // opened (in place of an idle one, if need be) instead of reusing
+    // a pooled connection.
+    std::unique_ptr<Connection> acquire(const std::string& host,
+                                        const std::string& port,
+                                        const bool fresh, bool& reused) {
+        std::unique_lock<std::mutex> lock(mutex);
+        Host& info = hosts[host + ":" + port];
+        info.available.wait(lock, [&] {
+            return !info.idle.empty() || (info.inUse < maxPerHost);
+        });
+        info.inUse++;
+        if (!info.idle.empty()) {
+            auto conn = std::move(info.idle.back());
+            info.idle.pop_back();
+            if (!fresh) {
+                reused = true;
+                return conn;
+            }
+            // The idle connection is closed and a new one takes its place.
+        }
+        // Resolve the host (unless its addresses are cached).
+        auto endpoints = info.endpoints;
+        if (endpoints.empty() ||
+            (std::chrono::steady_clock::now() > info.expires)) {
+            lock.unlock();
+            endpoints = resolve(host, port);
+            lock.lock();
+            info.endpoints = endpoints;
+            info.expires   = std::chrono::steady_clock::now() + dnsTtl;
+        }
+        lock.unlock();
+        reused = false;
+        auto conn = std::make_unique<Connection>();
+        conn->expires_after(timeout);
+        for (const auto& endpoint : endpoints) {
+            conn->clear();
+            conn->connect(endpoint);
+            if (*conn) {
+                break;
+            }
+        }
+        boost::system::error_code ec;  // Ignored if not connected
+        conn->socket().set_option(boost::asio::ip::tcp::no_delay(true), ec);
+        return conn;
+    }
+
+    // Return a connection to the pool (or close it).
+    void release(const std::string& key, std::unique_ptr<Connection> conn,
+                 const bool reusable) {
+        std::lock_guard<std::mutex> lock(mutex);
+        Host& info = hosts[key];
+        info.inUse--;
+        if (reusable && *conn) {
+            info.idle.push_back(std::move(conn));
+        }
+        info.available.notify_one();
+    }
+
+    // Resolve the addresses of a host.
+    static std::vector<boost::asio::ip::tcp::endpoint>
+    resolve(const std::string& host, const std::string& port) {
+        boost::asio::io_context io;
+        boost::asio::ip::tcp::resolver resolver(io);
+        boost::system::error_code ec;
+        std::vector<boost::asio::ip::tcp::endpoint> endpoints;
+        for (const auto& entry : resolver.resolve(host, port, ec)) {
+            endpoints.push_back(entry.endpoint());
+        }
+        return endpoints;
+    }
+
+    // Read the status line and headers of a response and set up its
+    // body (whose reads wait at most idleTimeout).  Returns false if
+    // no response could be read.
+    static bool readHeaders(Response& resp, const bool isHead,
+                            const std::chrono::seconds idleTimeout) {
+        Connection& conn = *resp.conn;
+        std::string version;
+        if (!(conn >> version >> resp.status)) {
+            resp.status = 0;
+            return false;
+        }
+        std::string line;
+        std::getline(conn, line);  // Rest of the status line
+        while (std::getline(conn, line) && (line != "\r") && !line.empty()) {
+            const size_t colon = line.find(':');
+            if (colon == std::string::npos) {
+                continue;
+            }
+            std::string name = line.substr(0, colon);
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+            const size_t start = line.find_first_not_of(" \t", colon + 1);
+            const size_t end   = line.find_last_not_of(" \t\r");
+            resp.headers[name] = (start == std::string::npos ? "" :
+                                  line.substr(start, end - start + 1));
+        }
+        if (!conn) {
+            return false;
+        }
+        std::string connection = resp.header("connection");
+        std::transform(connection.begin(), connection.end(),
+                       connection.begin(), ::tolower);
+        const bool noBody = isHead || (resp.status / 100 == 1) ||
+            (resp.status == 204) || (resp.status == 304);
+        const bool chunked = !noBody &&
+            (resp.header("transfer-encoding").find("chunked") !=
+             std::string::npos);
+        long long length = -1;  // Read until the server closes
+        if (noBody) {
+            length = 0;
+        } else if (!chunked && !resp.header("content-length").empty()) {
+            length = std::stoll(resp.header("content-length"));
+        }
+        resp.keepAlive = (connection != "close") && (version != "HTTP/1.0") &&
+            (chunked || (length >= 0));
+        resp.bodyBuf.setup(&conn, (chunked ? 0 : length), chunked,
+                           idleTimeout);
+        return true;
+    }
+
+    // The limit on concurrent connections per host.
+    size_t maxPerHost;
+    // How long resolved addresses are cached.
+    const std::chrono::seconds dnsTtl;
+    // The maximum time to wait for the server (see the constructor).
+    const std::chrono::seconds timeout;
+    // The connections and addresses of each host ("host:port").
+    std::unordered_map<std::string, Host> hosts;
+    // The mutex that protects hosts.
+    std::mutex mutex;
+};
+
+#endif
@@ -0,0 +1,266 @@
+#ifndef MAPPED_DICTIONARY_H
+#define MAPPED_DICTIONARY_H
+
+/**
+ * A read-only dictionary of words stored in a precompiled binary file
+ * that is memory-mapped when it is loaded.  The file is an
+ * open-addressing hash table that is built once (from a text file
+ * with 1 word per line) and used as is, so loading the dictionary
+ * does not read or allocate anything per word and the pages of the
+ * file are shared by all the processes using it.
+ *
+ * The binary file consists of:
+ *
+ *    1. A Header (see below).
+ *    2. numSlots Slots, where numSlots is a power of 2.  A slot with
+ *       offset 0 is empty.
+ *    3. The words, each terminated by a '\0' character.  The first
+ *       byte is a '\0' so that no word is at offset 0.
+ *
+ * Copyright 2021 zarembmj@miamioh.edu
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+// ------------------------------------------------------------------- //
+// ****  NOTE: NEVER NEVER put "using namespace" IN A HEADER FILE  *** //
+// ------------------------------------------------------------------- //
+
+/**
+ * A dictionary of words that can only be looked up.  Lookups do not
+ * allocate any memory.  All the methods in this class are MT-safe.
+ */
+class MappedDictionary {
+public:
+    /** The constructor creates an empty dictionary. */
+    MappedDictionary() = default;
+
+    /** The destructor unmaps the dictionary file (if any). */
+    ~MappedDictionary() {
+        if (mapped != nullptr) {
+            munmap(mapped, mappedSize);
+        }
+    }
+
+    // A dictionary owns its mapping and cannot be copied.
+    MappedDictionary(const MappedDictionary&) = delete;
+    MappedDictionary& operator=(const MappedDictionary&) = delete;
+
+    /** Load the dictionary for a given text file of words.  The
+        precompiled version of the file (with a ".dict" extension
+        instead of ".txt") is used if it is up to date.  Otherwise the
+        precompiled file is (re)created first.  If the precompiled file
+        cannot be written, the dictionary is built in memory.
+
+        \param[in] txtPath The path to the text file with the words.
+        If the file does not exist the dictionary is empty.
+
+        \return This method returns true if the dictionary was loaded.
+    */
+    bool load(const std::string& txtPath) {
+        const std::string dictPath = txtPath.substr(0, txtPath.rfind(".txt")) +
+            ".dict";
+        struct stat txtInfo, dictInfo;
+        if (stat(txtPath.c_str(), &txtInfo) == -1) {
+            return map(dictPath);  // Maybe only the compiled file exists.
+        }
+        if ((stat(dictPath.c_str(), &dictInfo) == 0) &&
+            (dictInfo.st_mtime >= txtInfo.st_mtime) && map(dictPath)) {
+            return true;
+        }
+        const std::string table = build(readWords(txtPath));
+        // Write to a temporary file first so that other processes
+        // never see a partially written file.
+        const std::string tmpPath = dictPath + "." + std::to_string(getpid());
+        if (writeFile(tmpPath, table) &&
+            (rename(tmpPath.c_str(), dictPath.c_str()) == 0) &&
+            map(dictPath)) {
+            return true;
+        }
+        unlink(tmpPath.c_str());
+        // Could not write the file. Use the table from memory.
+        inMemory = table;
+        return use(inMemory.data(), inMemory.size());
+    }
+
+    /** Compile a text file of words into a binary dictionary file.
+
+        \param[in] txtPath The path to the text file with the words.
+
+        \param[in] dictPath The path to the binary file to be created.
+
+        \return This method returns true if the file was written.
+    */
+    static bool compile(const std::string& txtPath,
+                        const std::string& dictPath) {
+        return writeFile(dictPath, build(readWords(txtPath)));
+    }
+
+    /** Check if a word is in the dictionary.
+
+        \param[in] word The word to look up.
+
+        \return This method returns true if the word is in the
+        dictionary.
+    */
+    bool contains(const std::string_view word) const {
+        if (numSlots == 0) {
+            return false;
+        }
+        const uint32_t hash = hashOf(word);
+        for (uint32_t i = hash & (numSlots - 1);; i = (i + 1) & (numSlots - 1)) {
+            const Slot& slot = slots[i];
+            if (slot.offset == 0) {
+                return false;
+            }
+            // strncmp stops at the '\0' at the end of each word.
+            if ((slot.hash == hash) &&
+                (std::strncmp(words + slot.offset, word.data(),
+                              word.size()) == 0) &&
+                (words[slot.offset + word.size()] == '\0')) {
+                return true;
+            }
+        }
+    }
+
+    /** The number of words in the dictionary. */
+    size_t size() const { return numWords; }
+
+private:
+    /** The header at the start of a dictionary file. */
+    struct Header {
+        char magic[8];      // Always "WORDDICT"
+        uint32_t numWords;  // The number of words in the dictionary
+        uint32_t numSlots;  // The number of slots (a power of 2)
+    };
+
+    /** A slot in the hash table. */
+    struct Slot {
+        uint32_t hash;    // The hash of the word (to skip most compares)
+        uint32_t offset;  // The offset of the word in the words area
+    };
+
+    // The (FNV-1a) hash function used for the table.
+    static uint32_t hashOf(const std::string_view word) {
+        uint32_t hash = 2166136261U;
+        for (const char c : word) {
+            hash = (hash ^ static_cast<unsigned char>(c)) * 16777619U;
+        }
+        return hash;
+    }
+
+    // Helper method to read the distinct words in a text file.
+    static std::vector<std::string> readWords(const std::string& txtPath) {
+        std::ifstream is(txtPath);
+        const std::unordered_set<std::string> unique{
+            std::istream_iterator<std::string>(is),
+            std::istream_iterator<std::string>()};
+        return {unique.begin(), unique.end()};
+    }
+
+    // Helper method to write (and close) a file.
+    static bool writeFile(const std::string& path, const std::string& data) {
+        std::ofstream os(path, std::ios::binary);
+        os.write(data.data(), data.size());
+        os.close();
+        return bool(os);
+    }
+
+    // Helper method to build the contents of a dictionary file.  The
+    // table is at most half full to keep the probe sequences short.
+    static std::string build(const std::vector<std::string>& wordList) {
+        uint32_t slotCount = 16;
+        while (slotCount < 2 * wordList.size()) {
+            slotCount *= 2;
+        }
+        std::vector<Slot> table(slotCount, Slot{0, 0});
+        std::string strings(1, '\0');
+        for (const std::string& word : wordList) {
+            const uint32_t hash = hashOf(word);
+            uint32_t i = hash & (slotCount - 1);
+            while (table[i].offset != 0) {
+                i = (i + 1) & (slotCount - 1);
+            }
+            table[i] = Slot{hash, static_cast<uint32_t>(strings.size())};
+            strings.append(word).push_back('\0');
+        }
+        Header header = {{'W', 'O', 'R', 'D', 'D', 'I', 'C', 'T'},
+                         static_cast<uint32_t>(wordList.size()), slotCount};
+        std::string file(reinterpret_cast<const char*>(&header),
+                         sizeof(header));
+        file.append(reinterpret_cast<const char*>(table.data()),
+                    table.size() * sizeof(Slot));
+        return file + strings;
+    }
+
+    // Helper method to memory-map a dictionary file.
+    bool map(const std::string& dictPath) {
+        const int fd = open(dictPath.c_str(), O_RDONLY);
+        if (fd == -1) {
+            return false;
+        }
+        struct stat info;
+        void* addr = MAP_FAILED;
+        if ((fstat(fd, &info) == 0) && (info.st_size > 0)) {
+            addr = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        close(fd);  // The mapping stays valid after the file is closed
+        if (addr == MAP_FAILED) {
+            return false;
+        }
+        if (!use(static_cast<const char*>(addr), info.st_size)) {
+            munmap(addr, info.st_size);
+            return false;
+        }
+        mapped = addr;
+        mappedSize = info.st_size;
+        return true;
+    }
+
+    // Helper method to validate and use the contents of a dictionary.
+    bool use(const char* data, const size_t size) {
+        Header header;
+        if (size < sizeof(header)) {
+            return false;
+        }
+        std::memcpy(&header, data, sizeof(header));
+        const size_t tableEnd = sizeof(header) +
+            size_t(header.numSlots) * sizeof(Slot);
+        if ((std::memcmp(header.magic, "WORDDICT", 8) != 0) ||
+            ((header.numSlots & (header.numSlots - 1)) != 0) ||
+            (header.numSlots <= header.numWords) || (tableEnd >= size) ||
+            (data[size - 1] != '\0')) {
+            return false;  // Not a (complete) dictionary file
+        }
+        numWords = header.numWords;
+        numSlots = header.numSlots;
+        slots    = reinterpret_cast<const Slot*>(data + sizeof(header));
+        words    = data + tableEnd;
+        return true;
+    }
+
+    // The number of words and slots in the table.
+    uint32_t numWords = 0, numSlots = 0;
+    // The slots of the hash table.
+    const Slot* slots = nullptr;
+    // The area with the words.
+    const char* words = nullptr;
+    // The mapped file (if any) and its size.
+    void* mapped = nullptr;
+    size_t mappedSize = 0;
+    // The table when it could not be written to a file.
+    std::string inMemory;
+};
+
+#endif
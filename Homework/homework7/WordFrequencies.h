@@ -0,0 +1,409 @@
+#ifndef WORD_FREQUENCIES_H
+#define WORD_FREQUENCIES_H
+
+/**
+ * Classes to count the frequency of each word.  Each thread counts
+ * words in its own WordTable, which is an open-addressing hash table
+ * whose keys are stored in an Arena (i.e., large blocks of memory
+ * shared by many keys), so adding a new word does not allocate memory
+ * per word.  The tables of different threads are merged at the end by
+ * splitting the words into partitions (by hash) that are merged in
+ * parallel and then the most frequent words are selected with a heap.
+ *
+ * To bound the memory used for very large vocabularies, a table can
+ * be limited to a maximum number of distinct words.  Once the table
+ * is full, new words are counted in a CountMinSketch and only the most
+ * frequent of them are remembered (as candidates for the top words).
+ * Counts from the sketch are approximate (never too low).
+ *
+ * Copyright 2021 zarembmj@miamioh.edu
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// ------------------------------------------------------------------- //
+// ****  NOTE: NEVER NEVER put "using namespace" IN A HEADER FILE  *** //
+// ------------------------------------------------------------------- //
+
+/**
+ * A simple memory arena for strings.  Strings are copied into large
+ * blocks and are never freed individually.  The copies stay valid
+ * until the arena is destroyed.  This class is not MT-safe.
+ */
+class Arena {
+public:
+    /** The size of each block of memory. */
+    static constexpr size_t BlockSize = 64 * 1024;
+
+    /** Copy a string into the arena.
+
+        \param[in] str The string to be copied.
+
+        \return A pointer to the copy (which is not '\0' terminated).
+    */
+    const char* copy(const std::string_view str) {
+        if (str.size() > BlockSize) {
+            // Long strings get a block of their own.
+            large.emplace_back(new char[str.size()]);
+            std::memcpy(large.back().get(), str.data(), str.size());
+            return large.back().get();
+        }
+        if (str.size() > BlockSize - used) {
+            blocks.emplace_back(new char[BlockSize]);
+            used = 0;
+        }
+        char* dest = blocks.back().get() + used;
+        std::memcpy(dest, str.data(), str.size());
+        used += str.size();
+        return dest;
+    }
+
+private:
+    // The blocks of memory and the blocks for long strings.
+    std::vector<std::unique_ptr<char[]>> blocks, large;
+    // The number of bytes used in the last block.
+    size_t used = BlockSize;
+};
+
+/**
+ * A count-min sketch: a fixed-size table of counters from which the
+ * count of any item can be estimated.  The estimate is never lower
+ * than the true count and, with high probability, is only a little
+ * higher.  Sketches of the same size can be merged by adding them.
+ */
+class CountMinSketch {
+public:
+    /** The constructor.
+
+        \param[in] width The number of counters per row (rounded up to
+        a power of 2).
+
+        \param[in] depth The number of rows (independent hashes).
+    */
+    explicit CountMinSketch(const size_t width = 1 << 16,
+                            const size_t depth = 4) :
+        width(roundUp(width)), depth(depth), counts(this->width * depth, 0) {}
+
+    /** Add to the count of an item.
+
+        \param[in] hash The (64-bit) hash of the item.
+
+        \param[in] count The count to be added.
+    */
+    void add(const uint64_t hash, const uint64_t count = 1) {
+        for (size_t row = 0; (row < depth); row++) {
+            counts[row * width + column(hash, row)] += count;
+        }
+    }
+
+    /** Estimate the count of an item.
+
+        \param[in] hash The (64-bit) hash of the item.
+
+        \return The estimated count of the item.
+    */
+    uint64_t estimate(const uint64_t hash) const {
+        uint64_t result = std::numeric_limits<uint64_t>::max();
+        for (size_t row = 0; (row < depth); row++) {
+            result = std::min(result, counts[row * width + column(hash, row)]);
+        }
+        return result;
+    }
+
+    /** Add the counts of another sketch (of the same size) to this one.
+
+        \param[in] other The sketch to be merged into this one.
+    */
+    void merge(const CountMinSketch& other) {
+        for (size_t i = 0; (i < counts.size()); i++) {
+            counts[i] += other.counts[i];
+        }
+    }
+
+private:
+    // Helper method to round a value up to a power of 2.
+    static size_t roundUp(const size_t value) {
+        size_t result = 1;
+        while (result < value) {
+            result *= 2;
+        }
+        return result;
+    }
+
+    // Helper method to find the counter (in a row) for a hash, using
+    // double hashing to derive a different hash for each row.
+    size_t column(const uint64_t hash, const size_t row) const {
+        const uint64_t step = ((hash >> 32) | (hash << 32)) *
+            0x9E3779B97F4A7C15ULL | 1;
+        return (hash + row * step) & (width - 1);
+    }
+
+    // The number of counters per row and the number of rows.
+    const size_t width, depth;
+    // The counters (row by row).
+    std::vector<uint64_t> counts;
+};
+
+/**
+ * An open-addressing hash table that counts words.  This class is not
+ * MT-safe.  Use 1 table per thread and merge them.
+ */
+class WordTable {
+public:
+    /** An entry in the table. */
+    struct Entry {
+        const char* key = nullptr;  // The word (not '\0' terminated)
+        uint32_t len = 0;           // The length of the word
+        uint64_t hash = 0;          // The hash of the word
+        uint64_t count = 0;         // The number of times it was seen
+
+        /** The word in this entry. */
+        std::string_view word() const { return {key, len}; }
+    };
+
+    /** The constructor.
+
+        \param[in] maxWords The maximum number of distinct words in the
+        table.  Once the table is full, new words are counted in a
+        sketch (see class comment).
+
+        \param[in] maxCandidates The number of the most frequent new
+        words to remember once the table is full.
+    */
+    explicit WordTable(const size_t maxWords =
+                       std::numeric_limits<size_t>::max(),
+                       const size_t maxCandidates = 0) :
+        maxWords(maxWords), maxCandidates(maxCandidates), entries(1024) {}
+
+    /** Add to the count of a word.  The word is copied into the
+        table's arena the first time it is seen.
+
+        \param[in] word The word to be counted.
+
+        \param[in] count The count to be added.
+    */
+    void add(const std::string_view word, const uint64_t count = 1) {
+        const uint64_t hash = hashOf(word);
+        Entry& entry = find(word, hash);
+        if (entry.key != nullptr) {
+            entry.count += count;
+        } else if (numWords < maxWords) {
+            insert(entry, arena.copy(word), word.size(), hash, count);
+        } else {
+            addToSketch(word, hash, count);
+        }
+    }
+
+    /** Add an entry from another table.  The key is not copied, so the
+        other table must outlive this one.
+
+        \param[in] other The entry to be added.
+    */
+    void add(const Entry& other) {
+        Entry& entry = find(other.word(), other.hash);
+        if (entry.key != nullptr) {
+            entry.count += other.count;
+        } else {
+            insert(entry, other.key, other.len, other.hash, other.count);
+        }
+    }
+
+    /** Obtain the exact count of a word in this table.
+
+        \param[in] word The word to look up.
+
+        \return The count of the word (0 if it is not in the table).
+    */
+    uint64_t count(const std::string_view word) const {
+        return const_cast<WordTable*>(this)->find(word, hashOf(word)).count;
+    }
+
+    /** Call a method with each entry in the table. */
+    void forEach(const std::function<void(const Entry&)>& method) const {
+        for (const Entry& entry : entries) {
+            if (entry.key != nullptr) {
+                method(entry);
+            }
+        }
+    }
+
+    /** The number of distinct words in the table. */
+    size_t size() const { return numWords; }
+
+    /** True if some words were counted in the sketch. */
+    bool overflowed() const { return (sketch != nullptr); }
+
+    /** The sketch with the counts of the words that did not fit in the
+        table.  This is nullptr if the table never filled up.
+    */
+    const CountMinSketch* getSketch() const { return sketch.get(); }
+
+    /** The most frequent words that did not fit in the table. */
+    const std::unordered_map<std::string, uint64_t>& getCandidates() const {
+        return candidates;
+    }
+
+    /** The hash function used for words (FNV-1a, 64-bit). */
+    static uint64_t hashOf(const std::string_view word) {
+        uint64_t hash = 14695981039346656037ULL;
+        for (const char c : word) {
+            hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+        }
+        return hash;
+    }
+
+private:
+    // Helper method to find the entry for a word, or the empty entry
+    // where the word would be inserted.
+    Entry& find(const std::string_view word, const uint64_t hash) {
+        const size_t mask = entries.size() - 1;
+        for (size_t i = hash & mask;; i = (i + 1) & mask) {
+            Entry& entry = entries[i];
+            if ((entry.key == nullptr) ||
+                ((entry.hash == hash) && (entry.word() == word))) {
+                return entry;
+            }
+        }
+    }
+
+    // Helper method to fill an empty entry, growing the table to keep
+    // it at most 70% full.
+    void insert(Entry& entry, const char* key, const size_t len,
+                const uint64_t hash, const uint64_t count) {
+        entry.key   = key;
+        entry.len   = len;
+        entry.hash  = hash;
+        entry.count = count;
+        if (++numWords * 10 > entries.size() * 7) {
+            std::vector<Entry> old(entries.size() * 2);
+            old.swap(entries);
+            for (const Entry& e : old) {
+                if (e.key != nullptr) {
+                    find(e.word(), e.hash) = e;
+                }
+            }
+        }
+    }
+
+    // Helper method to count a word that does not fit in the table and
+    // remember it if it is one of the most frequent such words.
+    void addToSketch(const std::string_view word, const uint64_t hash,
+                     const uint64_t count) {
+        if (sketch == nullptr) {
+            sketch = std::make_unique<CountMinSketch>();
+        }
+        sketch->add(hash, count);
+        if ((maxCandidates == 0) || ((candidates.size() == maxCandidates) &&
+                                     (sketch->estimate(hash) <= minCandidate))) {
+            return;  // Not frequent enough to be a candidate (yet).
+        }
+        if (!candidates.emplace(word, hash).second) {
+            return;  // Already a candidate.
+        }
+        if (candidates.size() > maxCandidates) {
+            // Drop the candidate with the lowest estimate.
+            auto lowest = candidates.begin();
+            for (auto it = candidates.begin(); (it != candidates.end()); it++) {
+                if (sketch->estimate(it->second) <
+                    sketch->estimate(lowest->second)) {
+                    lowest = it;
+                }
+            }
+            candidates.erase(lowest);
+        }
+        minCandidate = std::numeric_limits<uint64_t>::max();
+        for (const auto& candidate : candidates) {
+            minCandidate = std::min(minCandidate,
+                                    sketch->estimate(candidate.second));
+        }
+    }
+
+    // The limits on the number of words and candidates.
+    const size_t maxWords, maxCandidates;
+    // The number of words in the table.
+    size_t numWords = 0;
+    // The entries in the table (the size is a power of 2).
+    std::vector<Entry> entries;
+    // The memory where the words are stored.
+    Arena arena;
+    // The counts of the words that did not fit in the table.
+    std::unique_ptr<CountMinSketch> sketch;
+    // The most frequent words that did not fit (word -> hash) and the
+    // lowest estimated count among them.
+    std::unordered_map<std::string, uint64_t> candidates;
+    uint64_t minCandidate = 0;
+};
+
+/** A word along with its count. The flag is true if the count is an
+    estimate (from a sketch).
+*/
+struct WordCount {
+    std::string_view word;
+    uint64_t count;
+    bool approximate;
+};
+
+/**
+ * Selects the k words with the highest counts using a min-heap of
+ * size k, i.e., without sorting all the words.  Ties are broken by
+ * the words themselves so the result does not depend on the order in
+ * which the words are added.
+ */
+class TopK {
+public:
+    /** The constructor.
+
+        \param[in] k The number of words to select.
+    */
+    explicit TopK(const size_t k) : k(k), heap(greater) {}
+
+    /** Consider a word for the top k.
+
+        \param[in] wc The word and its count.
+    */
+    void add(const WordCount& wc) {
+        if (heap.size() < k) {
+            heap.push(wc);
+        } else if ((k > 0) && greater(wc, heap.top())) {
+            heap.pop();
+            heap.push(wc);
+        }
+    }
+
+    /** Obtain the top k words, sorted by decreasing count.  This
+        method empties the heap.
+    */
+    std::vector<WordCount> result() {
+        std::vector<WordCount> words;
+        for (; !heap.empty(); heap.pop()) {
+            words.push_back(heap.top());
+        }
+        std::reverse(words.begin(), words.end());
+        return words;
+    }
+
+private:
+    // Orders words so that the "smallest" one is at the top of the heap
+    static bool greater(const WordCount& a, const WordCount& b) {
+        return (a.count != b.count) ? (a.count > b.count) : (a.word < b.word);
+    }
+
+    // The number of words to select.
+    const size_t k;
+    // The k "largest" words seen so far, with the smallest at the top.
+    std::priority_queue<WordCount, std::vector<WordCount>,
+                        bool(*)(const WordCount&, const WordCount&)> heap;
+};
+
+#endif
@@ -0,0 +1,242 @@
+#ifndef WORD_TOKENIZER_H
+#define WORD_TOKENIZER_H
+
+/**
+ * A fast tokenizer that splits a stream into lowercase words.  The
+ * stream is read in large blocks.  Each block is classified (and
+ * lowercased in place) 64 bytes at a time using SIMD instructions
+ * (AVX2 if the program is compiled with -mavx2, SSE2 otherwise, or
+ * plain C++ on other CPUs) into a bitmap of delimiters.  The words are
+ * then found from the bitmap with bit operations and handed over as
+ * std::string_view objects, without any copies or memory allocation.
+ *
+ * The words are the same as the ones obtained by replacing the
+ * punctuation (::ispunct) with blanks, converting to lowercase
+ * (::tolower), and splitting at white space (::isspace), all in the
+ * default "C" locale.
+ *
+ * Copyright 2021 zarembmj@miamioh.edu
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// ------------------------------------------------------------------- //
+// ****  NOTE: NEVER NEVER put "using namespace" IN A HEADER FILE  *** //
+// ------------------------------------------------------------------- //
+
+/**
+ * A class with static methods to split a stream into words.
+ */
+class WordTokenizer {
+public:
+    /** The number of bytes read from the stream at a time. */
+    static constexpr size_t BlockSize = 64 * 1024;
+
+    /** The words at the edges of a chunk of a bigger stream.  Such
+        words may continue in the previous/next chunk.
+    */
+    struct Edges {
+        // The word at the start and the word at the end of the chunk.
+        // These are empty if the chunk starts/ends with a delimiter.
+        std::string head, tail;
+        // True if the chunk has no delimiters at all, i.e., the whole
+        // chunk (in head) is a part of a word.
+        bool whole = true;
+    };
+
+    /** Split the data in a stream into lowercase words.
+
+        \param[in,out] is The input stream to be read until EOF.
+
+        \param[in] handler The method to be called with each word as a
+        std::string_view.  The view is valid only during the call.
+
+        \param[out] edges If not nullptr, the words at the start and at
+        the end of the stream are stored here (instead of being passed
+        to the handler) so that chunks of a bigger stream can be
+        processed independently.
+
+        \param[in] limit The maximum number of bytes to be read.
+
+        \return The number of bytes read from the stream.
+    */
+    template <typename Handler>
+    static size_t tokenize(std::istream& is, Handler&& handler,
+                           Edges* edges = nullptr,
+                           size_t limit = std::numeric_limits<size_t>::max()) {
+        const size_t maxRead = limit;
+        std::vector<char> buf(BlockSize);
+        std::vector<uint64_t> delims;  // 1 bit per byte in buf
+        size_t carry = 0;  // Bytes of a word carried over from last block
+        bool atStart = true;  // True while a word may start at byte 0
+        bool sawDelim = false;  // True once any delimiter has been seen
+        for (bool more = true; more;) {
+            if (carry == buf.size()) {
+                buf.resize(2 * buf.size());  // A very long word
+            }
+            is.read(&buf[carry], std::min(buf.size() - carry, limit));
+            limit -= is.gcount();
+            more = bool(is) && (limit > 0);
+            const size_t size = carry + is.gcount();
+            delims.resize((size + 63) / 64);
+            classify(buf.data(), size, delims.data());
+            sawDelim = sawDelim || std::any_of(delims.begin(), delims.end(),
+                                               [](uint64_t d) { return d; });
+            // Hand over each word, except for a word at the end of the
+            // block that may continue in the next block.
+            size_t pos = 0;
+            while ((pos = find(delims.data(), pos, size, false)) < size) {
+                const size_t end = find(delims.data(), pos, size, true);
+                if ((end == size) && more) {
+                    break;
+                }
+                const std::string_view word(&buf[pos], end - pos);
+                if ((edges != nullptr) && atStart && (pos == 0)) {
+                    edges->head = word;  // May continue in previous chunk
+                } else if ((edges != nullptr) && (end == size)) {
+                    edges->tail = word;  // May continue in next chunk
+                } else {
+                    handler(word);
+                }
+                atStart = false;
+                pos = end;
+            }
+            atStart = atStart && (pos == 0);
+            carry = size - std::min(pos, size);
+            std::memmove(buf.data(), &buf[size - carry], carry);
+        }
+        if (edges != nullptr) {
+            edges->whole = !sawDelim;
+        }
+        return maxRead - limit;
+    }
+
+private:
+    // Helper method to check if a byte is a delimiter, i.e., a space
+    // (9 to 13 and 32), or a punctuation in the "C" locale.
+    static bool isDelim(const unsigned char c) {
+        return ((c >= 9) && (c <= 13)) || ((c >= 32) && (c <= 47)) ||
+            ((c >= 58) && (c <= 64)) || ((c >= 91) && (c <= 96)) ||
+            ((c >= 123) && (c <= 126));
+    }
+
+    // Helper method to classify bytes without SIMD instructions.
+    static uint64_t classifyScalar(char* data, const size_t count) {
+        uint64_t mask = 0;
+        for (size_t i = 0; (i < count); i++) {
+            const unsigned char c = data[i];
+            mask |= uint64_t(isDelim(c)) << i;
+            if ((c >= 'A') && (c <= 'Z')) {
+                data[i] = c + ('a' - 'A');
+            }
+        }
+        return mask;
+    }
+
+#if defined(__AVX2__)
+    // Mask of bytes in the range lo to hi (both inclusive).
+    static __m256i inRange(const __m256i x, const char lo, const char hi) {
+        const __m256i t = _mm256_sub_epi8(x, _mm256_set1_epi8(lo));
+        return _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(hi - lo)),
+                                 t);
+    }
+
+    // Classify and lowercase 32 bytes.
+    static uint32_t classify32(char* data) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<__m256i*>(data));
+        const __m256i delim = _mm256_or_si256(
+            _mm256_or_si256(inRange(x, 9, 13), inRange(x, 32, 47)),
+            _mm256_or_si256(_mm256_or_si256(inRange(x, 58, 64),
+                                            inRange(x, 91, 96)),
+                            inRange(x, 123, 126)));
+        const __m256i upper = inRange(x, 'A', 'Z');
+        x = _mm256_add_epi8(x, _mm256_and_si256(upper,
+                                                _mm256_set1_epi8(0x20)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(data), x);
+        return _mm256_movemask_epi8(delim);
+    }
+
+    // Classify and lowercase 64 bytes.
+    static uint64_t classify64(char* data) {
+        return classify32(data) | (uint64_t(classify32(data + 32)) << 32);
+    }
+#elif defined(__SSE2__)
+    // Mask of bytes in the range lo to hi (both inclusive).
+    static __m128i inRange(const __m128i x, const char lo, const char hi) {
+        const __m128i t = _mm_sub_epi8(x, _mm_set1_epi8(lo));
+        return _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(hi - lo)), t);
+    }
+
+    // Classify and lowercase 16 bytes.
+    static uint32_t classify16(char* data) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<__m128i*>(data));
+        const __m128i delim = _mm_or_si128(
+            _mm_or_si128(inRange(x, 9, 13), inRange(x, 32, 47)),
+            _mm_or_si128(_mm_or_si128(inRange(x, 58, 64), inRange(x, 91, 96)),
+                         inRange(x, 123, 126)));
+        const __m128i upper = inRange(x, 'A', 'Z');
+        x = _mm_add_epi8(x, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(data), x);
+        return _mm_movemask_epi8(delim);
+    }
+
+    // Classify and lowercase 64 bytes.
+    static uint64_t classify64(char* data) {
+        return uint64_t(classify16(data)) |
+            (uint64_t(classify16(data + 16)) << 16) |
+            (uint64_t(classify16(data + 32)) << 32) |
+            (uint64_t(classify16(data + 48)) << 48);
+    }
+#else
+    // Classify and lowercase 64 bytes.
+    static uint64_t classify64(char* data) {
+        return classifyScalar(data, 64);
+    }
+#endif
+
+    // Helper method to lowercase a block of bytes (in place) and set
+    // 1 bit per delimiter in the bitmap.
+    static void classify(char* data, const size_t size, uint64_t* delims) {
+        size_t i = 0;
+        for (; (i + 64 <= size); i += 64) {
+            delims[i / 64] = classify64(data + i);
+        }
+        if (i < size) {
+            delims[i / 64] = classifyScalar(data + i, size - i);
+        }
+    }
+
+    // Helper method to find the first byte at or after pos that is
+    // (or is not) a delimiter.  Returns size if there is no such byte.
+    static size_t find(const uint64_t* delims, const size_t pos,
+                       const size_t size, const bool delim) {
+        if (pos >= size) {
+            return size;
+        }
+        const uint64_t flip = (delim ? 0 : ~uint64_t(0));
+        size_t index = pos / 64;
+        uint64_t bits = (delims[index] ^ flip) & (~uint64_t(0) << (pos % 64));
+        while (bits == 0) {
+            if (++index * 64 >= size) {
+                return size;
+            }
+            bits = delims[index] ^ flip;
+        }
+        return std::min(index * 64 + __builtin_ctzll(bits), size);
+    }
+};
+
+#endif
@@ -0,0 +1,186 @@
+#ifndef WORK_STEALING_POOL_H
+#define WORK_STEALING_POOL_H
+
+/**
+ * A fixed-size pool of threads that run tasks.  Each worker thread has
+ * its own queue of tasks.  Tasks submitted by a worker (e.g., the
+ * pieces of a bigger task) go to the worker's own queue.  A worker
+ * runs the most recently added task in its own queue first and, when
+ * its queue is empty, steals the oldest task from another worker's
+ * queue.  Hence the workers rarely contend for the same queue and all
+ * the workers stay busy as long as there is work to do.
+ *
+ * Copyright 2021 zarembmj@miamioh.edu
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// ------------------------------------------------------------------- //
+// ****  NOTE: NEVER NEVER put "using namespace" IN A HEADER FILE  *** //
+// ------------------------------------------------------------------- //
+
+/**
+ * A work-stealing thread pool.  All the methods in this class are
+ * MT-safe.
+ */
+class WorkStealingPool {
+public:
+    /** Shortcut to a task run by the pool. */
+    using Task = std::function<void()>;
+
+    /** The constructor starts the worker threads.
+
+        \param[in] numThreads The number of worker threads.  The
+        default is the number of CPUs.
+    */
+    explicit WorkStealingPool(const size_t numThreads =
+                              std::thread::hardware_concurrency()) {
+        for (size_t i = 0; (i < std::max<size_t>(1, numThreads)); i++) {
+            workers.push_back(std::make_unique<Worker>());
+        }
+        for (size_t i = 0; (i < workers.size()); i++) {
+            threads.emplace_back([this, i] { workerMain(i); });
+        }
+    }
+
+    /** The destructor waits for all the tasks to finish and then
+        stops the worker threads.
+    */
+    ~WorkStealingPool() {
+        wait();
+        {
+            std::lock_guard<std::mutex> lock(idleMutex);
+            stop = true;
+        }
+        workAvailable.notify_all();
+        for (auto& thr : threads) {
+            thr.join();
+        }
+    }
+
+    /** Add a task to be run by one of the workers.  If this method is
+        called from a worker of this pool, the task is added to that
+        worker's queue.  Otherwise the tasks are spread over the
+        workers' queues.
+
+        \param[in] task The task to be run.
+    */
+    void submit(Task task) {
+        const size_t index = ((currentPool() == this) ? workerIndex() :
+                              nextWorker++ % workers.size());
+        pending++;
+        {
+            std::lock_guard<std::mutex> lock(workers[index]->mutex);
+            workers[index]->tasks.push_back(std::move(task));
+            queued++;
+        }
+        // Wake up an idle worker (if any) to run or steal the task.
+        std::lock_guard<std::mutex> lock(idleMutex);
+        workAvailable.notify_one();
+    }
+
+    /** Wait until all the tasks (including the tasks that they
+        submit) have finished.  Don't call from a worker thread.
+    */
+    void wait() {
+        std::unique_lock<std::mutex> lock(idleMutex);
+        allDone.wait(lock, [this] { return pending == 0; });
+    }
+
+    /** The number of worker threads in this pool. */
+    size_t size() const { return workers.size(); }
+
+    /** The index (0 to size() - 1) of the worker running the calling
+        thread.  This is 0 if not called from a worker thread.  This
+        is handy to keep per-worker data that needs no locks.
+    */
+    static size_t workerIndex() { return currentIndex(); }
+
+private:
+    /** The queue of tasks of a worker. */
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    // The pool and index of the worker running the calling thread.
+    static WorkStealingPool*& currentPool() {
+        thread_local WorkStealingPool* pool = nullptr;
+        return pool;
+    }
+
+    static size_t& currentIndex() {
+        thread_local size_t index = 0;
+        return index;
+    }
+
+    // Helper method to obtain a task, first from the worker's own
+    // queue (newest first) and then from other queues (oldest first).
+    bool getTask(const size_t self, Task& task) {
+        for (size_t i = 0; (i < workers.size()); i++) {
+            Worker& worker = *workers[(self + i) % workers.size()];
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            if (!worker.tasks.empty()) {
+                if (i == 0) {
+                    task = std::move(worker.tasks.back());
+                    worker.tasks.pop_back();
+                } else {
+                    task = std::move(worker.tasks.front());
+                    worker.tasks.pop_front();
+                }
+                queued--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // The method run by each worker thread.
+    void workerMain(const size_t self) {
+        currentPool()  = this;
+        currentIndex() = self;
+        for (Task task;;) {
+            if (getTask(self, task)) {
+                task();
+                task = nullptr;
+                if (--pending == 0) {
+                    std::lock_guard<std::mutex> lock(idleMutex);
+                    allDone.notify_all();
+                }
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(idleMutex);
+            workAvailable.wait(lock, [this] { return stop || (queued > 0); });
+            if (stop) {
+                return;
+            }
+        }
+    }
+
+    // The queues of tasks of each worker.
+    std::vector<std::unique_ptr<Worker>> workers;
+    // The worker threads.
+    std::vector<std::thread> threads;
+    // The number of tasks submitted but not yet finished.
+    std::atomic<size_t> pending{0};
+    // The number of tasks in the queues.  It is only changed while
+    // holding the mutex of the queue being changed.
+    std::atomic<size_t> queued{0};
+    // The worker to receive the next task submitted from outside.
+    std::atomic<size_t> nextWorker{0};
+    // Used to put idle workers to sleep and to wait for all tasks.
+    std::mutex idleMutex;
+    std::condition_variable workAvailable, allDone;
+    // Flag to stop the workers.
+    bool stop = false;
+};
+
+#endif
@@ -1,7 +1,19 @@
 /** Copyright 2021 zarembmj@miamioh.edu
  * 
  * A program to use multiple threads to count words from data obtained
- * via a given set of URLs.
+ * via a given set of URLs.  The files are downloaded and counted by a
+ * work-stealing pool with 1 thread per CPU.  Large files are split
+ * into byte ranges (via HTTP Range requests) that are counted in
+ * parallel, so all the CPUs are used even for a few large files.
+ *
+ * With the "--top K" option, the K most frequent words across all the
+ * files are also printed.  The "--max-words N" option limits the
+ * number of distinct words counted exactly by each thread (the rest
+ * are counted approximately in a count-min sketch).  The
+ * "--connections N" option sets the number of concurrent downloads
+ * (Range requests) from the server.  The chunks are counted as they
+ * are downloaded, so the pool has at least N threads to overlap the
+ * downloads with counting even on machines with fewer CPUs.
  */
 
 #include <boost/asio.hpp>
@@ -10,141 +22,415 @@
 #include <vector>
 #include <fstream>
 #include <iterator>
-#include <cctype>
 #include <algorithm>
 #include <thread>
-#include <unordered_map>
+#include <limits>
+#include "MappedDictionary.h"
+#include "WordTokenizer.h"
+#include "WorkStealingPool.h"
+#include "WordFrequencies.h"
+#include "HttpClient.h"
 
 // Using namespace to streamline working with Boost socket
 using namespace boost::asio;
 using namespace boost::system;
 
-// Shortcut an unordered map of words
-using Dictionary = std::unordered_map<std::string, bool>;
+// Shortcut to the dictionary of words
+using Dictionary = MappedDictionary;
 
 // Forward declaration of loadDictionary for use immediately below
-Dictionary loadDictionary(const std::string& path);
+const Dictionary& loadDictionary(const std::string& path);
 
 // The global dictionary of valid words
-const Dictionary dictionary = loadDictionary("english.txt");
+const Dictionary& dictionary = loadDictionary("english.txt");
 
-/** This method returns an unordered map of words from a file 
- *  to use as a dictionary.
+/** This method returns a dictionary of words from a file.  The
+ *  precompiled (memory-mapped) version of the file, i.e.,
+ *  english.dict, is used if it is up to date.  Otherwise it is
+ *  created first (see the --compile option in main).
  *
  * @param path The file path to the dictionary file.
  *
  * @return The Dictionary containing the list of words loaded from the
  * file supplied to path.
  */
-Dictionary loadDictionary(const std::string& path) {
-    Dictionary dictionary;
-    std::ifstream englishWords(path);
-    for (std::string word; englishWords >> word;) {
-        dictionary[word] = true;
-    }
+const Dictionary& loadDictionary(const std::string& path) {
+    static Dictionary dictionary;
+    dictionary.load(path);
     return dictionary;
 }
 
-/** This method changes the punctuation in a line to blank space.
- *  The line is also converted to lower case.
+// The server and base path from where the files are downloaded.
+const std::string Host = "ceclnx01.cec.miamioh.edu";
+const std::string BasePath = "/~raodm/";
+
+// Files larger than this are split into chunks of this many bytes.
+const size_t ChunkSize = 1 << 20;
+
+// The most times the request for a chunk is sent if it fails with a
+// dropped connection or a server error (5xx).
+const int MaxTries = 3;
+
+// The counts of each word kept by each worker (only with --top).
+std::vector<std::unique_ptr<WordTable>> wordTables;
+
+/** The number of words and English words in a file (or a part of it).
+    The flag is set if a part of the file could not be downloaded.
+*/
+struct Counts {
+    long words = 0, engWords = 0;
+    bool failed = false;
+};
+
+/** The counts kept by each worker (in the order of the files).  Each
+    worker only updates its own counts, so no locks are needed and the
+    workers do not share any cache lines.
+*/
+using WorkerCounts = std::vector<std::vector<Counts>>;
+
+/** The information about a file being counted. */
+struct FileInfo {
+    size_t index = 0;    // The index of the file in WorkerCounts
+    std::string file;    // The file from the command-line
+    size_t length = 0;   // Its length, if known (and ranges work)
+    std::string etag;    // Its ETag (if any), used with If-Range
+    // The words at the edges of each chunk (see WordTokenizer::Edges)
+    std::vector<WordTokenizer::Edges> edges;
+};
+
+/**
+ * Helper method to add a word to the counts.
  *
- * @param The line string supplied.
+ * @param word The word to be counted.
  *
- * @return A string with all punctuation removed and all letters 
- * converted to lowercase.
+ * @param counts The counts to be updated.
+ *
+ * @param table The table of word frequencies to be updated (if any).
  */
-std::string changePunct(std::string line) {
-    // Remove punctuation in line (and replace with blank space)
-    std::replace_if(line.begin(), line.end(), ::ispunct, ' ');
-    // Convert each word to lowercase
-    std::transform(line.begin(), line.end(), line.begin(), ::tolower);
-    return line;
+void countWord(const std::string_view word, Counts& counts,
+               WordTable* table) {
+    counts.words++;
+    if (dictionary.contains(word)) {
+        counts.engWords++;
+    }
+    if (table != nullptr) {
+        table->add(word);
+    }
 }
 
 /**
- * This method counts the number of total words and the number of valid
- * English words from a given input stream. 
- * Punctuation and special characters are ignored. 
+ * Helper method to obtain the word frequency table of the calling
+ * worker.
  *
- * @param stream The input stream.
- * 
- * @return A string with the total word count and English word count.
+ * @return The table or nullptr if word frequencies are not counted.
  */
-std::string wordCount(std::istream& stream) {
-    int wordCount = 0, engWordCount = 0;
-    // Processes each line and word
-    for (std::string line; std::getline(stream, line);) {
-        // Remove punctuation and convert to lowercase
-        line = changePunct(line);
-        // Process each word
-        std::istringstream is(line);
-        for (std::string word; is >> word;) {
-            wordCount++;
-            if (dictionary.find(word) != dictionary.end()) {
-                engWordCount++;
-            }
+WordTable* workerTable() {
+    return (wordTables.empty() ? nullptr :
+            wordTables[WorkStealingPool::workerIndex()].get());
+}
+
+/**
+ * This method sends an HTTP request for a file and reads the response
+ * headers.  The shared HttpClient is used so that the connections to
+ * the server are reused by the requests for all the files and chunks.
+ *
+ * @param method The HTTP method, i.e., "GET" or "HEAD".
+ *
+ * @param file A string containing the file to be requested.  The file
+ * path is appended to "http://ceclnx01.cec.miamioh.edu/~raodm/"
+ *
+ * @param range An optional range of bytes, e.g., "0-1023".
+ *
+ * @param etag The ETag of the file (if known).  The range is requested
+ * with "If-Range", so that the whole file (with a status 200) is sent
+ * instead of the range if the file has changed.
+ *
+ * @return The response (with a status code of 0 on errors).
+ */
+HttpClient::ResponsePtr sendRequest(const std::string& method,
+                                    const std::string& file,
+                                    const std::string& range = "",
+                                    const std::string& etag = "") {
+    HttpClient::Headers headers;
+    if (!range.empty()) {
+        headers.emplace_back("Range", "bytes=" + range);
+        if (!etag.empty()) {
+            headers.emplace_back("If-Range", etag);
         }
     }
-    // Return a string with the total word count and English word count
-    return ": words=" + std::to_string(wordCount) +
-        ", English words=" + std::to_string(engWordCount);
+    return HttpClient::shared().request(method, Host, "80", BasePath + file,
+                                        headers);
 }
 
 /**
- * This method gets the word counts for a given file.
+ * This method counts the words in a chunk of a file.  The chunk is
+ * downloaded with a Range request (or the whole file is downloaded if
+ * the file is not split).  The counts are added to the calling
+ * worker's counts.  A request that fails with a dropped connection or
+ * a server error is retried (up to MaxTries times).  If the chunk still
+ * cannot be downloaded, the file has changed since its HEAD request,
+ * or the data ends early (which is found only after its words are
+ * counted), the file is marked as failed and its counts are not used.
  *
- * A Boost TCP stream from homework 1 is used to send an HTTP GET
- * request to the server and print the response.
+ * @param info The file being counted.
  *
- * @param file A string containing the file to be processed.
- * The file path is appended to this url:
- * "http://ceclnx01.cec.miamioh.edu/~raodm/"
+ * @param chunk The index of the chunk to be counted.
  *
- * @return The results of wordCount for the file
+ * @param workerCounts The counts kept by each worker.
  */
-std::string getCount(const std::string& file) {
-    // Setup the fixed strings required for the TCP stream
-    const std::string base = "/~raodm/";
-    const std::string host = "ceclnx01.cec.miamioh.edu";
-    const std::string resource = base + file;
-    // Send request to the HTTP server
-    ip::tcp::iostream stream(host, "80");
-    stream << "GET " << resource << " HTTP/1.1\r\n";
-    stream << "Host: " << host << "\r\n";
-    stream << "Connection: Close\r\n\r\n";
-    // First read and skip HTTP headers (A classic)
-    for (std::string line; std::getline(stream, line) &&
-                           !line.empty() && (line != "\r"); ) {}
-    // Call wordCount for the count
-    auto count = wordCount(stream);
-    // Return the result
-    return file + count;
+void countChunk(FileInfo& info, const size_t chunk,
+                WorkerCounts& workerCounts) {
+    Counts& counts = workerCounts[WorkStealingPool::workerIndex()][info.index];
+    const size_t start = chunk * ChunkSize;
+    const size_t size  = (info.edges.size() == 1 ?
+                          std::numeric_limits<size_t>::max() :
+                          std::min(ChunkSize, info.length - start));
+    const std::string range = (info.edges.size() == 1 ? "" :
+                               std::to_string(start) + "-" +
+                               std::to_string(start + size - 1));
+    HttpClient::ResponsePtr resp;
+    for (int tries = 1; (tries <= MaxTries); tries++) {
+        resp = sendRequest("GET", info.file, range, info.etag);
+        if ((resp->status != 0) && (resp->status < 500)) {
+            break;
+        }
+    }
+    // With If-Range, a 200 for a chunk means that the file changed.
+    const bool whole = (info.edges.size() == 1);
+    if (whole ? (resp->status != 200) :
+        ((resp->status != 206) &&
+         ((resp->status != 200) || !info.etag.empty()))) {
+        counts.failed = true;
+        return;
+    }
+    std::istream& body = resp->body();
+    if (resp->status == 200) {
+        // The server ignored the range. Skip to the start of the chunk.
+        body.ignore(start);
+    }
+    WordTable* const table = workerTable();
+    const size_t read = WordTokenizer::tokenize(body,
+        [&](const std::string_view word) {
+            countWord(word, counts, table);
+        }, &info.edges[chunk], size);
+    // A chunk must have all its bytes and a whole file must have ended
+    // with the end of the body (not a dropped connection).
+    if (whole ? !resp->complete() : (read != size)) {
+        counts.failed = true;
+    }
+}
+
+/**
+ * This method starts counting the words in a file.  It first finds
+ * the length of the file (via a HEAD request) and then counts each
+ * chunk of the file as a separate task.
+ *
+ * @param pool The pool that runs the tasks.
+ *
+ * @param info The file to be counted.
+ *
+ * @param counts The counts kept by each worker.
+ */
+void countFile(WorkStealingPool& pool, FileInfo& info, WorkerCounts& counts) {
+    {
+        const HttpClient::ResponsePtr resp = sendRequest("HEAD", info.file);
+        const bool ranges = (resp->header("accept-ranges").find("bytes") !=
+                             std::string::npos);
+        // Split the file only if ranges work.
+        info.length = ((resp->status == 200) && ranges) ?
+            std::strtoull(resp->header("content-length").c_str(), nullptr,
+                          10) : 0;
+        info.etag = resp->header("etag");
+    }
+    const size_t chunks = std::max<size_t>(1, (info.length + ChunkSize - 1) /
+                                           ChunkSize);
+    info.edges.resize(chunks);
+    for (size_t chunk = 1; (chunk < chunks); chunk++) {
+        pool.submit([&info, &counts, chunk] {
+            countChunk(info, chunk, counts);
+        });
+    }
+    countChunk(info, 0, counts);
+}
+
+/**
+ * This method combines the counts of a file: the counts kept by every
+ * worker, and the words at the edges of the chunks (a word may span
+ * several chunks).
+ *
+ * @param info The file that has been counted.
+ *
+ * @param counts The counts kept by each worker.
+ *
+ * @return A string with the total word count and English word count,
+ * or an error message if a part of the file could not be downloaded.
+ */
+std::string totalCounts(const FileInfo& info, const WorkerCounts& counts) {
+    Counts total;
+    for (const auto& workerCounts : counts) {
+        total.words    += workerCounts[info.index].words;
+        total.engWords += workerCounts[info.index].engWords;
+        total.failed   |= workerCounts[info.index].failed;
+    }
+    if (total.failed) {
+        return info.file + ": Unable to download the file";
+    }
+    std::string word;  // The word being put together across chunks
+    for (const WordTokenizer::Edges& edges : info.edges) {
+        word += edges.head;
+        if (!edges.whole) {
+            if (!word.empty()) {
+                countWord(word, total, workerTable());
+            }
+            word = edges.tail;
+        }
+    }
+    if (!word.empty()) {
+        countWord(word, total, workerTable());
+    }
+    return info.file + ": words=" + std::to_string(total.words) +
+        ", English words=" + std::to_string(total.engWords);
+}
+
+/**
+ * This method prints the most frequent words across all the files.
+ * The words are split into 1 partition per worker (by their hash):
+ * first each table's entries are bucketed by partition, and then each
+ * worker merges the buckets of its partition from all the tables and
+ * selects the top words of its partition.  So each entry is visited
+ * only twice.  The top words of the partitions are then combined with
+ * those counted approximately (if any table overflowed).  Since a
+ * word may be in one table but only in the sketch of another, the
+ * sketch's estimate is added to the count of every top word, which is
+ * then reported as approximate (unless the estimate is 0).
+ *
+ * @param pool The pool used to merge the tables in parallel.
+ *
+ * @param k The number of words to print.
+ */
+void printTopWords(WorkStealingPool& pool, const size_t k) {
+    const size_t parts = pool.size();
+    // The entries of each table, bucketed by partition.
+    using Bucket = std::vector<const WordTable::Entry*>;
+    std::vector<std::vector<Bucket>> buckets(wordTables.size());
+    for (size_t i = 0; (i < wordTables.size()); i++) {
+        pool.submit([&, i] {
+            buckets[i].resize(parts);
+            wordTables[i]->forEach([&](const WordTable::Entry& entry) {
+                buckets[i][entry.hash % parts].push_back(&entry);
+            });
+        });
+    }
+    pool.wait();
+    std::vector<std::unique_ptr<WordTable>> merged(parts);
+    std::vector<std::vector<WordCount>> partTop(parts);
+    for (size_t part = 0; (part < parts); part++) {
+        pool.submit([&, part] {
+            merged[part] = std::make_unique<WordTable>();
+            for (const auto& tableBuckets : buckets) {
+                for (const WordTable::Entry* entry : tableBuckets[part]) {
+                    merged[part]->add(*entry);
+                }
+            }
+            TopK top(k);
+            merged[part]->forEach([&top](const WordTable::Entry& entry) {
+                top.add({entry.word(), entry.count, false});
+            });
+            partTop[part] = top.result();
+        });
+    }
+    pool.wait();
+    // Combine the approximate counts of the words that did not fit.
+    CountMinSketch sketch;
+    std::unordered_map<std::string_view, uint64_t> candidates;
+    bool overflowed = false;
+    for (const auto& table : wordTables) {
+        if (table->overflowed()) {
+            overflowed = true;
+            sketch.merge(*table->getSketch());
+            candidates.insert(table->getCandidates().begin(),
+                              table->getCandidates().end());
+        }
+    }
+    TopK top(k);
+    for (const auto& words : partTop) {
+        for (const WordCount& wc : words) {
+            if (candidates.count(wc.word) != 0) {
+                continue;  // Added below.
+            }
+            // Other tables may have counted the word in their sketch.
+            const uint64_t more = (overflowed ? sketch.estimate(
+                WordTable::hashOf(wc.word)) : 0);
+            top.add({wc.word, wc.count + more, (more > 0)});
+        }
+    }
+    for (const auto& candidate : candidates) {
+        const uint64_t exact = merged[candidate.second % parts]->
+            count(candidate.first);
+        top.add({candidate.first, exact + sketch.estimate(candidate.second),
+                 true});
+    }
+    std::cout << "Top " << k << " words:\n";
+    int rank = 0;
+    for (const WordCount& wc : top.result()) {
+        std::cout << ++rank << ". " << wc.word << ": " << wc.count
+                  << (wc.approximate ? " (approx.)" : "") << '\n';
+    }
 }
 
 /** The main method.
  *
  * @param argc The number of command-line arguments.
  *
- * @param argv The list of command-line arguments.
+ * @param argv The list of command-line arguments: optionally
+ * "--top K", "--max-words N", and "--connections N" followed by the
+ * files.  Use
+ * "--compile Words.txt Words.dict" to just precompile a dictionary.
  */
 int main(int argc, char *argv[]) {
-    // Assume each command-line argument is a file
-    std::vector<std::string> stats(argc); 
-    std::vector<std::thread> thrList; 
-
-    // Create 1 thread per file
-    for (int i = 1; (i < argc); i++) {
-        // A lambda is used instead of a threadMain method. 
-        // (Just like in class!)
-        thrList.push_back(std::thread([&, i]{ stats[i] = getCount(argv[i]); }));
-    }
-    // Wait for each thread to finish
-    for (auto& thr : thrList) {
-        thr.join();
-    }
-    // Print the results from each thread.
-    for (int i = 1; (i < argc); i++) {
-        std::cout << stats[i] << '\n';
+    if ((argc == 4) && (std::string(argv[1]) == "--compile")) {
+        return (Dictionary::compile(argv[2], argv[3]) ? 0 : 1);
+    }
+    size_t topWords = 0, maxWords = std::numeric_limits<size_t>::max();
+    size_t connections = 0;  // 0 means the default of the HttpClient
+    int first = 1;  // The first file in argv
+    for (; (first + 1 < argc); first += 2) {
+        const std::string option = argv[first];
+        if (option == "--top") {
+            topWords = std::stoul(argv[first + 1]);
+        } else if (option == "--max-words") {
+            maxWords = std::stoul(argv[first + 1]);
+        } else if (option == "--connections") {
+            connections = std::stoul(argv[first + 1]);
+            HttpClient::shared().setMaxPerHost(connections);
+        } else {
+            break;
+        }
+    }
+    // Assume each remaining command-line argument is a file
+    std::vector<FileInfo> files(std::max(0, argc - first));
+    WorkStealingPool pool(std::max<size_t>(connections,
+                                           std::thread::hardware_concurrency()));
+    for (size_t i = 0; (topWords > 0) && (i < pool.size()); i++) {
+        wordTables.push_back(std::make_unique<WordTable>(maxWords, topWords));
+    }
+    // The counts for each file kept separately by each worker
+    WorkerCounts counts(pool.size(), std::vector<Counts>(files.size()));
+    for (size_t i = 0; (i < files.size()); i++) {
+        files[i].index = i;
+        files[i].file  = argv[first + i];
+        pool.submit([&pool, &files, &counts, i] {
+            countFile(pool, files[i], counts);
+        });
+    }
+    // Wait for all the files to be counted
+    pool.wait();
+    // Print the results for each file.
+    for (size_t i = 0; (i < files.size()); i++) {
+        std::cout << totalCounts(files[i], counts) << '\n';
+    }
+    if (topWords > 0) {
+        printTopWords(pool, topWords);
     }
     return 0;
 }
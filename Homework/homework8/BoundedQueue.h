@@ -0,0 +1,144 @@
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+/**
+ * A simple multi-producer, multi-consumer (MPMC) queue with a fixed
+ * capacity.  The stock exchange server uses this queue to hand off
+ * accepted connections from the acceptor thread to a fixed pool of
+ * long-lived worker threads.
+ *
+ * Copyright 2021 zarembmj@miamioh.edu
+ */
+
+#include <cstddef>
+#include <mutex>
+#include <condition_variable>
+#include <utility>
+#include <vector>
+
+// ------------------------------------------------------------------- //
+// ****  NOTE: NEVER NEVER put "using namespace" IN A HEADER FILE  *** //
+// ------------------------------------------------------------------- //
+
+/**
+ * A bounded MPMC queue backed by a fixed-size ring buffer.  All
+ * methods are MT-safe.  Producers can either block until space is
+ * available (push) or give up immediately (tryPush), which lets the
+ * caller decide what to do on overflow.
+ *
+ * \tparam T The type of entries stored in the queue.  It must be
+ * default constructible and movable.
+ */
+template <typename T>
+class BoundedQueue {
+public:
+    /** The constructor that allocates the ring buffer once up front.
+
+        \param[in] capacity The maximum number of entries that can be
+        pending in the queue at any given time.  Must be > 0.
+    */
+    explicit BoundedQueue(const size_t capacity) :
+        ring(capacity), head(0), count(0) {}
+
+    /** Add an entry to the queue, waiting until space is available.
+
+        \param[in] item The entry to be added to the queue.
+    */
+    void push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this] { return count < ring.size(); });
+        enqueue(std::move(item));
+        lock.unlock();
+        notEmpty.notify_one();
+    }
+
+    /** Add an entry to the queue only if space is available.
+
+        \param[in,out] item The entry to be added to the queue.  The
+        entry is moved only if this method returns true.
+
+        \return This method returns true if the entry was added and
+        false if the queue was full.
+    */
+    bool tryPush(T& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (count == ring.size()) {
+            return false;
+        }
+        enqueue(std::move(item));
+        lock.unlock();
+        notEmpty.notify_one();
+        return true;
+    }
+
+    /** Remove the oldest entry from the queue, waiting until one is
+        available.
+
+        \return The oldest entry in the queue.
+    */
+    T pop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this] { return count > 0; });
+        T item = dequeue();
+        lock.unlock();
+        notFull.notify_one();
+        return item;
+    }
+
+    /** Remove the oldest entry from the queue if there is one.
+
+        \param[out] item The entry removed from the queue.  This value
+        is changed only if this method returns true.
+
+        \return This method returns true if an entry was removed and
+        false if the queue was empty.
+    */
+    bool tryPop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (count == 0) {
+            return false;
+        }
+        item = dequeue();
+        lock.unlock();
+        notFull.notify_one();
+        return true;
+    }
+
+    /** The number of entries currently pending in the queue.  The
+        value is only a snapshot and may change immediately. */
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return count;
+    }
+
+private:
+    // Helper to append an entry.  Caller must hold the mutex.
+    void enqueue(T&& item) {
+        ring[(head + count) % ring.size()] = std::move(item);
+        count++;
+    }
+
+    // Helper to remove the first entry.  Caller must hold the mutex.
+    T dequeue() {
+        T item = std::move(ring[head]);
+        ring[head] = T();  // Don't hold on to resources in the ring
+        head = (head + 1) % ring.size();
+        count--;
+        return item;
+    }
+
+    // The fixed-size ring buffer holding the entries in the queue.
+    std::vector<T> ring;
+    // Index of the oldest entry in the ring.
+    size_t head;
+    // Number of entries currently in the ring.
+    size_t count;
+    // The mutex that protects all of the above instance variables.
+    mutable std::mutex mutex;
+    // Signaled when an entry is removed (producers wait on this).
+    std::condition_variable notFull;
+    // Signaled when an entry is added (consumers wait on this).
+    std::condition_variable notEmpty;
+};
+
+#endif
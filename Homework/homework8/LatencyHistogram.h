@@ -0,0 +1,125 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+/**
+ * A compact, HDR-style histogram for recording latencies.  Values are
+ * stored in log-linear buckets: every power-of-2 range is split into
+ * 64 linear sub-buckets, so any recorded value is reported with an
+ * error of less than 1.6% while the whole 64-bit range needs only a
+ * few thousand counters.  Recording a value is just a bit of
+ * arithmetic and an increment, so each thread can cheaply keep its own
+ * histogram and the histograms are merged at the end.
+ *
+ * Copyright 2021 zarembmj@miamioh.edu
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// ------------------------------------------------------------------- //
+// ****  NOTE: NEVER NEVER put "using namespace" IN A HEADER FILE  *** //
+// ------------------------------------------------------------------- //
+
+/**
+ * A histogram of non-negative integer values (e.g., latencies in
+ * microseconds).  This class is not MT-safe.  Use one histogram per
+ * thread and merge them.
+ */
+class LatencyHistogram {
+public:
+    /** The number of bits of precision kept for each value. */
+    static constexpr int SubBucketBits = 7;
+
+    /** The constructor creates an empty histogram. */
+    LatencyHistogram() : counts(bucketIndex(UINT64_MAX) + 1, 0),
+                         total(0), sum(0), maxValue(0) {}
+
+    /** Record a value in the histogram.
+
+        \param[in] value The value to be recorded.
+    */
+    void record(const uint64_t value) {
+        counts[bucketIndex(value)]++;
+        total++;
+        sum += value;
+        maxValue = std::max(maxValue, value);
+    }
+
+    /** Add all the values recorded in another histogram to this one.
+
+        \param[in] other The histogram to be merged into this one.
+    */
+    void merge(const LatencyHistogram& other) {
+        for (size_t i = 0; (i < counts.size()); i++) {
+            counts[i] += other.counts[i];
+        }
+        total   += other.total;
+        sum     += other.sum;
+        maxValue = std::max(maxValue, other.maxValue);
+    }
+
+    /** The number of values recorded in this histogram. */
+    uint64_t count() const { return total; }
+
+    /** The largest value recorded in this histogram. */
+    uint64_t max() const { return maxValue; }
+
+    /** The mean of the values recorded in this histogram. */
+    double mean() const { return (total == 0 ? 0 : double(sum) / total); }
+
+    /** Obtain the value at a given percentile.
+
+        \param[in] pct The percentile, e.g., 99.9.
+
+        \return The highest value that is equivalent (to within the
+        precision of the histogram) to the value below which pct
+        percent of the recorded values fall.
+    */
+    uint64_t percentile(const double pct) const {
+        const uint64_t target = std::max<uint64_t>(1, pct / 100 * total + 0.5);
+        uint64_t seen = 0;
+        for (size_t i = 0; (i < counts.size()); i++) {
+            if ((seen += counts[i]) >= target) {
+                return std::min(highestEquivalent(i), maxValue);
+            }
+        }
+        return maxValue;
+    }
+
+private:
+    // The number of linear sub-buckets in each power-of-2 range
+    // (except the first range, which has twice as many).
+    static constexpr uint64_t HalfCount = 1ULL << (SubBucketBits - 1);
+
+    // Helper method to find the bucket for a given value.
+    static size_t bucketIndex(const uint64_t value) {
+        if (value < 2 * HalfCount) {
+            return value;
+        }
+        const int shift = 63 - __builtin_clzll(value) - (SubBucketBits - 1);
+        return 2 * HalfCount + (shift - 1) * HalfCount +
+            ((value >> shift) - HalfCount);
+    }
+
+    // Helper method to find the largest value in a given bucket.
+    static uint64_t highestEquivalent(const size_t index) {
+        if (index < 2 * HalfCount) {
+            return index;
+        }
+        const int shift = (index - 2 * HalfCount) / HalfCount + 1;
+        const uint64_t sub = (index - 2 * HalfCount) % HalfCount + HalfCount;
+        return ((sub + 1) << shift) - 1;
+    }
+
+    // The number of values recorded in each bucket.
+    std::vector<uint64_t> counts;
+    // The total number of values recorded.
+    uint64_t total;
+    // The sum of all the values (to compute the mean).
+    uint64_t sum;
+    // The largest value recorded.
+    uint64_t maxValue;
+};
+
+#endif
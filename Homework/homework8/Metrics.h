@@ -0,0 +1,100 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+/**
+ * Counters used by the stock exchange server to report what it is
+ * doing (at the /metrics URL).  The counters are spread over shards,
+ * each on its own cache line(s), and every thread always updates the
+ * same shard.  Hence, threads updating counters on the hot path do not
+ * contend with each other.  The shards are only summed up when the
+ * metrics are reported.
+ *
+ * Copyright 2021 zarembmj@miamioh.edu
+ */
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// ------------------------------------------------------------------- //
+// ****  NOTE: NEVER NEVER put "using namespace" IN A HEADER FILE  *** //
+// ------------------------------------------------------------------- //
+
+/**
+ * A set of sharded counters.  All the methods in this class are
+ * MT-safe.  Counters are updated with relaxed atomic operations, so a
+ * report is only a close approximation while updates are in progress.
+ */
+class Metrics {
+public:
+    /** The different counters maintained by this class. */
+    enum Counter {
+        // The number of requests for each type of transaction.
+        Reset, Create, Buy, Sell, Status, Batch, Report, Invalid,
+        WaitNanos,  // Total time buyers were blocked waiting for stocks
+        Waits,      // Number of times buyers were blocked
+        LockNanos,  // Total time the stocks' mutexes were held
+        Locks,      // Number of times stocks' mutexes were held
+        NumCounters
+    };
+
+    /** The number of independently updated shards. */
+    static constexpr size_t NumShards = 16;
+
+    /** Add a value to a counter.
+
+        \param[in] counter The counter to be updated.
+
+        \param[in] value The value to be added.
+    */
+    void add(const Counter counter, const uint64_t value = 1) {
+        shards[shardIndex()].values[counter].fetch_add(
+            value, std::memory_order_relaxed);
+    }
+
+    /** Obtain the current value of a counter.
+
+        \param[in] counter The counter whose value is to be returned.
+
+        \return The sum of the counter over all the shards.
+    */
+    uint64_t get(const Counter counter) const {
+        uint64_t sum = 0;
+        for (const Shard& shard : shards) {
+            sum += shard.values[counter].load(std::memory_order_relaxed);
+        }
+        return sum;
+    }
+
+    /** Convenience method to obtain the current time for measuring
+        durations.
+
+        \return The number of nanoseconds on the steady clock.
+    */
+    static uint64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+private:
+    /** The counters updated by a subset of the threads. */
+    struct alignas(64) Shard {
+        std::array<std::atomic<uint64_t>, NumCounters> values{};
+    };
+
+    // Helper method to find the shard used by the calling thread.
+    // Threads are spread over the shards in the order in which they
+    // first update a counter.
+    static size_t shardIndex() {
+        static std::atomic<size_t> nextIndex(0);
+        thread_local const size_t index = nextIndex++ % NumShards;
+        return index;
+    }
+
+    // The shards of counters.
+    std::array<Shard, NumShards> shards;
+};
+
+#endif
@@ -0,0 +1,234 @@
+#ifndef REQUEST_PARSER_H
+#define REQUEST_PARSER_H
+
+/**
+ * An in-place parser for the HTTP requests processed by the stock
+ * exchange server.  The parser works directly on the bytes of the
+ * request head (the request line and the headers).  URL encoded
+ * entities in the path are decoded into a fixed scratch buffer and the
+ * transaction information is exposed as string_views into that
+ * buffer.  Hence, parsing a request does not allocate any memory.
+ *
+ * Copyright 2021 zarembmj@miamioh.edu
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <istream>
+#include <string_view>
+
+// ------------------------------------------------------------------- //
+// ****  NOTE: NEVER NEVER put "using namespace" IN A HEADER FILE  *** //
+// ------------------------------------------------------------------- //
+
+/**
+ * A reusable parser for stock requests of the form
+ * "GET /trans=buy&stock=0x01&amount=5&timeout=500 HTTP/1.1".  The
+ * fields of the path are positional (as in the original
+ * istringstream-based parsing), that is, the names of the parameters
+ * other than the second one are not checked.
+ *
+ * \note The string_views in this class refer to buffers inside the
+ * parser and are valid only until the next request is parsed.  An
+ * instance is large-ish (because of the buffers) and is not MT-safe.
+ * Use one instance per thread.
+ */
+class RequestParser {
+public:
+    /** The maximum size of a request head that can be handled. */
+    static constexpr size_t MaxHead = 8192;
+
+    /** The decoded path, e.g., "/trans=buy&stock=0x01&amount=5". */
+    std::string_view path;
+
+    /** The transaction, e.g., "buy" or "batch". */
+    std::string_view trans;
+
+    /** The name of the 2nd parameter, i.e., "stock" or "ops". */
+    std::string_view key;
+
+    /** The stock (or the list of operations for a batch). */
+    std::string_view stock;
+
+    /** The amount of stocks. Zero if not specified. */
+    unsigned int amount = 0;
+
+    /** The timeout (in milliseconds) for a buy. Zero if not specified. */
+    unsigned int timeout = 0;
+
+    /** True if the connection should be kept open after the response.
+        HTTP/1.1 connections are persistent unless the client sends a
+        "Connection: close" header. */
+    bool keepAlive = false;
+
+    /** Read 1 HTTP request head from a stream into the internal buffer
+        and parse it.  Lines are read directly into the buffer without
+        any intermediate strings.
+
+        \param[in] is The input stream from where the HTTP request is
+        to be read.
+
+        \return This method returns false if a complete request could
+        not be read, e.g., because the client closed the connection or
+        the request is longer than MaxHead.
+    */
+    bool read(std::istream& is) {
+        size_t len = 0;
+        while (is.getline(head + len, MaxHead - len)) {
+            if (is.eof()) {
+                return false;  // The last line has no '\n'.
+            }
+            // gcount includes the '\n' that was consumed but not stored
+            const size_t lineLen = is.gcount();
+            head[len + lineLen - 1] = '\n';
+            len += lineLen;
+            const bool blank = (lineLen == 1) ||
+                ((lineLen == 2) && (head[len - 2] == '\r'));
+            if (blank && (len > lineLen)) {
+                // Blank line ("\r\n") after the request line
+                return parse(std::string_view(head, len));
+            }
+        }
+        return false;
+    }
+
+    /** Parse a complete request head that is already in memory, e.g.,
+        in the buffer of a socket.
+
+        \param[in] request The request line and all the headers.  This
+        buffer is not changed and is not used after this call.
+
+        \return This method returns false if the request line is
+        malformed.
+    */
+    bool parse(std::string_view request) {
+        path = trans = key = stock = std::string_view();
+        amount = timeout = 0;
+        // Break up the request line into method, path, and version.
+        std::string_view line = nextLine(request);
+        const std::string_view method  = nextToken(line, " \r");
+        const std::string_view rawPath = nextToken(line, " \r");
+        const std::string_view version = nextToken(line, " \r");
+        if (method.empty() || rawPath.empty()) {
+            return false;
+        }
+        keepAlive = (version == "HTTP/1.1");
+        // Check the Connection header as we go.
+        while (!request.empty()) {
+            line = nextLine(request);
+            if (startsWithNoCase(line, "connection:")) {
+                keepAlive = containsNoCase(line, "keep-alive");
+            }
+        }
+        // Pull out the transaction information from the decoded path.
+        path = decode(rawPath);
+        std::string_view info = path;
+        const std::string_view Delims = " &=";
+        nextToken(info, Delims);  // Skip over "/trans"
+        trans = nextToken(info, Delims);
+        key   = nextToken(info, Delims);
+        stock = nextToken(info, Delims);
+        nextToken(info, Delims);  // Skip over "amount"
+        if (toNumber(nextToken(info, Delims), amount)) {
+            nextToken(info, Delims);  // Skip over "timeout"
+            toNumber(nextToken(info, Delims), timeout);
+        }
+        return true;
+    }
+
+private:
+    // Helper method to decode entities in the form "%xx" and '+' into
+    // the scratch buffer.  Malformed entities are left as is.
+    std::string_view decode(const std::string_view str) {
+        size_t len = 0;
+        for (size_t i = 0; (i < str.size()) && (len < MaxHead); i++) {
+            int hi, lo;
+            if (str[i] == '+') {
+                scratch[len++] = ' ';
+            } else if ((str[i] == '%') && (i + 2 < str.size()) &&
+                       ((hi = hexValue(str[i + 1])) >= 0) &&
+                       ((lo = hexValue(str[i + 2])) >= 0)) {
+                scratch[len++] = static_cast<char>(hi * 16 + lo);
+                i += 2;
+            } else {
+                scratch[len++] = str[i];
+            }
+        }
+        return std::string_view(scratch, len);
+    }
+
+    // Helper method to convert a hexadecimal digit to its value.
+    static int hexValue(const char c) {
+        if ((c >= '0') && (c <= '9')) return c - '0';
+        if ((c >= 'a') && (c <= 'f')) return c - 'a' + 10;
+        if ((c >= 'A') && (c <= 'F')) return c - 'A' + 10;
+        return -1;
+    }
+
+    // Helper method to convert a string of digits to a number.
+    // Returns false (like operator>>) if there are no digits.
+    static bool toNumber(const std::string_view str, unsigned int& value) {
+        size_t i = 0;
+        for (value = 0; (i < str.size()) && (str[i] >= '0') &&
+                 (str[i] <= '9'); i++) {
+            value = value * 10 + (str[i] - '0');
+        }
+        return (i > 0);
+    }
+
+    // Helper method to remove and return the first line (without the
+    // "\r\n") from a given string.
+    static std::string_view nextLine(std::string_view& str) {
+        const size_t end = str.find('\n');
+        std::string_view line = str.substr(0, end);
+        str.remove_prefix(end == std::string_view::npos ? str.size() :
+                          end + 1);
+        if (!line.empty() && (line.back() == '\r')) {
+            line.remove_suffix(1);
+        }
+        return line;
+    }
+
+    // Helper method to remove and return the first token (skipping
+    // over leading delimiters) from a given string.
+    static std::string_view nextToken(std::string_view& str,
+                                      const std::string_view delims) {
+        const size_t start = std::min(str.find_first_not_of(delims),
+                                      str.size());
+        str.remove_prefix(start);
+        const size_t end = std::min(str.find_first_of(delims), str.size());
+        const std::string_view token = str.substr(0, end);
+        str.remove_prefix(end);
+        return token;
+    }
+
+    // Helper method to compare characters ignoring case.
+    static bool sameNoCase(const char c1, const char c2) {
+        return std::tolower(static_cast<unsigned char>(c1)) ==
+            std::tolower(static_cast<unsigned char>(c2));
+    }
+
+    // Helper method to check for a (lower case) prefix ignoring case.
+    static bool startsWithNoCase(const std::string_view str,
+                                 const std::string_view prefix) {
+        return (str.size() >= prefix.size()) &&
+            std::equal(prefix.begin(), prefix.end(), str.begin(),
+                       sameNoCase);
+    }
+
+    // Helper method to search for a (lower case) word ignoring case.
+    static bool containsNoCase(const std::string_view str,
+                               const std::string_view word) {
+        return std::search(str.begin(), str.end(), word.begin(),
+                           word.end(), sameNoCase) != str.end();
+    }
+
+    // The buffer into which read() reads the request head.
+    char head[MaxHead];
+    // The buffer into which the path is decoded.  The string_views
+    // above refer to this buffer.
+    char scratch[MaxHead];
+};
+
+#endif
@@ -9,20 +9,65 @@
  */
 
 #include <string>
+#include <cstdint>
+#include <atomic>
 #include <mutex>
 #include <condition_variable>
+#include <functional>
+#include <list>
 
-class Stock {
+/*
+ * Each stock is aligned to a cache line so that trades on different
+ * stocks never share (and falsely contend on) a cache line.  The hot
+ * fields used by every trade -- the balance and its mutex -- are
+ * placed together in the first cache line.
+ */
+class alignas(64) Stock {
 public:
-    // The name of the stock, e.g. "msft"
-    std::string name;
+    // A buyer that is blocked waiting for a sufficient balance.  Each
+    // buyer has its own condition variable so that a seller can wake
+    // up exactly the buyers that it can satisfy.  A buyer that must not
+    // block a thread (see AsyncSession) sets onGrant instead, which is
+    // called in place of signalling the condition variable.
+    struct Waiter {
+        // Create a waiter for a buyer of the given number of stocks.
+        explicit Waiter(const unsigned int quantity) : quantity(quantity) {}
+        // The number of stocks the buyer wants to buy.
+        unsigned int quantity;
+        // Set by the seller once the stocks have been handed off.
+        bool granted = false;
+        // The sequence number of the log record of the hand off.
+        uint64_t lsn = 0;
+        // The condition variable on which the buyer sleeps.
+        std::condition_variable condVar;
+        // Called (with the mutex held) once the stocks have been
+        // handed off, if set.  It must not block.
+        std::function<void()> onGrant;
+    };
+
     // Number of available stocks.  This value can never go below
-    // zero.
-    unsigned int balance;
+    // zero.  Sells and non-blocking buys update it atomically without
+    // the mutex.
+    std::atomic<unsigned int> balance;
+    // Number of buyers in the waitQueue.  Sellers check this value to
+    // decide if they need to lock the mutex.
+    std::atomic<int> waiters{0};
     // A mutex associated with this this stock.
     std::mutex mutex;
-    // The condition variable associated with this stock.
-    std::condition_variable condVar;
+    // The buyers waiting for a sufficient balance, in order of
+    // arrival.  Protected by the mutex.
+    std::list<Waiter*> waitQueue;
+    // The name of the stock, e.g. "msft"
+    std::string name;
+    // The number of the StockTable generation that holds this stock.
+    uint64_t generation = 0;
+    // The time (in nanoseconds) at which the mutex was last locked.
+    // Protected by the mutex.
+    uint64_t lockedAt = 0;
+    // Total time (in nanoseconds) and number of times the mutex has
+    // been held.  Updated while holding the mutex and read (without
+    // it) when metrics are reported.
+    std::atomic<uint64_t> lockNanos{0}, lockCount{0};
 };
 
 #endif
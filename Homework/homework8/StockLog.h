@@ -0,0 +1,535 @@
+#ifndef STOCK_LOG_H
+#define STOCK_LOG_H
+
+/**
+ * A write-ahead log (WAL) with periodic snapshots to make the stock
+ * balances maintained by the stock exchange server durable.
+ *
+ * Every change to a balance is appended to the current log segment.
+ * Concurrent requests share fsync calls via group commit: the first
+ * request that needs its records on disk becomes the leader, writes
+ * out everything appended so far, and calls fdatasync once on behalf
+ * of all the waiting requests.  Records appended while the leader is
+ * busy form the next group.  Requests that must not block a thread
+ * (see whenDurable) are synced by a background thread instead, which
+ * takes part in the groups in the same way.
+ *
+ * If a group cannot be written or synced, the log has a gap, so none
+ * of the records after it can be made durable by the log.  The
+ * requests waiting for them are told that their changes are not
+ * durable (instead of being acknowledged) until the next snapshot,
+ * which covers the gap, succeeds.
+ *
+ * Periodically, the balances of all stocks are written to a binary
+ * snapshot and older log segments are removed.  On startup, the
+ * snapshot is loaded and the remaining segments are replayed.
+ *
+ * Each record is tagged with the number of the StockTable generation
+ * it changed.  Requests that started before a reset may still change
+ * (and log changes to) the old generation after the reset is logged.
+ * Those changes are gone once the reset is done, so replay drops the
+ * records of generations older than the current one.
+ *
+ * Copyright 2021 zarembmj@miamioh.edu
+ */
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "StockTable.h"
+
+// ------------------------------------------------------------------- //
+// ****  NOTE: NEVER NEVER put "using namespace" IN A HEADER FILE  *** //
+// ------------------------------------------------------------------- //
+
+/**
+ * The durable log of changes to stocks.  All the methods in this class
+ * are MT-safe.
+ *
+ * Changes to balances and appends to the log must be done together
+ * within a changeScope().  This ensures that a snapshot never sees a
+ * change whose record ends up in a log segment after the snapshot (or
+ * vice versa).  The scope must be as short as possible and must never
+ * be held while sleeping or waiting for the log to be durable.
+ */
+class StockLog {
+public:
+    /** The types of records in the log. */
+    enum Op : char {
+        Create = 'C',  // Stock created with an initial balance
+        Sell   = 'S',  // Stocks added to the balance
+        Buy    = 'B',  // Stocks removed from the balance
+        Reset  = 'R'   // All stocks removed
+    };
+
+    /** The constructor recovers the stocks from the given directory
+        into the table and starts a new log segment.
+
+        \param[in] dir The directory where the log segments and the
+        snapshot are stored.  It is created if it does not exist.
+
+        \param[in] table The table of stocks to be recovered and
+        later snapshotted.
+    */
+    StockLog(const std::string& dir, StockTable& table) :
+        dir(dir), table(table), segment(0), snapSegment(0), fd(-1),
+        appendedLsn(0), durableLsn(0), failedLsn(0), flushing(false),
+        records(0) {
+        ::mkdir(dir.c_str(), 0755);
+        snapSegment = loadSnapshot();
+        segment = snapSegment;
+        while (replay(segmentPath(segment))) {
+            segment++;
+        }
+        // Start a fresh segment instead of appending to a segment
+        // that may end with a torn record.
+        if (!openSegment(segment)) {
+            throw std::runtime_error("Unable to open " + segmentPath(segment));
+        }
+    }
+
+    /** Obtain the scope within which a change must be made to the
+        balance of a stock and appended to the log. */
+    std::shared_lock<std::shared_mutex> changeScope() {
+        return std::shared_lock<std::shared_mutex>(checkpointMutex);
+    }
+
+    /** Append a record to the log.  The record is only buffered in
+        memory.  Use waitDurable to ensure it is on disk.
+
+        \param[in] op The type of the record.
+
+        \param[in] generation The number of the generation of stocks
+        that was changed (the new generation for a Reset).
+
+        \param[in] name The name of the stock.
+
+        \param[in] amount The balance or number of stocks.
+
+        \return The log sequence number (LSN) of the record.
+    */
+    uint64_t append(const Op op, const uint64_t generation,
+                    const std::string_view name, const unsigned int amount) {
+        const uint16_t len = name.size();
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.push_back(op);
+        pending.append(reinterpret_cast<const char*>(&generation),
+                       sizeof(generation));
+        pending.append(reinterpret_cast<const char*>(&amount), sizeof(amount));
+        pending.append(reinterpret_cast<const char*>(&len), sizeof(len));
+        pending.append(name.data(), len);
+        records++;
+        return ++appendedLsn;
+    }
+
+    /** Wait until the record with a given LSN (and all the records
+        before it) are on disk.  The calling thread may become the
+        leader that writes and syncs a group of records on behalf of
+        all the waiting threads.
+
+        \param[in] lsn The LSN returned by append.
+
+        \return This method returns false if the record could not be
+        made durable because writing or syncing the log failed.
+    */
+    bool waitDurable(const uint64_t lsn) {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (durableLsn < lsn) {
+            if (broken()) {
+                return false;
+            }
+            if (flushing) {
+                flushed.wait(lock);  // Some other thread is the leader
+                continue;
+            }
+            // Become the leader and flush all pending records.
+            flushing = true;
+            std::string group;
+            group.swap(pending);
+            const uint64_t groupLsn = appendedLsn;
+            const int groupFd = fd;
+            lock.unlock();
+            const bool ok = writeAll(groupFd, group) &&
+                (::fdatasync(groupFd) == 0);
+            lock.lock();
+            if (ok) {
+                durableLsn = groupLsn;
+            } else {
+                failedLsn  = groupLsn;
+            }
+            flushing = false;
+            flushed.notify_all();
+        }
+        return true;
+    }
+
+    /** Call a method once the record with a given LSN (and all the
+        records before it) are on disk, without waiting for it.  The
+        records are synced (in groups, as with waitDurable) by a
+        background thread that is started on first use, so the
+        StockLog must then never be destroyed.
+
+        \param[in] lsn The LSN returned by append.
+
+        \param[in] done The method to be called.  It is called by the
+        background thread (or right away by the calling thread if the
+        record is already on disk), so it must not block.  Its argument
+        is false if the record could not be made durable (see
+        waitDurable).
+    */
+    void whenDurable(const uint64_t lsn, std::function<void(bool)> done) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if ((durableLsn >= lsn) || broken()) {
+            const bool durable = (durableLsn >= lsn);
+            lock.unlock();
+            done(durable);
+            return;
+        }
+        callbacks.emplace_back(lsn, std::move(done));
+        if (!syncing) {
+            syncing = true;
+            std::thread([this] { syncCallbacks(); }).detach();
+        }
+        callbackAdded.notify_one();
+    }
+
+    /** Write a snapshot of the balances of all stocks and remove the
+        log segments that are no longer needed.  Changes are paused
+        only while the balances are copied and a new log segment is
+        started.  A snapshot also makes the records lost by a failed
+        write or sync (see waitDurable) durable. */
+    void snapshot() {
+        std::vector<std::pair<std::string, unsigned int>> stocks;
+        uint64_t snapSeg, generation, snapLsn;
+        {   // Take a consistent cut of the balances and the log
+            std::unique_lock<std::shared_mutex> cut(checkpointMutex);
+            const StockTable::GenerationPtr current = table.current();
+            generation = current->number();
+            current->forEach([&stocks](const Stock& stock) {
+                    stocks.push_back({stock.name, stock.balance.load()});
+                });
+            std::unique_lock<std::mutex> lock(mutex);
+            flushed.wait(lock, [this] { return !flushing; });
+            snapLsn = appendedLsn;
+            // A log with a gap is not worth extending.  Its records
+            // are covered by this snapshot (if it succeeds).
+            if (!broken() && (!writeAll(fd, pending) ||
+                              (::fdatasync(fd) != 0))) {
+                failedLsn = snapLsn;
+            }
+            if (!broken()) {
+                durableLsn = snapLsn;
+            }
+            pending.clear();
+            flushed.notify_all();
+            ::close(fd);
+            // A segment that can't be opened fails the writes to it.
+            openSegment(++segment);
+            snapSeg = segment;
+            records = 0;
+        }
+        // Write the snapshot to a temporary file and atomically
+        // rename it so that a crash never leaves a partial snapshot.
+        std::string data(SnapMagic, sizeof(SnapMagic));
+        const uint64_t count = stocks.size();
+        data.append(reinterpret_cast<const char*>(&snapSeg), sizeof(snapSeg));
+        data.append(reinterpret_cast<const char*>(&generation),
+                    sizeof(generation));
+        data.append(reinterpret_cast<const char*>(&count), sizeof(count));
+        for (const auto& entry : stocks) {
+            const uint16_t len = entry.first.size();
+            data.append(reinterpret_cast<const char*>(&entry.second),
+                        sizeof(entry.second));
+            data.append(reinterpret_cast<const char*>(&len), sizeof(len));
+            data.append(entry.first);
+        }
+        const std::string tmpPath = dir + "/snapshot.tmp";
+        const int snapFd = ::open(tmpPath.c_str(),
+                                  O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        const bool written = writeAll(snapFd, data) &&
+            (::fsync(snapFd) == 0);
+        ::close(snapFd);
+        // The rename must be on disk before the older segments, which
+        // are now covered by the snapshot, are removed.
+        if (!written ||
+            (::rename(tmpPath.c_str(), (dir + "/snapshot").c_str()) != 0) ||
+            !syncDir()) {
+            return;  // The older segments are still needed.
+        }
+        for (uint64_t seg = snapSegment; (seg < snapSeg); seg++) {
+            ::unlink(segmentPath(seg).c_str());
+        }
+        syncDir();
+        snapSegment = snapSeg;
+        // Everything up to the cut is now durable, even if the log
+        // had a gap before it.
+        std::lock_guard<std::mutex> lock(mutex);
+        durableLsn = std::max(durableLsn, snapLsn);
+        flushed.notify_all();
+    }
+
+    /** Start a detached background thread that periodically writes a
+        snapshot.  A snapshot is taken once minRecords have been
+        logged, or at least every interval if anything was logged.
+
+        \param[in] interval The maximum time between snapshots.
+
+        \param[in] minRecords The number of records that trigger a
+        snapshot right away.
+    */
+    void startSnapshots(const std::chrono::seconds interval,
+                        const size_t minRecords) {
+        std::thread([this, interval, minRecords] {
+                auto last = std::chrono::steady_clock::now();
+                while (true) {
+                    std::this_thread::sleep_for(std::chrono::seconds(1));
+                    const auto now = std::chrono::steady_clock::now();
+                    if ((records >= minRecords) ||
+                        ((records > 0) && (now - last >= interval))) {
+                        snapshot();
+                        last = now;
+                    }
+                }
+            }).detach();
+    }
+
+private:
+    // The magic string at the start of a snapshot file.
+    static constexpr char SnapMagic[8] = {'S', 'T', 'K', 'S',
+                                          'N', 'A', 'P', '2'};
+
+    // The method run by the background thread of whenDurable.  It
+    // syncs the records that the queued methods wait for and then
+    // calls the methods whose records are on disk (or can't be made
+    // durable because the log is broken).
+    void syncCallbacks() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            callbackAdded.wait(lock, [this] { return !callbacks.empty(); });
+            uint64_t lsn = 0;
+            for (const auto& entry : callbacks) {
+                lsn = std::max(lsn, entry.first);
+            }
+            lock.unlock();
+            waitDurable(lsn);
+            lock.lock();
+            const bool failed = broken();
+            const auto waiting = std::stable_partition(callbacks.begin(),
+                callbacks.end(), [this, failed](const auto& entry) {
+                    return failed || (entry.first <= durableLsn); });
+            std::vector<std::pair<std::function<void(bool)>, bool>> ready;
+            for (auto entry = callbacks.begin(); (entry != waiting); entry++) {
+                ready.push_back({std::move(entry->second),
+                                 entry->first <= durableLsn});
+            }
+            callbacks.erase(callbacks.begin(), waiting);
+            lock.unlock();
+            for (const auto& done : ready) {
+                done.first(done.second);
+            }
+            lock.lock();
+        }
+    }
+
+    // Helper method to check if a group of records after the durable
+    // ones could not be written or synced.  In that case the records
+    // after the gap can't be made durable by the log.  The caller must
+    // hold the mutex.
+    bool broken() const {
+        return failedLsn > durableLsn;
+    }
+
+    // Helper method to obtain the path to a given log segment.
+    std::string segmentPath(const uint64_t seg) const {
+        return dir + "/wal." + std::to_string(seg);
+    }
+
+    // Helper method to open (create) a new log segment.  The entry of
+    // the segment in the directory is synced right away so that the
+    // records later synced via fdatasync are not lost in a crash.
+    // Returns false if the segment could not be created.
+    bool openSegment(const uint64_t seg) {
+        fd = ::open(segmentPath(seg).c_str(),
+                    O_WRONLY | O_CREAT | O_APPEND, 0644);
+        return (fd >= 0) && syncDir();
+    }
+
+    // Helper method to make the changes to the entries in the
+    // directory (files created, renamed, or removed) durable.
+    // Returns false if the directory could not be synced.
+    bool syncDir() const {
+        const int dirFd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+        if (dirFd < 0) {
+            return false;
+        }
+        const bool ok = (::fsync(dirFd) == 0);
+        ::close(dirFd);
+        return ok;
+    }
+
+    // Helper method to write all the given data to a file.  Returns
+    // false if a write failed.
+    static bool writeAll(const int fd, const std::string& data) {
+        for (size_t done = 0; (done < data.size());) {
+            const ssize_t count = ::write(fd, data.data() + done,
+                                          data.size() - done);
+            if ((count < 0) && (errno != EINTR)) {
+                return false;
+            }
+            done += std::max<ssize_t>(count, 0);
+        }
+        return true;
+    }
+
+    // Helper method to read an entire file into memory.  Returns
+    // false if the file does not exist.
+    static bool readFile(const std::string& path, std::string& data) {
+        std::ifstream is(path, std::ios::binary);
+        if (!is.good()) {
+            return false;
+        }
+        data.assign(std::istreambuf_iterator<char>(is),
+                    std::istreambuf_iterator<char>());
+        return true;
+    }
+
+    // Helper method to load the snapshot (if any) into the table.
+    // Returns the first log segment not covered by the snapshot.
+    uint64_t loadSnapshot() {
+        std::string data;
+        if (!readFile(dir + "/snapshot", data) ||
+            (data.size() < sizeof(SnapMagic) + 24) ||
+            (data.compare(0, sizeof(SnapMagic), SnapMagic,
+                          sizeof(SnapMagic)) != 0)) {
+            return 0;
+        }
+        uint64_t seg, generation, count;
+        const char* pos = data.data() + sizeof(SnapMagic);
+        std::memcpy(&seg, pos, sizeof(seg));
+        std::memcpy(&generation, pos + sizeof(seg), sizeof(generation));
+        std::memcpy(&count, pos + 2 * sizeof(seg), sizeof(count));
+        pos += 3 * sizeof(seg);
+        table.reset(generation);
+        StockTable::Generation& stocks = *table.current();
+        for (uint64_t i = 0; (i < count); i++) {
+            unsigned int balance;
+            uint16_t len;
+            std::memcpy(&balance, pos, sizeof(balance));
+            std::memcpy(&len, pos + sizeof(balance), sizeof(len));
+            pos += sizeof(balance) + sizeof(len);
+            stocks.insert(std::string_view(pos, len), balance);
+            pos += len;
+        }
+        return seg;
+    }
+
+    // Helper method to replay the records in a log segment.  A torn
+    // record at the end of the segment is ignored.  Returns false if
+    // the segment does not exist.
+    bool replay(const std::string& path) {
+        std::string data;
+        if (!readFile(path, data)) {
+            return false;
+        }
+        const size_t hdrLen = 1 + sizeof(uint64_t) + sizeof(unsigned int) +
+            sizeof(uint16_t);
+        for (size_t pos = 0; (pos + hdrLen <= data.size());) {
+            uint64_t generation;
+            unsigned int amount;
+            uint16_t len;
+            const char* field = &data[pos + 1];
+            std::memcpy(&generation, field, sizeof(generation));
+            field += sizeof(generation);
+            std::memcpy(&amount, field, sizeof(amount));
+            std::memcpy(&len, field + sizeof(amount), sizeof(len));
+            if (pos + hdrLen + len > data.size()) {
+                break;  // Torn record
+            }
+            const std::string_view name(&data[pos + hdrLen], len);
+            apply(static_cast<Op>(data[pos]), generation, name, amount);
+            pos += hdrLen + len;
+        }
+        return true;
+    }
+
+    // Helper method to apply a record from the log to the table.  The
+    // records of older generations are dropped.  A record of a newer
+    // generation implies the reset that started it, even if the record
+    // of the reset was logged after it.
+    void apply(const Op op, const uint64_t generation,
+               const std::string_view name, const unsigned int amount) {
+        const uint64_t current = table.current()->number();
+        if (generation > current) {
+            table.reset(generation);
+        }
+        if ((op == Reset) || (generation < current)) {
+            return;
+        }
+        StockTable::Generation& stocks = *table.current();
+        if (op == Create) {
+            stocks.insert(name, amount);
+        } else if (Stock* stock = stocks.find(name)) {
+            if (op == Sell) {
+                stock->balance += amount;
+            } else {
+                stock->balance -= amount;
+            }
+        }
+    }
+
+    // The directory where the log segments and snapshot are stored.
+    const std::string dir;
+    // The table of stocks that is logged.
+    StockTable& table;
+    // The log segment to which records are currently appended.
+    uint64_t segment;
+    // The first log segment not covered by the latest snapshot.
+    uint64_t snapSegment;
+    // The file descriptor of the current log segment.
+    int fd;
+    // The records appended but not yet written to the log segment.
+    std::string pending;
+    // The LSN of the most recently appended record.
+    uint64_t appendedLsn;
+    // All records up to this LSN are on disk.
+    uint64_t durableLsn;
+    // The last LSN of the most recent group that could not be written
+    // or synced.  See broken().
+    uint64_t failedLsn;
+    // Flag to indicate if a leader is currently writing to disk.
+    bool flushing;
+    // The methods (and the LSNs they wait for) queued by whenDurable,
+    // and a flag set once the thread that calls them is started.
+    std::vector<std::pair<uint64_t, std::function<void(bool)>>> callbacks;
+    bool syncing = false;
+    // The number of records appended since the last snapshot.
+    std::atomic<size_t> records;
+    // The mutex protecting the above instance variables.
+    std::mutex mutex;
+    // Signaled by the leader once a group of records is on disk.
+    std::condition_variable flushed;
+    // Signaled when a method is queued by whenDurable.
+    std::condition_variable callbackAdded;
+    // Changes hold this lock shared, and snapshots hold it exclusive.
+    std::shared_mutex checkpointMutex;
+};
+
+#endif
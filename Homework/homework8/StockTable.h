@@ -0,0 +1,321 @@
+#ifndef STOCK_TABLE_H
+#define STOCK_TABLE_H
+
+/**
+ * A concurrent table of stocks used by the stock exchange server.
+ * Stock symbols (e.g., "0x01") are interned to dense integer IDs via
+ * independently locked shards so that creates can run concurrently
+ * with trades.  The stocks themselves live in a chunked array indexed
+ * by ID.  The table can be reset by swapping in a fresh, empty
+ * generation.
+ *
+ * Copyright 2021 zarembmj@miamioh.edu
+ */
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "Stock.h"
+
+// ------------------------------------------------------------------- //
+// ****  NOTE: NEVER NEVER put "using namespace" IN A HEADER FILE  *** //
+// ------------------------------------------------------------------- //
+
+/** The dense integer ID assigned to each stock symbol. */
+using StockId = uint32_t;
+
+/**
+ * A sharded table of stocks.  Stocks are never moved or removed once
+ * created, so a StockId (or Stock&) obtained from the table stays
+ * valid for as long as the caller holds on to the generation it came
+ * from.
+ *
+ * A reset does not tear down the table under its readers.  Instead,
+ * it atomically swaps in a new, empty generation.  Requests that are
+ * in-flight continue to use the generation they started with (via
+ * their shared_ptr), and the old generation is freed when the last of
+ * them finishes.
+ */
+class StockTable {
+public:
+    /** The number of independently locked symbol shards. */
+    static constexpr size_t NumShards = 64;
+
+    /** The number of stocks allocated together in one chunk. */
+    static constexpr size_t ChunkSize = 4096;
+
+    /** The maximum number of chunks (and hence stocks) in a table. */
+    static constexpr size_t MaxChunks = 4096;
+
+    /** The ID returned when a stock symbol is not found. */
+    static constexpr StockId NoStock = UINT32_MAX;
+
+    /**
+     * One generation of stocks.  All the methods in this class are
+     * MT-safe.
+     */
+    class Generation {
+    public:
+        /** The constructor. Chunks are only allocated on demand.
+
+            \param[in] number The number of this generation.  Each
+            reset of the table starts a generation with a higher number.
+        */
+        explicit Generation(const uint64_t number = 0) :
+            chunks(), nextId(0), num(number) {}
+
+        /** The destructor frees the chunks of stocks. */
+        ~Generation() {
+            for (auto& chunk : chunks) {
+                delete[] chunk.load();
+            }
+        }
+
+        /** The number of this generation. */
+        uint64_t number() const { return num; }
+
+        /** Look up the ID of a stock.  The symbol is hashed only once.
+
+            \param[in] name The name of the stock to look up.
+
+            \return The ID of the stock or NoStock if the stock does
+            not exist.
+        */
+        StockId lookup(const std::string_view name) const {
+            const size_t hash = std::hash<std::string_view>()(name);
+            const Shard& shard = shards[hash % NumShards];
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            return probe(shard, hash, name);
+        }
+
+        /** Obtain the stock with a given ID.  This is just an array
+            access and no locks are involved.
+
+            \param[in] id A valid ID obtained via lookup or insert.
+
+            \return The stock with the given ID.
+        */
+        Stock& at(const StockId id) const {
+            return chunks[id / ChunkSize].load(std::memory_order_acquire)
+                [id % ChunkSize];
+        }
+
+        /** Look up a stock.
+
+            \param[in] name The name of the stock to look up.
+
+            \return A pointer to the stock or nullptr if the stock
+            does not exist.
+        */
+        Stock* find(const std::string_view name) const {
+            const StockId id = lookup(name);
+            return (id == NoStock ? nullptr : &at(id));
+        }
+
+        /** Create a stock if it does not already exist.
+
+            \param[in] name The name of the stock to be created.
+
+            \param[in] balance The initial balance for a new stock.
+
+            \param[in] created If not empty, this function is called
+            with a new stock once it is initialized, but before other
+            threads can find it.  So anything it does (e.g., logging
+            the create) happens before any trades on the stock.
+
+            \return The ID of the stock with the given name and a flag
+            that is true if the stock was created by this call.
+        */
+        std::pair<StockId, bool>
+        insert(const std::string_view name, const unsigned int balance,
+               const std::function<void(const Stock&)>& created = nullptr) {
+            const size_t hash = std::hash<std::string_view>()(name);
+            Shard& shard = shards[hash % NumShards];
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            StockId id = probe(shard, hash, name);
+            if (id != NoStock) {
+                return {id, false};
+            }
+            // Allocate a new ID and initialize the stock before
+            // publishing it in the shard.
+            id = allocate();
+            Stock& stock  = at(id);
+            stock.name    = std::string(name);
+            stock.balance = balance;
+            stock.generation = num;
+            if (created) {
+                created(stock);
+            }
+            addSlot(shard, {hash, id});
+            return {id, true};
+        }
+
+        /** Call a given function on every stock in this generation.
+
+            \note Stocks created concurrently with this call may or
+            may not be visited, and may not be fully initialized yet.
+
+            \param[in] func The function to be called on each stock.
+        */
+        template <typename Func>
+        void forEach(Func func) const {
+            const StockId count = nextId.load();
+            for (StockId id = 0; (id < count); id++) {
+                // The chunk of a stock being created may not exist yet
+                const Stock* chunk = chunks[id / ChunkSize].load(
+                    std::memory_order_acquire);
+                if (chunk != nullptr) {
+                    func(chunk[id % ChunkSize]);
+                }
+            }
+        }
+
+    private:
+        /** An entry in the open-addressing hash table of a shard. */
+        struct Slot {
+            size_t  hash;  // The full hash of the stock symbol
+            StockId id;    // The stock's ID or NoStock if slot is empty
+        };
+
+        /** A shard of the symbol table.  Each shard is on its own
+            cache line(s) so that locking one shard does not slow down
+            accesses to its neighbors. */
+        struct alignas(64) Shard {
+            // Readers-writer lock protecting the slots below.  Trades
+            // only need a shared lock to find their stock.
+            mutable std::shared_mutex mutex;
+            // Open-addressing (linear probing) table of symbols.
+            std::vector<Slot> slots = std::vector<Slot>(16, {0, NoStock});
+            // The number of slots that are in use.
+            size_t used = 0;
+        };
+
+        // Helper method to find a symbol in a shard.  The caller must
+        // hold a lock on the shard.
+        StockId probe(const Shard& shard, const size_t hash,
+                      const std::string_view name) const {
+            const size_t mask = shard.slots.size() - 1;
+            for (size_t i = (hash / NumShards) & mask; ; i = (i + 1) & mask) {
+                const Slot& slot = shard.slots[i];
+                if (slot.id == NoStock) {
+                    return NoStock;
+                }
+                if ((slot.hash == hash) && (at(slot.id).name == name)) {
+                    return slot.id;
+                }
+            }
+        }
+
+        // Helper method to add a symbol to a shard, growing the slots
+        // if they are half full.  Caller must hold an exclusive lock.
+        void addSlot(Shard& shard, const Slot& entry) {
+            if (2 * (shard.used + 1) > shard.slots.size()) {
+                std::vector<Slot> old(2 * shard.slots.size(), {0, NoStock});
+                old.swap(shard.slots);
+                for (const Slot& slot : old) {
+                    if (slot.id != NoStock) {
+                        place(shard, slot);
+                    }
+                }
+            }
+            place(shard, entry);
+            shard.used++;
+        }
+
+        // Helper method to put an entry in the first free slot.
+        void place(Shard& shard, const Slot& entry) {
+            const size_t mask = shard.slots.size() - 1;
+            size_t i = (entry.hash / NumShards) & mask;
+            while (shard.slots[i].id != NoStock) {
+                i = (i + 1) & mask;
+            }
+            shard.slots[i] = entry;
+        }
+
+        // Helper method to allocate the next ID, allocating a chunk of
+        // stocks if necessary.  The ID is only taken if it is within
+        // the capacity, so nextId never exceeds it (see forEach).
+        StockId allocate() {
+            StockId id = nextId.load();
+            do {
+                if (id >= ChunkSize * MaxChunks) {
+                    throw std::length_error("Too many stocks");
+                }
+            } while (!nextId.compare_exchange_weak(id, id + 1));
+            std::atomic<Stock*>& chunk = chunks[id / ChunkSize];
+            if (chunk.load(std::memory_order_acquire) == nullptr) {
+                // Creates in other shards may race to allocate the
+                // same chunk. Only one of them wins.
+                Stock* fresh = new Stock[ChunkSize];
+                Stock* expected = nullptr;
+                if (!chunk.compare_exchange_strong(expected, fresh)) {
+                    delete[] fresh;
+                }
+            }
+            return id;
+        }
+
+        // The fixed set of symbol shards in this generation.
+        std::array<Shard, NumShards> shards;
+        // The chunks of stocks, indexed by ID / ChunkSize.
+        std::array<std::atomic<Stock*>, MaxChunks> chunks;
+        // The next ID to be assigned.
+        std::atomic<StockId> nextId;
+        // The number of this generation.
+        const uint64_t num;
+    };
+
+    /** Shortcut to a shared pointer to a generation. */
+    using GenerationPtr = std::shared_ptr<Generation>;
+
+    /** The constructor creates the initial, empty generation. */
+    StockTable() : generation(std::make_shared<Generation>()) {}
+
+    /** Obtain the current generation of stocks.  Callers should hold
+        on to the returned pointer for the duration of a request.
+
+        \return The current generation of stocks.
+    */
+    GenerationPtr current() const {
+        return std::atomic_load(&generation);
+    }
+
+    /** Remove all stocks by swapping in a new, empty generation.  The
+        new generation is numbered 1 more than the current one.
+
+        \return The number of the new generation.
+    */
+    uint64_t reset() {
+        std::lock_guard<std::mutex> lock(resetMutex);
+        const uint64_t number = current()->number() + 1;
+        reset(number);
+        return number;
+    }
+
+    /** Swap in a new, empty generation with a given number.  This is
+        used to recover the table from a log.
+
+        \param[in] number The number of the new generation.
+    */
+    void reset(const uint64_t number) {
+        std::atomic_store(&generation, std::make_shared<Generation>(number));
+    }
+
+private:
+    // The current generation. Only accessed via std::atomic_load and
+    // std::atomic_store.
+    GenerationPtr generation;
+    // Serializes resets so that generation numbers only ever increase.
+    std::mutex resetMutex;
+};
+
+#endif
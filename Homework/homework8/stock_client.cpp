@@ -25,6 +25,9 @@
 #include <utility>
 #include <vector>
 #include <chrono>
+#include <atomic>
+#include <map>
+#include "LatencyHistogram.h"
 
 // Convenience namespaces used in this source file.
 using namespace boost::asio;
@@ -35,16 +38,25 @@ using namespace std::literals::chrono_literals;
 using ReqRespList = std::vector<std::pair<std::string, std::string>>;
 
 /** Helper method to read the actual 1-line response from the server
-    and check to ensure its length match with content-length.
+    and check to ensure its length match with content-length.  On a
+    persistent connection exactly content-length bytes are read, so
+    that the next response can be read from the same stream.
 */
 std::string getMessageFromServer(std::istream& is, size_t contentLen,
-                                 std::string resp, const bool printResp) {
+                                 std::string resp, const bool printResp,
+                                 const bool keepAlive = false) {
     // Get the message at the end of the HTTP response.
     std::string msg, line;
     resp.append("\n");
-    while (std::getline(is, line)) {
-        msg += line;  // Accummulate response.
-        resp.append(line).append("\n");
+    if (keepAlive && (contentLen != std::string::npos)) {
+        msg.resize(contentLen);
+        msg.resize(is.read(&msg[0], contentLen).gcount());
+        resp.append(msg).append("\n");
+    } else {
+        while (std::getline(is, line)) {
+            msg += line;  // Accummulate response.
+            resp.append(line).append("\n");
+        }
     }
 
     // Print the whole message to help students troubleshoot their
@@ -67,8 +79,13 @@ std::string getMessageFromServer(std::istream& is, size_t contentLen,
 /**
  * Helper method to extract the response message from the HTTP
  * response.
+ *
+ * \param[in,out] keepAlive If this pointer is not null, the response
+ * is read from a persistent connection.  The flag is cleared if the
+ * server indicates that it is going to close the connection.
  */
-std::string getResponse(std::istream& is, const bool printResp = false) {
+std::string getResponse(std::istream& is, const bool printResp = false,
+                        bool* keepAlive = nullptr) {
     std::string line, resp;
     size_t contentLen = -1;  // set in loop below
     while (std::getline(is, line) && (line != "\r")) {
@@ -82,6 +99,10 @@ std::string getResponse(std::istream& is, const bool printResp = false) {
         if (line.substr(0, 16) == "Content-Length: ") {
             contentLen = std::stoi(line.substr(16));
         }
+        // Check if the server is going to close a persistent connection
+        if ((keepAlive != nullptr) && (line == "Connection: Close")) {
+            *keepAlive = false;
+        }
         resp.append(line).append("\n");
     }
     if (!is.good()) {
@@ -91,31 +112,35 @@ std::string getResponse(std::istream& is, const bool printResp = false) {
 
     // Get the message at the end of the HTTP response, validate it,
     // and return the message for further checks.
-    return getMessageFromServer(is, contentLen, resp, printResp);
+    return getMessageFromServer(is, contentLen, resp, printResp,
+                                keepAlive != nullptr);
 }
 
-/** Helper method to send a request to the server and process the
-    response from the server.
+/** Helper method to send a request to the server over a given
+    connection and validate the response from the server.
+
+    \param[in,out] keepAlive If this pointer is not null, the request
+    asks the server to keep the connection open.  The flag is cleared
+    if the server is going to close the connection.
 */
-void processRequest(std::string port, const std::string& request,
+void processRequest(ip::tcp::iostream& server, const std::string& port,
+                    const std::string& request,
                     const std::string& expectedResult,
-                    const bool printResp = false) {
-    ip::tcp::iostream server("localhost", port);
-    if (!server) {
-        // Can't connect to server
-        std::cout << "Error connecting to server on port " << port << std::endl;
-        return;
-    }
+                    const bool printResp, bool* keepAlive) {
     // First send the request to the server.
     server << "GET /" << request << " HTTP/1.1\r\n"
            << "Host: localhost:" << port << "\r\n"
-           << "Connection: close\r\n\r\n";
+           << (keepAlive ? "Connection: keep-alive\r\n\r\n" :
+               "Connection: close\r\n\r\n") << std::flush;
     // Get the first line and ensure it is HTTP 200 OK.
     std::string line;
     if (std::getline(server, line), line != "HTTP/1.1 200 OK\r") {
         std::cerr << "Invalid header line from server ('" << line << "')\n";
+        if (keepAlive) {
+            *keepAlive = false;  // Don't reuse a broken connection
+        }
     } else {
-        const std::string msg = getResponse(server, printResp);
+        const std::string msg = getResponse(server, printResp, keepAlive);
         // Read rest of the message from the client.
         if (msg != expectedResult) {
             std::cerr << "Invalid msg from server. Expected: '"
@@ -126,6 +151,77 @@ void processRequest(std::string port, const std::string& request,
     }
 }
 
+/** Helper method to send a request to the server and process the
+    response from the server.
+*/
+void processRequest(std::string port, const std::string& request,
+                    const std::string& expectedResult,
+                    const bool printResp = false) {
+    ip::tcp::iostream server("localhost", port);
+    if (!server) {
+        // Can't connect to server
+        std::cout << "Error connecting to server on port " << port << std::endl;
+        return;
+    }
+    processRequest(server, port, request, expectedResult, printResp, nullptr);
+}
+
+/** Helper method to send a list of requests to the server, one after
+    the other, reusing one persistent connection.  A new connection is
+    opened only if the server closes the current one.
+*/
+void processRequests(std::string port, const ReqRespList reqRespList,
+                     const bool printResp = false) {
+    std::unique_ptr<ip::tcp::iostream> server;
+    bool keepAlive = false;
+    for (const auto& reqResp : reqRespList) {
+        if (!keepAlive) {
+            // Open a new persistent connection to the server.
+            server = std::make_unique<ip::tcp::iostream>("localhost", port);
+            if (!*server) {
+                std::cout << "Error connecting to server on port "
+                          << port << std::endl;
+                return;
+            }
+            keepAlive = true;
+        }
+        processRequest(*server, port, reqResp.first, reqResp.second,
+                       printResp, &keepAlive);
+    }
+}
+
+/**
+ * Run requests using 1 or more threads, with each thread reusing one
+ * persistent connection to the server.  Thread i sends requests i,
+ * i + numThreads, i + 2 * numThreads, etc.
+ *
+ * \param[in] port The port number to be use to communicate with the server.
+ *
+ * \param[in] reqRespList The list of requests and corresponding
+ * responses expected from the server.
+ */
+void runKeepAliveRequests(const std::string& port,
+                          const ReqRespList& reqRespList, const int numThreads,
+                          const bool printResp = false,
+                          const bool nowait = false) {
+    std::vector<std::thread> thrList;
+    for (int thr = 0; (thr < numThreads) &&
+             (thr < static_cast<int>(reqRespList.size())); thr++) {
+        // Make the list of requests to be sent by this thread
+        ReqRespList thrReqs;
+        for (size_t req = thr; (req < reqRespList.size()); req += numThreads) {
+            thrReqs.push_back(reqRespList[req]);
+        }
+        thrList.push_back(std::thread(processRequests, port, thrReqs,
+                                      printResp));
+    }
+    // If we should not wait for requests to finish then we simply
+    // place the threads in background.
+    for (auto& t : thrList) {
+        nowait ? t.detach() : t.join();
+    }
+}
+
 /**
  * Run requests using 1 or more threads.
  *
@@ -133,10 +229,18 @@ void processRequest(std::string port, const std::string& request,
  *
  * \param[in] reqRespList The list of requests and corresponding
  * responses expected from the server.
+ *
+ * \param[in] keepAlive If true, each thread reuses 1 persistent
+ * connection (see runKeepAliveRequests) instead of opening a
+ * connection per request.
  */
 void runRequests(const std::string& port, const ReqRespList& reqRespList,
                  const int numThreads, const bool printResp = false,
-                 const bool nowait = false) {
+                 const bool nowait = false, const bool keepAlive = false) {
+    if (keepAlive) {
+        runKeepAliveRequests(port, reqRespList, numThreads, printResp, nowait);
+        return;
+    }
     // Submit requests to the server in batches of size 'numThreads'
     for (size_t stReq = 0; (stReq < reqRespList.size()); stReq += numThreads) {
         // Sumit a batch of requests to the server.
@@ -147,8 +251,8 @@ void runRequests(const std::string& port, const ReqRespList& reqRespList,
             const std::string req  = reqRespList[currReq].first;
             const std::string resp = reqRespList[currReq].second;
             // Create a thread to submit request & validate response
-            thrList.push_back(std::thread(processRequest, port, req,
-                                          resp, printResp));
+            thrList.push_back(std::thread([port, req, resp, printResp] {
+                        processRequest(port, req, resp, printResp); }));
         }
 
         // If we should not wait for requests to finish then we simply
@@ -187,10 +291,12 @@ void checkThreads(const int pid, const int numThr) {
 
 /**
  * Helper method to read line-by-line of transaction and expected
- * response and send it to server for testing.
+ * response and send it to server for testing.  With keepAlive, the
+ * requests are sent over persistent connections.
  */
 void processInputCmds(std::istream& input, const std::string& port,
-                      const bool printResp = false) {
+                      const bool printResp = false,
+                      const bool keepAlive = false) {
     // Read line-by-line of request-response pairs until a "run"
     // command is countered.
     std::string req, resp;   // request, response.
@@ -204,7 +310,7 @@ void processInputCmds(std::istream& input, const std::string& port,
             input >> thrs >> reps;
             for (int rep = 0; (rep < reps); rep++) {
                 runRequests(port, testData, thrs, printResp,
-                            (rep == reps - 1) && (req == "nowait"));
+                            (rep == reps - 1) && (req == "nowait"), keepAlive);
             }
             testData.clear();  // Clear out this batch of tests.
             std::cout << "Finished block #" << block++ << " testing phase.\n";
@@ -222,17 +328,244 @@ void processInputCmds(std::istream& input, const std::string& port,
     std::cout << "Testing completed.\n";
 }
 
+/** The latency histogram and error count for 1 type of transaction
+    (e.g., "buy") observed by the benchmark.
+*/
+struct BenchStats {
+    LatencyHistogram latency;  // Latencies in microseconds
+    size_t errors = 0;         // Requests without a valid response
+};
+
+/** Helper method to send 1 request over a persistent connection and
+    read the response, without any checks on the message itself.
+
+    \param[in,out] keepAlive Cleared if the server is going to close
+    the connection (or the connection is broken).
+
+    \return This method returns true if a complete HTTP 200 OK response
+    was received.
+*/
+bool sendBenchRequest(ip::tcp::iostream& server, const std::string& port,
+                      const std::string& request, bool& keepAlive) {
+    server << "GET /" << request << " HTTP/1.1\r\n"
+           << "Host: localhost:" << port << "\r\n"
+           << "Connection: keep-alive\r\n\r\n" << std::flush;
+    std::string line;
+    std::getline(server, line);
+    const bool ok = (line == "HTTP/1.1 200 OK\r");
+    size_t contentLen = 0;
+    while (std::getline(server, line) && (line != "\r")) {
+        if (line.substr(0, 16) == "Content-Length: ") {
+            contentLen = std::stoul(line.substr(16));
+        } else if (line == "Connection: Close\r") {
+            keepAlive = false;
+        }
+    }
+    // Note: ignore() would block peeking past the end of the message.
+    std::string msg(contentLen, ' ');
+    server.read(&msg[0], contentLen);
+    if (!server.good()) {
+        keepAlive = false;
+        return false;
+    }
+    return ok;
+}
+
+/**
+ * Helper method for each benchmark thread.  Requests are sent on a
+ * fixed schedule (open-loop): request i is due at start + i / rate,
+ * irrespective of how long earlier requests took.  Each thread
+ * claims the next due request, waits until it is due, and sends it.
+ * Latency is measured from the time the request was due (rather than
+ * when it was actually sent) so that a slow server is not hidden by
+ * the client falling behind schedule (coordinated omission).
+ *
+ * \param[in] port The port number of the server.
+ *
+ * \param[in] reqs The requests that are sent round-robin.
+ *
+ * \param[in] types The index of the type of transaction (into stats)
+ * for each request.
+ *
+ * \param[in] start The time at which the benchmark started.
+ *
+ * \param[in] interval The time between consecutive requests.
+ *
+ * \param[in] numReqs The total number of requests to be sent.
+ *
+ * \param[in] deadline The time by which all responses must arrive.
+ * Requests that are still pending at this time (e.g., a buy that is
+ * waiting for stocks) are counted as errors.
+ *
+ * \param[in,out] next The shared counter of requests claimed so far.
+ *
+ * \param[out] stats The statistics for each type of transaction for
+ * this thread.
+ */
+void benchThread(const std::string& port, const ReqRespList& reqs,
+                 const std::vector<size_t>& types,
+                 const std::chrono::steady_clock::time_point start,
+                 const std::chrono::nanoseconds interval,
+                 const size_t numReqs,
+                 const std::chrono::steady_clock::time_point deadline,
+                 std::atomic<size_t>& next,
+                 std::vector<BenchStats>& stats) {
+    using namespace std::chrono;
+    std::unique_ptr<ip::tcp::iostream> server;
+    bool keepAlive = false;
+    for (size_t i = next++; (i < numReqs); i = next++) {
+        const auto due = start + interval * i;
+        std::this_thread::sleep_until(due);
+        if (!keepAlive && (steady_clock::now() < deadline)) {
+            server = std::make_unique<ip::tcp::iostream>("localhost", port);
+            server->expires_at(deadline);
+            server->rdbuf()->set_option(tcp::no_delay(true));
+            keepAlive = server->good();
+        }
+        const size_t req = i % reqs.size();
+        const bool ok = keepAlive && (steady_clock::now() < deadline) &&
+            sendBenchRequest(*server, port, reqs[req].first, keepAlive);
+        BenchStats& stat = stats[types[req]];
+        if (ok) {
+            stat.latency.record(duration_cast<microseconds>(
+                                    steady_clock::now() - due).count());
+        } else {
+            stat.errors++;
+        }
+    }
+}
+
+/**
+ * Run an open-loop benchmark against the server and print latency
+ * percentiles, the achieved throughput, and errors for each type of
+ * transaction.  The requests in the input file are sent round-robin
+ * and the expected responses are ignored (as they depend on the order
+ * in which requests are processed).
+ *
+ * \param[in] input The input file with request-response pairs.
+ * The "run", "nowait", and "chkThr" commands are ignored.
+ *
+ * \param[in] port The port number of the server.
+ *
+ * \param[in] rate The target number of requests per second.
+ *
+ * \param[in] seconds The duration of the benchmark.
+ *
+ * \param[in] numThreads The number of persistent threads (each with
+ * its own connection) used to send requests.
+ */
+void runBenchmark(std::istream& input, const std::string& port,
+                  const double rate, const double seconds,
+                  const int numThreads) {
+    // Load the requests and classify them by transaction type.
+    ReqRespList reqs;
+    std::vector<size_t> types;
+    std::map<std::string, size_t> typeIdx;
+    std::string req, resp, dummy;
+    while (input >> std::quoted(req)) {
+        if (req == "run" || req == "nowait") {
+            input >> dummy >> dummy;
+        } else if (req == "chkThr") {
+            input >> dummy;
+        } else {
+            input >> std::quoted(resp);
+            const size_t end = req.find('&');
+            const std::string trans = req.substr(6, end == std::string::npos ?
+                                                 end : end - 6);
+            typeIdx.insert({trans, typeIdx.size()});
+            types.push_back(typeIdx[trans]);
+            reqs.push_back({req, resp});
+        }
+    }
+    if (reqs.empty() || (rate <= 0) || (numThreads <= 0)) {
+        std::cerr << "Nothing to benchmark.\n";
+        return;
+    }
+
+    // Have the threads send requests on schedule.
+    using namespace std::chrono;
+    const size_t numReqs = rate * seconds;
+    const nanoseconds interval(static_cast<int64_t>(1e9 / rate));
+    std::vector<std::vector<BenchStats>> stats(numThreads,
+            std::vector<BenchStats>(typeIdx.size()));
+    std::atomic<size_t> next(0);
+    const auto start = steady_clock::now();
+    const auto deadline = start + duration_cast<nanoseconds>(
+        duration<double>(seconds)) + 2s;
+    std::vector<std::thread> thrList;
+    for (int thr = 0; (thr < numThreads); thr++) {
+        thrList.push_back(std::thread(benchThread, port, std::cref(reqs),
+                                      std::cref(types), start, interval,
+                                      numReqs, deadline, std::ref(next),
+                                      std::ref(stats[thr])));
+    }
+    for (auto& t : thrList) {
+        t.join();
+    }
+    const double elapsed = duration<double>(steady_clock::now() -
+                                            start).count();
+
+    // Merge the per-thread statistics and print them.
+    std::cout << "Target rate: " << rate << " req/s, duration: "
+              << seconds << " s, threads: " << numThreads << '\n'
+              << std::setw(10) << "trans" << std::setw(10) << "count"
+              << std::setw(8)  << "errors" << std::setw(12) << "req/s"
+              << std::setw(10) << "p50(us)" << std::setw(10) << "p99(us)"
+              << std::setw(11) << "p999(us)" << std::setw(10) << "max(us)"
+              << '\n';
+    auto print = [elapsed](const std::string& name, const BenchStats& stat) {
+        std::cout << std::setw(10) << name
+                  << std::setw(10) << stat.latency.count() + stat.errors
+                  << std::setw(8)  << stat.errors << std::setw(12)
+                  << std::fixed << std::setprecision(1)
+                  << stat.latency.count() / elapsed
+                  << std::setw(10) << stat.latency.percentile(50)
+                  << std::setw(10) << stat.latency.percentile(99)
+                  << std::setw(11) << stat.latency.percentile(99.9)
+                  << std::setw(10) << stat.latency.max() << '\n';
+    };
+    BenchStats all;
+    for (const auto& type : typeIdx) {
+        BenchStats merged;
+        for (const auto& thrStats : stats) {
+            merged.latency.merge(thrStats[type.second].latency);
+            merged.errors += thrStats[type.second].errors;
+        }
+        print(type.first, merged);
+        all.latency.merge(merged.latency);
+        all.errors += merged.errors;
+    }
+    print("all", all);
+}
+
 #ifndef TEST_CLIENT
 
 void checkRunClient(const std::string& port)  {}
 
 /**
  * The main method just checks to ensure necessary command-lien
- * arguments are specified and then 
+ * arguments are specified and then runs the tests in the input
+ * file with:
+ *
+ *     stock_client InputFile ServerPort [keepalive] [print]
+ *
+ * where "keepalive" sends the requests of each thread over 1
+ * persistent connection (instead of 1 connection per request), and
+ * any further argument prints the responses.  Alternatively, the
+ * requests in the input file can be used to benchmark the server with:
+ *
+ *     stock_client InputFile ServerPort bench Rate Seconds [Threads]
+ *
+ * where Rate is the target number of requests per second, Seconds
+ * is the duration of the benchmark, and Threads is the number of
+ * concurrent connections to use (default is 8).
  */
 int main(int argc, char *argv[]) {
     if (argc < 3) {
-        std::cerr << "Specify InputFile and ServerPort\n";
+        std::cerr << "Usage: stock_client InputFile ServerPort "
+                  << "[keepalive] [print]\n"
+                  << "   or: stock_client InputFile ServerPort bench "
+                  << "Rate Seconds [Threads]\n";
         return 1;
     }
     // Open the input file to be used for testing.
@@ -242,16 +575,31 @@ int main(int argc, char *argv[]) {
         return 2;
     }
 
-    // Check and process optional parameter to print response
-    const bool printResp = (argc > 3);
+    // Run the benchmark instead of tests if requested.
+    if ((argc > 5) && (std::string(argv[3]) == "bench")) {
+        runBenchmark(input, argv[2], std::stod(argv[4]), std::stod(argv[5]),
+                     (argc > 6 ? std::stoi(argv[6]) : 8));
+        return 0;
+    }
+    // Check and process optional parameters to use persistent
+    // connections and to print responses.
+    const bool keepAlive = (argc > 3) && (std::string(argv[3]) == "keepalive");
+    const bool printResp = (argc > (keepAlive ? 4 : 3));
     // Have helper method process input commands from file
-    processInputCmds(input, argv[2], printResp);
+    processInputCmds(input, argv[2], printResp, keepAlive);
     // All done.
     return 0;
 }
 
 #else 
 
+/**
+ * The client run within the server (built with -DTEST_CLIENT).  As
+ * there is no command line for the client, it is configured with
+ * environment variables: TEST_FILE is the input file, KEEP_ALIVE (if
+ * set) uses persistent connections as the "keepalive" option does, and
+ * CLIENT_ABORT (if set) aborts the process after the tests.
+ */
 void runClientThread(const std::string port, const bool printResp = false) {
     std::string inputFile = getenv("TEST_FILE");
     std::ifstream input(inputFile);
@@ -261,7 +609,7 @@ void runClientThread(const std::string port, const bool printResp = false) {
     }
     // Wait for a few seconds to let the main thread spin-up
     std::this_thread::sleep_for(100ms);
-    processInputCmds(input, port, printResp);
+    processInputCmds(input, port, printResp, getenv("KEEP_ALIVE") != nullptr);
     std::this_thread::sleep_for(100ms);
     if (getenv("CLIENT_ABORT")) {
         abort();
@@ -20,7 +20,15 @@
 #include <mutex>
 #include <iomanip>
 #include <vector>
+#include <atomic>
+#include <algorithm>
+#include <string_view>
 #include "Stock.h"
+#include "StockTable.h"
+#include "StockLog.h"
+#include "BoundedQueue.h"
+#include "RequestParser.h"
+#include "Metrics.h"
 
 // Setup a server socket to accept connections on the socket
 using namespace boost::asio;
@@ -29,107 +37,416 @@ using namespace boost::asio::ip;
 // Shortcut to smart pointer with TcpStream
 using TcpStreamPtr = std::shared_ptr<tcp::iostream>;
 
-// Prototype for helper method defined in main.cpp
-std::string url_decode(std::string);
+/**
+ * The different strategies used by runServer() when the queue of
+ * accepted connections is full (that is, all the workers are busy and
+ * the backlog is at capacity).
+ */
+enum class Overflow {
+    Block,  // The acceptor waits until a worker frees up a slot
+    Shed,   // The connection is rejected with an HTTP 503 response
+    Grow    // A temporary worker is spun up to handle the excess load
+};
 
 // The name space to hold all of the information that is shared
 // between multiple threads.
 namespace sm {
-    // Unordered map including stock's name as the key (std::string)
+    // Concurrent table including stock's name as the key (std::string)
     // and the actual Stock entry as the value.
-    std::unordered_map<std::string, Stock> stockMap;
-    
-    // Homework 9 Code --------------------------------------------------------
-    // Atomic variable that counts the number of active threads
-    std::atomic<int> threadCount(0);
-    // Condition variable used to check if the number of active threads
-    // exceeds the limit.
-    std::condition_variable threadStatus;
-    // ------------------------------------------------------------------------
+    StockTable stockMap;
     
+    // The number of pending connections per worker thread that can be
+    // queued up before the overflow policy kicks in.
+    const int QueueFactor = 4;
+
+    // The duration for which a persistent (keep-alive) connection can
+    // stay idle before the server closes it.
+    const std::chrono::seconds IdleTimeout(5);
+
+    // The maximum number of requests processed on a single persistent
+    // connection before the server closes it.
+    const int MaxRequestsPerConn = 1000;
+
+    // The durable log of changes to stocks.  This is nullptr if the
+    // server was started without a data directory.  It is never
+    // deleted because detached threads use it until the process exits.
+    StockLog* stockLog = nullptr;
+
+    // The LSN of the most recent log record appended on behalf of the
+    // request being processed by this thread.  It is reset for each
+    // request, so that a record that could not be made durable fails
+    // only the request that appended it.
+    thread_local uint64_t lastLsn = 0;
+
+    // The maximum time between snapshots of the stocks.
+    const std::chrono::seconds SnapshotInterval(60);
+
+    // The number of log records that trigger a snapshot right away.
+    const size_t SnapshotRecords = 1000000;
+
+    // Atomic variable that counts the number of temporary workers
+    // spun up by the Overflow::Grow policy.
+    std::atomic<int> tempThreads(0);
+
+    // The counters reported at the /metrics URL.
+    Metrics metrics;
+
+    // The number of long-lived worker (or reactor) threads.
+    int poolThreads = 0;
+
+    // The number of connections currently being processed.
+    std::atomic<int> activeConns(0);
+
+    // The queue of connections waiting for a worker.  This is nullptr
+    // with the asynchronous engine.
+    BoundedQueue<TcpStreamPtr>* connQueue = nullptr;
+
+    // The number of stocks with the longest lock hold times reported
+    // at the /metrics URL.
+    const size_t MetricsTopStocks = 20;
+
+    // The longest time the operations of a batch on a stock wait for
+    // a sufficient balance.
+    const std::chrono::milliseconds BatchTimeout(5000);
+
+    // The threads on which the asynchronous engine processes batches,
+    // so that a batch waiting for a sufficient balance does not hold
+    // up a reactor thread.  This is nullptr with the thread-pool engine.
+    boost::asio::thread_pool* batchPool = nullptr;
+
+    // The response (and its HTTP status) sent in place of the result
+    // of a request whose changes could not be logged durably.
+    const std::string NotDurable = "Unable to log the change durably";
+    const std::string NotDurableStatus = "500 Internal Server Error";
 }  // namespace sm
 
+/**
+ * Helper method to obtain the scope within which a change to the
+ * stocks and appending its record to the log must be done.
+ *
+ * @return A lock to be held while making the change.  The lock is
+ * empty if logging is disabled.
+ */
+std::shared_lock<std::shared_mutex> logScope() {
+    return (sm::stockLog != nullptr ? sm::stockLog->changeScope() :
+            std::shared_lock<std::shared_mutex>());
+}
+
+/**
+ * Helper method to append a record of a change to the log (if logging
+ * is enabled).  The record is made durable before the response to the
+ * current request is sent.
+ *
+ * @note This method must be called within a logScope().
+ *
+ * @param op The type of change.
+ *
+ * @param generation The number of the generation of stocks that was
+ * changed (the new generation for a reset).
+ *
+ * @param name The name of the stock that was changed.
+ *
+ * @param amount The balance, or the number of stocks bought or sold.
+ */
+void logChange(const StockLog::Op op, const uint64_t generation,
+               const std::string_view name, const unsigned int amount) {
+    if (sm::stockLog != nullptr) {
+        sm::lastLsn = sm::stockLog->append(op, generation, name, amount);
+    }
+}
+
+/**
+ * Helper method to record the time for which a stock's mutex was held,
+ * just before the mutex is released.
+ *
+ * @note The caller must hold the stock's mutex.
+ *
+ * @param stock The stock whose mutex is about to be released.
+ *
+ * @param now The current time, from Metrics::now().
+ */
+void lockReleased(Stock& stock, const uint64_t now) {
+    const uint64_t held = now - stock.lockedAt;
+    stock.lockNanos.fetch_add(held, std::memory_order_relaxed);
+    stock.lockCount.fetch_add(1, std::memory_order_relaxed);
+    sm::metrics.add(Metrics::LockNanos, held);
+    sm::metrics.add(Metrics::Locks);
+}
+
+/**
+ * A lock on a stock's mutex that records how long the mutex is held.
+ * It can be used wherever a std::unique_lock is expected.
+ */
+class StockLock : public std::unique_lock<std::mutex> {
+public:
+    /** The constructor that locks the stock's mutex.
+
+        \param[in] stock The stock to be locked.
+    */
+    explicit StockLock(Stock& stock) :
+        std::unique_lock<std::mutex>(stock.mutex), stock(stock) {
+        stock.lockedAt = Metrics::now();
+    }
+
+    /** The destructor records the hold time before unlocking. */
+    ~StockLock() {
+        lockReleased(stock, Metrics::now());
+    }
+
+private:
+    // The stock whose mutex is held.
+    Stock& stock;
+};
+
 /**
  * This method is used to create a new stock entry in stockMap.
  * If the stock already exists, then then no new entry is added.
  *
- * @note This method assumes that it will be called in single-threaded mode
- * by stock_client.
+ * @note MT-safe.  Creates can run concurrently with other trades.
+ *
+ * @param stocks The generation of stocks in which the stock is created.
  *
  * @param stock The name of the stock.
  * 
  * @param balance The balance amount.
  */
-std::string createStock(const std::string& stock, unsigned int balance) {
-    // Check if stock exists
-    if (sm::stockMap.find(stock) == sm::stockMap.end()) {
-         // Create a new stock entry
-        sm::stockMap[stock].name = stock;
-        sm::stockMap[stock].balance = balance;
-        return "Stock " + stock + " created with balance = "
+std::string createStock(StockTable::Generation& stocks,
+                        const std::string_view stock, unsigned int balance) {
+    // Create a new stock entry if the stock does not exist.  The create
+    // is logged before other requests can find (and trade) the stock.
+    const auto scope = logScope();
+    const auto entry = stocks.insert(stock, balance,
+                                     [balance](const Stock& created) {
+            logChange(StockLog::Create, created.generation, created.name,
+                      balance); });
+    const std::string& name = stocks.at(entry.first).name;
+    if (entry.second) {
+        return "Stock " + name + " created with balance = "
             + std::to_string(balance);
     }
     // Returned if there is a duplicate account number
-    return "Stock " + stock + " already exists";
+    return "Stock " + name + " already exists";
 }
 
 /**
  * This method returns the status of the current balance on the specified stock.
- * It is assumed the the stock already exists.
+ * The balance is read atomically without locking the stock, so status
+ * requests never contend with trades.
  *
- * @param stock The name of the stock whose balance is to be returned.
+ * @param stock The stock whose balance is to be returned.
  *
  * @return A string containing the balance information for the given
  * stock.
  */
-std::string balanceStatus(const std::string& stock) {
-    std::ostringstream output;
+std::string balanceStatus(Stock& stock) {
+    return "Balance for stock " + stock.name + " = " +
+        std::to_string(stock.balance.load());
+}
+
+/**
+ * Helper method to try and buy stocks without blocking.  The balance
+ * is decremented via a compare-and-swap loop so that it never goes
+ * below zero.
+ *
+ * @param stock The stock on which the transaction is performed.
+ *
+ * @param trades The quantity of stocks being bought.
+ *
+ * @return This method returns true if the balance was sufficient and
+ * has been decremented.  Otherwise it returns false.
+ */
+bool tryBuy(Stock& stock, const unsigned trades) {
+    const auto scope = logScope();
+    unsigned int balance = stock.balance.load();
+    while (balance >= trades) {
+        if (stock.balance.compare_exchange_weak(balance, balance - trades)) {
+            logChange(StockLog::Buy, stock.generation, stock.name, trades);
+            return true;
+        }
+    }
+    return false;
+}
 
-    {  // !Begin critical section!
-        std::lock_guard<std::mutex> lock(sm::stockMap.at(stock).mutex);
-        output << "Balance for stock " << stock << " = "
-           << sm::stockMap.at(stock).balance;
-    }  // !End critical section!
+/**
+ * Helper method to hand off stocks to blocked buyers.  The wait queue
+ * is scanned in order of arrival and every buyer whose quantity can
+ * be satisfied from the current balance is granted its stocks (the
+ * balance is decremented on its behalf), removed from the queue, and
+ * woken up (or notified via its onGrant).  Buyers that cannot be
+ * satisfied stay asleep.  This is first-fit rather than strict FIFO:
+ * a smaller buyer (including one that just joined the queue) may be
+ * granted its stocks ahead of a larger buyer that arrived earlier.
+ *
+ * @note The caller must hold the stock's mutex.
+ *
+ * @param stock The stock whose waiting buyers are to be processed.
+ */
+void grantWaiters(Stock& stock) {
+    for (auto waiter = stock.waitQueue.begin();
+         (waiter != stock.waitQueue.end());) {
+        if (tryBuy(stock, (*waiter)->quantity)) {
+            (*waiter)->granted = true;
+            (*waiter)->lsn     = sm::lastLsn;
+            if ((*waiter)->onGrant) {
+                (*waiter)->onGrant();
+            } else {
+                (*waiter)->condVar.notify_one();
+            }
+            waiter = stock.waitQueue.erase(waiter);
+            stock.waiters--;
+        } else {
+            waiter++;
+        }
+    }
+}
 
-    return output.str();
+/**
+ * Helper method to add stocks to the balance via an atomic fetch-add
+ * and hand off stocks to blocked buyers (if any).  The mutex is taken
+ * only if there are buyers waiting.
+ *
+ * @param stock The stock on which the transaction is performed.
+ *
+ * @param trades The quantity of stocks being sold.
+ *
+ * @param locked True if the caller already holds the stock's mutex.
+ */
+void sell(Stock& stock, const unsigned trades, const bool locked = false) {
+    {   // Add stocks to the balance
+        const auto scope = logScope();
+        stock.balance += trades;
+        logChange(StockLog::Sell, stock.generation, stock.name, trades);
+    }
+    // Wake up the threads waiting to buy that can now proceed
+    if (locked) {
+        grantWaiters(stock);
+    } else if (stock.waiters.load() > 0) {
+        StockLock lock(stock);
+        grantWaiters(stock);
+    }
 }
 
 /**
- * This method updates the balance of available stocks using the sleep-wait
- * approach that's required for Homework 9.
+ * Helper method to buy stocks, waiting in the stock's wait queue if
+ * the balance is not sufficient.  Before sleeping, the buyer adds
+ * itself to the queue and then tries once more, so that a concurrent
+ * sell (which checks the number of waiters after updating the
+ * balance) cannot be missed.
+ *
+ * @note The caller must hold the stock's mutex via a StockLock.
+ *
+ * @param stock The stock on which the transaction is performed.
+ *
+ * @param lock The lock held on the stock's mutex.
+ *
+ * @param trades The quantity of stocks being bought.
+ *
+ * @param timeout The maximum duration to wait.  Zero means wait
+ * indefinitely.
+ *
+ * @return This method returns true if the stocks were bought and
+ * false if the wait timed out.
+ */
+bool buy(Stock& stock, std::unique_lock<std::mutex>& lock,
+         const unsigned trades, const std::chrono::milliseconds timeout) {
+    // Join the queue and check if the current balance suffices.
+    Stock::Waiter self(trades);
+    const auto entry = stock.waitQueue.insert(stock.waitQueue.end(), &self);
+    stock.waiters++;
+    grantWaiters(stock);
+    if (!self.granted) {
+        // Sleep until a seller hands off the stocks to this buyer.
+        // The time spent asleep does not count as holding the mutex.
+        const auto granted = [&self] { return self.granted; };
+        const uint64_t start = Metrics::now();
+        lockReleased(stock, start);
+        const bool done = (timeout.count() == 0) ?
+            (self.condVar.wait(lock, granted), true) :
+            self.condVar.wait_for(lock, timeout, granted);
+        stock.lockedAt = Metrics::now();
+        sm::metrics.add(Metrics::WaitNanos, stock.lockedAt - start);
+        sm::metrics.add(Metrics::Waits);
+        if (!done) {
+            // Timed out. Leave the queue without buying anything.
+            stock.waitQueue.erase(entry);
+            stock.waiters--;
+            return false;
+        }
+    }
+    // The response must wait for the record of the hand off.
+    sm::lastLsn = std::max(sm::lastLsn, self.lsn);
+    return true;
+}
+
+/**
+ * Helper method to apply a buy or sell to a stock whose mutex is
+ * already locked by the caller.  A buy that needs more than the
+ * available balance waits (temporarily releasing the lock) until
+ * sufficient stocks are available.
+ *
+ * @param stock The stock on which the transaction is performed.
+ *
+ * @param lock The lock held on the stock's mutex.
+ *
+ * @param trans The stock transaction to be initiated.  
+ * This string should either be "sell" (add) or "buy" (subtract).
+ *
+ * @param trades The quantity of stocks being bought or sold.
+ *
+ * @param timeout The maximum duration a buy may wait.  Zero means
+ * wait indefinitely.
+ *
+ * @return This method returns false if a buy timed out.
+ */
+bool applyTrade(Stock& stock, std::unique_lock<std::mutex>& lock,
+                const std::string_view trans, const unsigned trades,
+                const std::chrono::milliseconds timeout =
+                std::chrono::milliseconds(0)) {
+    if (trans == "sell") {
+        sell(stock, trades, true);
+        return true;
+    }
+    // Buy right away only if no buyers are waiting.  Otherwise join
+    // the queue, which is served first-fit (see grantWaiters).
+    if ((stock.waiters.load() == 0) && tryBuy(stock, trades)) {
+        return true;
+    }
+    return buy(stock, lock, trades, timeout);
+}
+
+/**
+ * This method updates the balance of available stocks.  Sells and buys
+ * for which the balance is sufficient are performed using atomic
+ * operations on the balance without locking the stock.  Only a buy that
+ * has to wait locks the stock and waits in the stock's queue of buyers.
  * The balance can never go below zero, so if the transaction is "buy" and
  * the required number of stocks isn't available, this method waits until it is.
  *
  * @param trans The stock transaction to be initiated.  
  * This string should either be "sell" (add) or "buy" (subtract).
  *
- * @param name The name of the stock where the transaction is initiated.
+ * @param stock The stock where the transaction is initiated.
  *
  * @param trades The quantity of stocks being bought or sold.
+ *
+ * @param timeout The maximum duration a buy may wait.  Zero means
+ * wait indefinitely.
  */
-std::string updateBalance(const std::string& trans, const std::string& name,
-                          const unsigned trades) {
-    Stock& stock = sm::stockMap.at(name);
-    // Lock the specified stock entry with a unique_lock
-    std::unique_lock<std::mutex> lock(stock.mutex);
+std::string updateBalance(const std::string_view trans, Stock& stock,
+                          const unsigned trades,
+                          const std::chrono::milliseconds timeout) {
     if (trans == "sell") {
-        // Add stocks to the balance
-        stock.balance += trades;
-        // Wake up any threads that are waiting to sell
-        stock.condVar.notify_one();
-    } else {
-        // We can only sell a number of stocks if we have that number of stocks
-        // Hence, we wait for that condition to be true using a lambda
-        stock.condVar.wait(lock,
-                [&stock, trades] {
-                    return stock.balance >= trades; });
-        // Now sufficient balance is guaranteed
-        assert(stock.balance >= trades);
-        stock.balance -= trades;
+        sell(stock, trades);
+    } else if ((stock.waiters.load() > 0) || !tryBuy(stock, trades)) {
+        // Slow path: Lock the specified stock entry and wait
+        StockLock lock(stock);
+        if (!applyTrade(stock, lock, trans, trades, timeout)) {
+            return "Timed out buying stock " + stock.name;
+        }
     }
 
     // Return the output message
-    return "Stock " + name + "'s balance updated";
+    return "Stock " + stock.name + "'s balance updated";
 }
 
 /**
@@ -144,30 +461,44 @@ std::string updateBalance(const std::string& trans, const std::string& name,
  * @param stock The name of the stock where the transaction will be initiated.
  *
  * @param trades The quantity of stocks being bought or sold.
+ *
+ * @param timeout The maximum number of milliseconds a buy may wait for
+ * a sufficient balance.  Zero means wait indefinitely.
  */
-std::string processTrans(const std::string& trans, const std::string& stock, 
-                         const unsigned trades = 0) {
+std::string processTrans(const std::string_view trans,
+                         const std::string_view stock,
+                         const unsigned trades = 0,
+                         const unsigned timeout = 0) {
     // The default output if the request isn't one of the designated 5
     std::string output = "Invalid request";
     if (trans == "reset") {
-        // Resets stockMap by clearing out all stocks
-        sm::stockMap.clear();
-        output = "Stocks reset";
-    } else if (trans == "create") { 
+        // Resets stockMap by swapping in an empty set of stocks.
+        // Requests still using the old set may log changes to it
+        // after this record.  The log ignores them on recovery.
+        const auto scope = logScope();
+        logChange(StockLog::Reset, sm::stockMap.reset(), "", 0);
+        return "Stocks reset";
+    }
+    // The rest of this request works with the current set of stocks
+    const StockTable::GenerationPtr stocks = sm::stockMap.current();
+    if (trans == "create") { 
         // Create account if it does not currently exist
-        output = createStock(stock, trades);
+        output = createStock(*stocks, stock, trades);
     } else {
-        // Check if stock exists
-        if (sm::stockMap.find(stock) == sm::stockMap.end()) {
+        // Check if stock exists. The symbol is resolved to its ID
+        // only once for this request.
+        const StockId id = stocks->lookup(stock);
+        if (id == StockTable::NoStock) {
             // If stock doesn't exist, display error
             output = "Stock not found";
         } else {
             // If stock exists, process buy or sell operations
             if ((trans == "buy") || (trans == "sell")) {
-                output = updateBalance(trans, stock, trades);
+                output = updateBalance(trans, stocks->at(id), trades,
+                                       std::chrono::milliseconds(timeout));
             } else if (trans == "status") {
                 // Get balance status
-                output = balanceStatus(stock);
+                output = balanceStatus(stocks->at(id));
             }
         }
     }
@@ -175,175 +506,960 @@ std::string processTrans(const std::string& trans, const std::string& stock,
     return output;
 }
 
+/**
+ * Helper method to apply the buys and sells of a batch on 1 stock as
+ * a single atomic change to its balance.  The balance needed up front
+ * (the deficit) is the most by which the buys ever exceed the sells
+ * before them.  If the balance suffices, the net change is applied via
+ * a compare-and-swap, so the operations never interleave with other
+ * trades (even lock-free ones).  Otherwise the deficit is reserved via
+ * the stock's queue of waiting buyers, for at most sm::BatchTimeout,
+ * and the rest is handed back right away.  Other trades may see the
+ * balance with the deficit reserved, but never the effect of only
+ * some of the operations.
+ *
+ * @note The caller must hold the stock's mutex via a StockLock.
+ *
+ * @param stock The stock on which the operations are performed.
+ *
+ * @param lock The lock held on the stock's mutex.
+ *
+ * @param deficit The balance needed to apply the operations in order.
+ *
+ * @param net The total sold minus the total bought.
+ *
+ * @param start Set to the balance just before the operations took
+ * effect, so that status operations in the batch can be answered.
+ *
+ * @return This method returns false if the wait timed out.  In this
+ * case the balance is unchanged.
+ */
+bool applyBatch(Stock& stock, std::unique_lock<std::mutex>& lock,
+                const int64_t deficit, const int64_t net, int64_t& start) {
+    // With buyers waiting, a deficit is reserved via the queue (like
+    // any other buy) rather than taken from the balance directly.
+    if ((deficit == 0) || (stock.waiters.load() == 0)) {
+        const auto scope = logScope();
+        unsigned int balance = stock.balance.load();
+        while (balance >= deficit) {
+            if (stock.balance.compare_exchange_weak(balance,
+                                                    unsigned(balance + net))) {
+                if (net != 0) {
+                    logChange(net < 0 ? StockLog::Buy : StockLog::Sell,
+                              stock.generation, stock.name,
+                              unsigned(net < 0 ? -net : net));
+                }
+                start = balance;
+                break;
+            }
+        }
+    }
+    if (start < 0) {
+        // Reserve the deficit once other trades have sold enough.
+        if (!buy(stock, lock, deficit, sm::BatchTimeout)) {
+            return false;
+        }
+        const auto scope = logScope();
+        start = stock.balance.fetch_add(unsigned(deficit + net)) + deficit;
+        if (deficit + net != 0) {
+            logChange(StockLog::Sell, stock.generation, stock.name,
+                      unsigned(deficit + net));
+        }
+    }
+    // Stocks handed back may satisfy buyers that are waiting.
+    grantWaiters(stock);
+    return true;
+}
+
+/**
+ * This method processes a batch of buy, sell, and status operations
+ * from a single request.  Operations are grouped by stock, and all
+ * the operations on a given stock are applied atomically, in the
+ * order they appear in the batch (see applyBatch): other trades never
+ * see the effect of only some of them, and the status operations
+ * report the balance as of their place in the batch.  If the balance
+ * does not allow the operations on a stock to be applied in order
+ * within sm::BatchTimeout, none of them are applied.  The batch is
+ * not atomic across stocks.
+ *
+ * @note MT-safe.
+ *
+ * @param ops A comma-separated list of operations, where each
+ * operation is in the form "trans:stock:amount", e.g.,
+ * "buy:0x01:5,sell:0x02:3,status:0x01".  The amount is ignored for
+ * status operations.
+ *
+ * @return The results of the operations (in the same order as the
+ * operations in the batch), one per line.
+ */
+std::string processBatch(std::string_view ops) {
+    // The information about each operation in the batch.  The
+    // strings refer to the parts of ops.
+    struct Op {
+        std::string_view trans, stock;
+        unsigned int amount = 0;
+        std::string result = "Invalid request";
+    };
+    std::vector<Op> opList;
+    // The indexes of operations in opList for each stock, with
+    // stocks in the order in which they first appear in the batch.
+    std::vector<std::pair<std::string_view, std::vector<size_t>>> groups;
+    std::unordered_map<std::string_view, size_t> groupIdx;
+
+    // Parse out the operations and group them by stock.
+    while (!ops.empty()) {
+        std::string_view op = ops.substr(0, ops.find(','));
+        ops.remove_prefix(std::min(op.size() + 1, ops.size()));
+        Op entry;
+        entry.trans = op.substr(0, op.find(':'));
+        op.remove_prefix(std::min(entry.trans.size() + 1, op.size()));
+        entry.stock = op.substr(0, op.find(':'));
+        op.remove_prefix(std::min(entry.stock.size() + 1, op.size()));
+        for (const char digit : op) {
+            if ((digit < '0') || (digit > '9')) {
+                break;
+            }
+            entry.amount = entry.amount * 10 + (digit - '0');
+        }
+        if (groupIdx.find(entry.stock) == groupIdx.end()) {
+            groupIdx[entry.stock] = groups.size();
+            groups.push_back({entry.stock, {}});
+        }
+        groups[groupIdx[entry.stock]].second.push_back(opList.size());
+        opList.push_back(entry);
+    }
+
+    // Apply all the operations on each stock at once under its lock.
+    const StockTable::GenerationPtr stocks = sm::stockMap.current();
+    for (const auto& group : groups) {
+        const StockId id = stocks->lookup(group.first);
+        if (id == StockTable::NoStock) {
+            for (const size_t i : group.second) {
+                opList[i].result = "Stock not found";
+            }
+            continue;
+        }
+        // Find the balance needed and the net change up front.
+        int64_t change = 0, deficit = 0;
+        for (const size_t i : group.second) {
+            const Op& op = opList[i];
+            change += (op.trans == "sell" ? int64_t(op.amount) :
+                       op.trans == "buy" ? -int64_t(op.amount) : 0);
+            deficit = std::max(deficit, -change);
+        }
+        Stock& stock = stocks->at(id);
+        StockLock lock(stock);
+        int64_t balance = -1;
+        if (!applyBatch(stock, lock, deficit, change, balance)) {
+            for (const size_t i : group.second) {
+                opList[i].result = "Timed out buying stock " + stock.name;
+            }
+            continue;
+        }
+        // Report the results as of each operation's place in the batch.
+        for (const size_t i : group.second) {
+            Op& op = opList[i];
+            if ((op.trans == "buy") || (op.trans == "sell")) {
+                balance += (op.trans == "sell" ? int64_t(op.amount) :
+                            -int64_t(op.amount));
+                op.result = "Stock " + stock.name + "'s balance updated";
+            } else if (op.trans == "status") {
+                op.result = "Balance for stock " + stock.name + " = " +
+                    std::to_string(balance);
+            }
+        }
+    }
+
+    // Return the results of the operations in the original order.
+    std::string output;
+    for (const auto& op : opList) {
+        output += (output.empty() ? "" : "\n") + op.result;
+    }
+    return output;
+}
+
 /** This method uses code copied from Homework 1 to send a 
- * fixed HTTP 200 OK response back to the client.
+ * HTTP response (200 OK by default) back to the client.
  *
  * @param os The output stream.
  * 
  * @param output The message sent to the client.
+ *
+ * @param keepAlive If true, the response tells the client that the
+ * connection will be kept open for further requests.
+ *
+ * @param status The HTTP status code and reason phrase.
 */
-void sendResponse(std::ostream& os, const std::string& output) {
+void sendResponse(std::ostream& os, const std::string& output,
+                  const bool keepAlive = false,
+                  const std::string& status = "200 OK") {
     // Sends a fixed output message back to the client
     // In this case, the message is the output of processTrans
-    os << "HTTP/1.1 200 OK\r\n"
+    os << "HTTP/1.1 " << status << "\r\n"
        << "Server: StockServer\r\n"
        << "Content-Length: " << output.size() << "\r\n"
-       << "Connection: Close\r\n"
+       << (keepAlive ? "Connection: keep-alive\r\n" : "Connection: Close\r\n")
        << "Content-Type: text/plain\r\n\r\n"
        << output;
 }
 
 /**
- * This method is called from a separate detached/background thread
- * from the runServer() method.  This method processes 1 transaction
- * from a client.  This method extracts the transaction information
- * and processes the transaction by calling the processTrans helper
- * method.
+ * Helper method to find the counter for a given type of transaction.
+ *
+ * @param trans The transaction, e.g., "buy".
+ *
+ * @return The counter for the number of requests of that type.
+ */
+Metrics::Counter transCounter(const std::string_view trans) {
+    if (trans == "buy")    return Metrics::Buy;
+    if (trans == "sell")   return Metrics::Sell;
+    if (trans == "status") return Metrics::Status;
+    if (trans == "create") return Metrics::Create;
+    if (trans == "reset")  return Metrics::Reset;
+    if (trans == "batch")  return Metrics::Batch;
+    return Metrics::Invalid;
+}
+
+/**
+ * This method generates the report served at the /metrics URL in the
+ * plain text format used by Prometheus.  The report includes the
+ * number of requests for each type of transaction, the time buyers
+ * spent blocked, the time the stocks' mutexes were held (overall and
+ * for the stocks with the longest hold times), the number of
+ * connections waiting in the queue, and the number of threads and
+ * active connections.
+ *
+ * @note MT-safe.  The counters are read without stopping the
+ * updates, so the values are only approximately consistent.
+ *
+ * @return The metrics report.
+ */
+std::string metricsReport() {
+    std::ostringstream os;
+    const char* const Names[] = {"reset", "create", "buy", "sell",
+                                 "status", "batch", "metrics", "invalid"};
+    os << "# TYPE stock_requests_total counter\n";
+    for (int i = Metrics::Reset; (i <= Metrics::Invalid); i++) {
+        os << "stock_requests_total{trans=\"" << Names[i] << "\"} "
+           << sm::metrics.get(Metrics::Counter(i)) << '\n';
+    }
+    os << "# TYPE stock_buy_wait_seconds_total counter\n"
+       << "stock_buy_wait_seconds_total "
+       << sm::metrics.get(Metrics::WaitNanos) / 1e9 << '\n'
+       << "# TYPE stock_buy_waits_total counter\n"
+       << "stock_buy_waits_total " << sm::metrics.get(Metrics::Waits) << '\n'
+       << "# TYPE stock_lock_hold_seconds_total counter\n"
+       << "stock_lock_hold_seconds_total "
+       << sm::metrics.get(Metrics::LockNanos) / 1e9 << '\n'
+       << "# TYPE stock_lock_holds_total counter\n"
+       << "stock_lock_holds_total " << sm::metrics.get(Metrics::Locks) << '\n';
+
+    // Find the stocks that held their locks for the longest time.
+    std::vector<std::pair<uint64_t, const Stock*>> held;
+    sm::stockMap.current()->forEach([&held](const Stock& stock) {
+            const uint64_t nanos = stock.lockNanos.load();
+            if (nanos > 0) {
+                held.push_back({nanos, &stock});
+            }
+        });
+    const size_t top = std::min(held.size(), sm::MetricsTopStocks);
+    std::partial_sort(held.begin(), held.begin() + top, held.end(),
+                      std::greater<>());
+    os << "# TYPE stock_lock_hold_seconds counter\n";
+    for (size_t i = 0; (i < top); i++) {
+        os << "stock_lock_hold_seconds{stock=\"" << held[i].second->name
+           << "\"} " << held[i].first / 1e9 << '\n';
+    }
+    os << "# TYPE stock_lock_holds counter\n";
+    for (size_t i = 0; (i < top); i++) {
+        os << "stock_lock_holds{stock=\"" << held[i].second->name
+           << "\"} " << held[i].second->lockCount.load() << '\n';
+    }
+
+    os << "# TYPE stock_queue_depth gauge\n"
+       << "stock_queue_depth "
+       << (sm::connQueue != nullptr ? sm::connQueue->size() : 0) << '\n'
+       << "# TYPE stock_threads gauge\n"
+       << "stock_threads " << sm::poolThreads + sm::tempThreads.load() << '\n'
+       << "# TYPE stock_active_connections gauge\n"
+       << "stock_active_connections " << sm::activeConns.load() << '\n';
+    return os.str();
+}
+
+/**
+ * Helper method to ensure that the changes made by the current request
+ * are durable before its response is sent.  Concurrent requests share
+ * the fsync.  The asynchronous engine uses StockLog::whenDurable
+ * instead, so that its threads never wait for the disk.
+ *
+ * @return This method returns false if the changes could not be
+ * made durable, in which case sm::NotDurable must be sent instead
+ * of the result of the request.
+ */
+bool waitDurable() {
+    return (sm::stockLog == nullptr) ||
+        sm::stockLog->waitDurable(sm::lastLsn);
+}
+
+/**
+ * This method processes the transaction in a parsed HTTP GET request
+ * by calling the processTrans (or processBatch) helper method.  This
+ * method is shared by the thread-pool and the asynchronous engines.
+ *
+ * @note MT-safe.
+ *
+ * \param[in] req The request parsed from a path such as
+ * "/trans=buy&stock=0x01&amount=5", or "/metrics" for a report of
+ * the server's metrics.  A buy may optionally include a
+ * timeout in milliseconds, e.g., "&timeout=500", after the amount.
+ *
+ * \return The result of processTrans to be sent to the client once
+ * the changes made by the request are durable (see waitDurable).
+ */
+std::string processRequest(const RequestParser& req) {
+    // Metrics are reported without going through processTrans.
+    if (req.path == "/metrics") {
+        sm::metrics.add(Metrics::Report);
+        return metricsReport();
+    }
+    sm::metrics.add(transCounter(req.trans));
+    // Process a batch of operations ("trans=batch&ops=...")
+    const std::string result = ((req.trans == "batch") && (req.key == "ops")) ?
+        processBatch(req.stock) :
+        processTrans(req.trans, req.stock, req.amount, req.timeout);
+    return result;
+}
+
+/**
+ * This method is called from one of the worker threads started by the
+ * runServer() method.  This method processes transactions from a
+ * client until the client closes the connection.  Requests may be
+ * pipelined -- that is, the client may send further requests without
+ * waiting for responses.  Responses are flushed only once all the
+ * requests buffered so far have been processed.  The connection is
+ * closed if it stays idle for sm::IdleTimeout or after
+ * sm::MaxRequestsPerConn requests.
  * 
- * \param[in] is The input stream from where the HTTP request is to be
- * read and processed.
+ * \param[in,out] client The I/O stream to the client from where HTTP
+ * requests are read and to where HTTP responses are written.
+ */
+void clientThread(tcp::iostream& client) {
+    // The request headers are read straight into the parser's buffer.
+    RequestParser req;
+    // Responses are small, so don't let Nagle's algorithm hold them
+    // back on a persistent connection.
+    client.rdbuf()->set_option(tcp::no_delay(true));
+    sm::activeConns++;
+    for (int count = 1; (count <= sm::MaxRequestsPerConn); count++) {
+        // Read the HTTP request from the client, but wait only so long.
+        client.expires_after(sm::IdleTimeout);
+        if (!req.read(client)) {
+            break;
+        }
+        // A buy may wait for a long time. So don't time it out.
+        client.expires_at(std::chrono::steady_clock::time_point::max());
+        const bool keepAlive = req.keepAlive &&
+            (count < sm::MaxRequestsPerConn);
+        // Process the transaction in an MT-safe method and send the
+        // result back to the client.
+        sm::lastLsn = 0;
+        const std::string result = processRequest(req);
+        if (waitDurable()) {
+            sendResponse(client, result, keepAlive);
+        } else {
+            sendResponse(client, sm::NotDurable, keepAlive,
+                         sm::NotDurableStatus);
+        }
+        if (!keepAlive) {
+            break;
+        }
+        // Batch up responses to pipelined requests.
+        if (client.rdbuf()->in_avail() == 0) {
+            client.flush();
+        }
+    }
+    sm::activeConns--;
+}
+
+/**
+ * The condition used by the asynchronous engine to find the end of a
+ * request head in a socket's buffer.  It follows the same rule as
+ * RequestParser::read: the head ends at the first blank line ("\n"
+ * or "\r\n") after the request line.
+ */
+struct EndOfHead {
+    /** The type of the iterators into the socket's buffer. */
+    using Iterator = buffers_iterator<boost::asio::streambuf::
+                                      const_buffers_type>;
+    /** The result type that is required by read_until. */
+    using result_type = std::pair<Iterator, bool>;
+
+    /** Search the data read so far for the end of the head.
+
+        \param[in] begin Where the search starts.  This is either the
+        start of the head or the start of a complete line that was
+        returned by an earlier call.
+
+        \param[in] end The end of the data read so far.
+
+        \return The position just after the blank line and true if
+        the head is complete.  Otherwise, the start of the last
+        complete line (so that the next search resumes there) and
+        false.
+    */
+    result_type operator()(Iterator begin, const Iterator end) const {
+        Iterator lineStart = begin, resume = begin;
+        for (Iterator i = begin; i != end; i++) {
+            if (*i != '\n') {
+                continue;
+            }
+            const auto lineLen = (i - lineStart) + 1;
+            const bool blank = (lineLen == 1) ||
+                ((lineLen == 2) && (*lineStart == '\r'));
+            if (blank && (lineStart != begin)) {
+                return {i + 1, true};
+            }
+            resume = lineStart;
+            lineStart = i + 1;
+        }
+        return {resume, false};
+    }
+};
+
+namespace boost {
+namespace asio {
+/** Let read_until know that EndOfHead is a match condition. */
+template <>
+struct is_match_condition<EndOfHead> : public std::true_type {};
+}  // namespace asio
+}  // namespace boost
+
+/**
+ * A connection to a client that is processed by the asynchronous
+ * (event-driven) engine.  Instead of dedicating a thread to each
+ * connection, all I/O is scheduled on the shared io_service and the
+ * handlers run on a small set of reactor threads.  Each session keeps
+ * itself alive (via shared_from_this) for as long as an operation is
+ * pending on its socket.  The handlers of a session run on a strand
+ * so that the idle timer never races with the socket operations.
+ * A buy that has to wait for a sufficient balance does not block a
+ * reactor thread: it is parked in the stock's queue of waiting buyers
+ * and the session resumes (on its strand) once a seller grants the
+ * stocks or the buy's timeout expires.  A batch, whose operations may
+ * wait for up to sm::BatchTimeout per stock, is processed on
+ * sm::batchPool instead of a reactor thread for the same reason.
+ */
+class AsyncSession : public std::enable_shared_from_this<AsyncSession> {
+public:
+    /** The constructor that takes ownership of an accepted socket.
+
+        \param[in] socket The socket connected to the client.
+    */
+    explicit AsyncSession(tcp::socket socket) :
+        socket(std::move(socket)), ioStrand(this->socket.get_executor()),
+        timer(this->socket.get_executor()),
+        buffer(RequestParser::MaxHead), count(0) {
+        sm::activeConns++;
+    }
+
+    /** The destructor called once the connection is no longer used. */
+    ~AsyncSession() {
+        sm::activeConns--;
+    }
+
+    /** Start reading the next request from the client.  Pipelined
+        requests that are already in the buffer are processed without
+        waiting on the socket. */
+    void start() {
+        auto self = shared_from_this();
+        // Close the connection if the client stays idle for too long.
+        timer.expires_after(sm::IdleTimeout);
+        timer.async_wait(bind_executor(ioStrand,
+                [self](const boost::system::error_code& ec) {
+                    if (!ec) {
+                        boost::system::error_code ignored;
+                        self->socket.close(ignored);
+                    }
+                }));
+        async_read_until(socket, buffer, EndOfHead(),
+                         bind_executor(ioStrand,
+                                 [self](const boost::system::error_code& ec,
+                                        size_t size) {
+                                     self->timer.cancel();
+                                     self->onRequest(ec, size);
+                                 }));
+    }
+
+private:
+    /** Handler called once the request line and all the headers
+        have been read.  This method processes the transaction and
+        sends the response back to the client.
+
+        \param[in] ec The error code (if any) from the read.
+
+        \param[in] size The size of the request line and the headers
+        (including the blank line) at the front of the buffer.
+    */
+    void onRequest(const boost::system::error_code& ec, const size_t size) {
+        // The handlers of many sessions run on the same reactor
+        // thread, but only 1 at a time.  So they can share a parser.
+        thread_local RequestParser req;
+        if (ec) {
+            return;  // Client went away. Nothing further to do.
+        }
+        // Parse the request in place in the buffer and then drop it.
+        // Bytes of pipelined requests (if any) that follow the
+        // headers are left in the buffer.
+        const bool valid = req.parse(std::string_view(
+                static_cast<const char*>(buffer.data().data()), size));
+        buffer.consume(size);
+        if (!valid) {
+            return;
+        }
+        keepAlive = req.keepAlive && (++count < sm::MaxRequestsPerConn);
+        sm::lastLsn = 0;
+        // Process the transaction.  A buy or batch is handled here so
+        // that it can wait without blocking this thread.
+        if ((req.trans == "buy") && (req.path != "/metrics")) {
+            sm::metrics.add(transCounter(req.trans));
+            startBuy(req.stock, req.amount, req.timeout);
+        } else if ((req.trans == "batch") && (req.key == "ops") &&
+                   (req.path != "/metrics")) {
+            sm::metrics.add(transCounter(req.trans));
+            startBatch(std::string(req.stock));
+        } else {
+            respond(processRequest(req));
+        }
+    }
+
+    /** Process a batch on sm::batchPool, where it may wait for a
+        sufficient balance, and send the response back on this
+        session's strand once it is done.
+
+        \param[in] ops The operations in the batch.  They are copied
+        because the parser is reused by this thread in the meantime.
+    */
+    void startBatch(std::string ops) {
+        auto self = shared_from_this();
+        post(*sm::batchPool, [self, ops = std::move(ops)] {
+                sm::lastLsn = 0;
+                const std::string result = processBatch(ops);
+                // The response must wait for the records of the batch,
+                // which were appended by this (pool) thread.
+                const uint64_t lsn = sm::lastLsn;
+                post(self->ioStrand, [self, result, lsn] {
+                        sm::lastLsn = lsn;
+                        self->respond(result); });
+            });
+    }
+
+    /** Buy stocks, parking the buy in the stock's wait queue (instead
+        of blocking) if the balance is not sufficient.  The response is
+        sent once the buy is done or times out.
+
+        \param[in] name The name of the stock to be bought.
+
+        \param[in] trades The quantity of stocks being bought.
+
+        \param[in] timeout The maximum number of milliseconds the buy
+        may wait.  Zero means wait indefinitely.
+    */
+    void startBuy(const std::string_view name, const unsigned trades,
+                  const unsigned timeout) {
+        const StockTable::GenerationPtr stocks = sm::stockMap.current();
+        const StockId id = stocks->lookup(name);
+        if (id == StockTable::NoStock) {
+            respond("Stock not found");
+            return;
+        }
+        Stock& stock = stocks->at(id);
+        // Buy right away only if no buyers are waiting (as
+        // applyTrade does).
+        if ((stock.waiters.load() == 0) && tryBuy(stock, trades)) {
+            respond("Stock " + stock.name + "'s balance updated");
+            return;
+        }
+        // Join the queue (as buy() does) and check if the current
+        // balance suffices.  The generation is held so that the stock
+        // stays valid while the buy is parked.
+        parkedStocks = stocks;
+        parkedStock = &stock;
+        waiter = std::make_unique<Stock::Waiter>(trades);
+        {
+            StockLock lock(stock);
+            stock.waitQueue.push_back(waiter.get());
+            waiterEntry = std::prev(stock.waitQueue.end());
+            stock.waiters++;
+            grantWaiters(stock);
+            if (!waiter->granted) {
+                // Resume on this session's strand once a seller grants
+                // the stocks (or the timeout expires).
+                auto self = shared_from_this();
+                waiter->onGrant = [self] {
+                    post(self->ioStrand, [self] { self->onBuyDone(); }); };
+                parkedAt = Metrics::now();
+                if (timeout > 0) {
+                    timer.expires_after(std::chrono::milliseconds(timeout));
+                    timer.async_wait(bind_executor(ioStrand,
+                            [self](const boost::system::error_code& ec) {
+                                if (!ec) {
+                                    self->onBuyTimeout();
+                                }
+                            }));
+                }
+                return;
+            }
+        }
+        onBuyDone();  // The current balance sufficed.
+    }
+
+    /** Handler called once the stocks of a parked buy have been
+        granted.  It sends the response to the buy. */
+    void onBuyDone() {
+        timer.cancel();
+        if (parkedAt != 0) {
+            sm::metrics.add(Metrics::WaitNanos, Metrics::now() - parkedAt);
+            sm::metrics.add(Metrics::Waits);
+        }
+        // The response must wait for the record of the hand off.
+        sm::lastLsn = waiter->lsn;
+        const std::string result = "Stock " + parkedStock->name +
+            "'s balance updated";
+        unpark();
+        respond(result);
+    }
+
+    /** Handler called when the timeout of a parked buy expires.  The
+        buy leaves the stock's wait queue without buying anything,
+        unless the stocks were granted in the meantime (in which case
+        onBuyDone has been posted and sends the response). */
+    void onBuyTimeout() {
+        if (waiter == nullptr) {
+            return;  // The buy is already done.
+        }
+        {
+            StockLock lock(*parkedStock);
+            if (waiter->granted) {
+                return;
+            }
+            parkedStock->waitQueue.erase(waiterEntry);
+            parkedStock->waiters--;
+        }
+        sm::metrics.add(Metrics::WaitNanos, Metrics::now() - parkedAt);
+        sm::metrics.add(Metrics::Waits);
+        const std::string result = "Timed out buying stock " +
+            parkedStock->name;
+        unpark();
+        respond(result);
+    }
+
+    /** Release the state of a parked buy.  This also breaks the cycle
+        between this session and the waiter's onGrant. */
+    void unpark() {
+        waiter.reset();
+        parkedStock = nullptr;
+        parkedStocks.reset();
+        parkedAt = 0;
+    }
+
+    /** Format the response to the current request and send it once
+        the changes made by the request are durable.  The log is synced
+        by StockLog's background thread, so this thread does not wait.
+        If the changes could not be made durable, sm::NotDurable is
+        sent instead.
+
+        \param[in] result The result of the transaction.
+    */
+    void respond(const std::string& result) {
+        std::ostringstream os;
+        sendResponse(os, result, keepAlive);
+        response = os.str();
+        if (sm::stockLog == nullptr) {
+            send();
+            return;
+        }
+        auto self = shared_from_this();
+        sm::stockLog->whenDurable(sm::lastLsn, [self](const bool durable) {
+                post(self->ioStrand, [self, durable] {
+                        if (!durable) {
+                            std::ostringstream os;
+                            sendResponse(os, sm::NotDurable, self->keepAlive,
+                                         sm::NotDurableStatus);
+                            self->response = os.str();
+                        }
+                        self->send(); }); });
+    }
+
+    /** Send the response to the current request and then read the
+        next request or close the connection. */
+    void send() {
+        auto self = shared_from_this();
+        async_write(socket, boost::asio::buffer(response),
+                    bind_executor(ioStrand,
+                            [self](const boost::system::error_code& ec,
+                                   size_t) {
+                                if (!ec && self->keepAlive) {
+                                    self->start();
+                                } else {
+                                    boost::system::error_code ignored;
+                                    self->socket.shutdown(
+                                        tcp::socket::shutdown_both, ignored);
+                                }
+                            }));
+    }
+
+    // The socket connected to the client.
+    tcp::socket socket;
+    // The strand on which all the handlers of this session run.
+    strand<tcp::socket::executor_type> ioStrand;
+    // The timer used to close idle connections.
+    steady_timer timer;
+    // The buffer into which requests are read.  Like the pool
+    // engine, a request head longer than RequestParser::MaxHead is
+    // not accepted.
+    boost::asio::streambuf buffer;
+    // The response being sent. It must stay valid until the write is
+    // done.
+    std::string response;
+    // The number of requests processed on this connection so far.
+    int count;
+    // True if the connection is kept open after the current response.
+    bool keepAlive = false;
+    // The state of a buy that is parked waiting for a sufficient
+    // balance: the waiter in the stock's queue (and its position),
+    // the stock and its generation, and when the buy was parked.
+    std::unique_ptr<Stock::Waiter> waiter;
+    std::list<Stock::Waiter*>::iterator waiterEntry;
+    Stock* parkedStock = nullptr;
+    StockTable::GenerationPtr parkedStocks;
+    uint64_t parkedAt = 0;
+};
+
+/**
+ * Helper method to schedule an asynchronous accept on the server
+ * socket.  Each accepted connection is handed off to a new
+ * AsyncSession and another accept is scheduled.
  *
- * \param[out] os The output stream to where the HTTP response is to
- * be written.
+ * \param[in] server The acceptor on which connections are accepted.
  */
-void clientThread(std::istream& is, std::ostream& os) {
-    // Read the HTTP request from the client, process it, and send an
-    // HTTP response back to the client.
-    std::string dummy, request;
-    is >> dummy >> request;
-    
-    while (std::getline(is, dummy), dummy != "\r") {}
-    // Decode the request using the url_decode method
-    request = url_decode(request); 
-    // Replace '&' and '=' characters in the request to make it
-    // easier to parse out the data
-    std::replace(request.begin(), request.end(), '&', ' ');
-    std::replace(request.begin(), request.end(), '=', ' ');
-    // Create a string input stream to read words out
-    std::string trans, stock;
-    unsigned int amount = 0;
-    std::istringstream(request) >> dummy >> trans >> dummy >> stock 
-                                >> dummy >> amount;
-    // Process the transaction in an MT-safe method
-    const std::string result = processTrans(trans, stock, amount);
-    
-    // Homework 9 Code --------------------------------------------------------
-    // Decrement thread count
-    sm::threadCount--;
-    // Wake server thread if it's asleep
-    sm::threadStatus.notify_one();
-    // ------------------------------------------------------------------------
-
-    // Send result back to the client
-    sendResponse(os, result); 
+void asyncAccept(tcp::acceptor& server) {
+    server.async_accept([&server](const boost::system::error_code& ec,
+                                  tcp::socket socket) {
+        if (!ec) {
+            socket.set_option(tcp::no_delay(true));
+            std::make_shared<AsyncSession>(std::move(socket))->start();
+        }
+        asyncAccept(server);  // Accept the next connection.
+    });
+}
+
+/**
+ * Top-level method to run the stock server using the asynchronous
+ * engine.  Connections cost only a socket (and a small buffer) as
+ * they are multiplexed over a fixed number of reactor threads that
+ * run the io_service.
+ *
+ * \param[in] server The boost::tcp::acceptor object to be used to
+ * accept connections from various clients.
+ *
+ * \param[in] service The io_service associated with the acceptor.
+ *
+ * \param[in] numThreads The number of reactor threads (and of threads
+ * that process batches) to use.  The calling thread is one of the
+ * reactor threads.
+ */
+void runAsyncServer(tcp::acceptor& server, io_service& service,
+                    const int numThreads) {
+    sm::poolThreads = numThreads;
+    // Batches get as many threads as the reactor.
+    boost::asio::thread_pool batches(numThreads);
+    sm::batchPool = &batches;
+    asyncAccept(server);
+    // Start the additional reactor threads...
+    std::vector<std::thread> reactors;
+    for (int i = 1; (i < numThreads); i++) {
+        reactors.push_back(std::thread([&service] { service.run(); }));
+    }
+    // ...and the calling thread is also a reactor thread.
+    service.run();
+    for (auto& thr : reactors) {
+        thr.join();
+    }
+}
+
+/**
+ * Send a fixed HTTP 503 response to a client that could not be
+ * queued for processing because the server is overloaded.
+ *
+ * @param os The output stream to the client.
+ */
+void sendBusyResponse(std::ostream& os) {
+    const std::string msg = "Server busy";
+    os << "HTTP/1.1 503 Service Unavailable\r\n"
+       << "Server: StockServer\r\n"
+       << "Content-Length: " << msg.size() << "\r\n"
+       << "Retry-After: 1\r\n"
+       << "Connection: Close\r\n"
+       << "Content-Type: text/plain\r\n\r\n"
+       << msg << std::flush;
+}
+
+/**
+ * The top-level method for each long-lived worker thread in the
+ * pool.  Each worker repeatedly removes the next connection from the
+ * queue and processes it via clientThread().
+ *
+ * @param queue The queue of accepted connections shared by all the
+ * workers.
+ */
+void workerThread(BoundedQueue<TcpStreamPtr>& queue) {
+    while (true) {
+        TcpStreamPtr client = queue.pop();
+        clientThread(*client);
+    }
+}
+
+/**
+ * The top-level method for a temporary worker created by the
+ * Overflow::Grow policy.  The worker processes the connection that
+ * overflowed, helps drain the backlog, and exits once the queue is
+ * empty.
+ *
+ * @param client The connection that did not fit in the queue.
+ *
+ * @param queue The queue of accepted connections shared by all the
+ * workers.
+ */
+void tempWorkerThread(TcpStreamPtr client, BoundedQueue<TcpStreamPtr>& queue) {
+    do {
+        clientThread(*client);
+        client.reset();  // Close the connection before blocking again
+    } while (queue.tryPop(client));
+    sm::tempThreads--;
 }
 
 /**
  * Top-level method to run a custom HTTP server to process stock trade
  * requests. 
  *
- * Phase 1: Multithreading is not needed.
- *
- * Phase 2: This method must use multiple threads -- each request
- * should be processed using a separate detached thread. Optional
- * feature: Limit number of detached-threads to be <= maxThreads.
+ * The server uses a fixed pool of maxThreads long-lived worker
+ * threads.  The acceptor thread (the caller) only accepts
+ * connections and adds them to a bounded queue from where the workers
+ * pick them up.  When the queue is full, the policy parameter decides
+ * how the excess connection is handled.
  *
  * \param[in] server The boost::tcp::acceptor object to be used to accept
  * connections from various clients.
  *
- * \param[in] maxThreads The maximum number of threads that the server
- * should use at any given time.
+ * \param[in] maxThreads The number of worker threads that the server
+ * should use to process requests.
+ *
+ * \param[in] policy What to do with a connection when the queue of
+ * pending connections is full.
  */
-void runServer(tcp::acceptor& server, const int maxThreads) {
+void runServer(tcp::acceptor& server, const int maxThreads,
+               const Overflow policy = Overflow::Block) {
+    // The queue of connections that are waiting for a worker. The
+    // detached workers refer to it, which is safe because this
+    // method never returns.
+    BoundedQueue<TcpStreamPtr> queue(maxThreads * sm::QueueFactor);
+    sm::connQueue   = &queue;
+    sm::poolThreads = maxThreads;
+
+    // Start the fixed pool of long-lived worker threads.
+    for (int i = 0; (i < maxThreads); i++) {
+        std::thread(workerThread, std::ref(queue)).detach();
+    }
+
     // Process client connections one-by-one...forever
     while (true) {
         // Creates garbage-collected connection on heap 
         TcpStreamPtr client = std::make_shared<tcp::iostream>();
         server.accept(*client->rdbuf());  // wait for client to connect
-        // Now we have a I/O stream to talk to the client. Have a
-        // conversation using the protocol.
-        
-        // Homework 9 Code ----------------------------------------------------
-        // This critical section ensures that maxThread will not be exceeded 
-        // before we create any threads
-        {  // !Begin critical section!
-            std::mutex mutex;
-            std::unique_lock<std::mutex> lock(mutex);
-            // Lambda that waits until threadCount is less than maxThreads
-            sm::threadStatus.wait(lock, [maxThreads] {
-                return sm::threadCount < maxThreads; }); 
-            // Increment threadCount
-            sm::threadCount++;        
-        }  // !End critical section!
-        // --------------------------------------------------------------------
-        
-        std::thread thr([client]{ clientThread(*client, *client); });
-        thr.detach();  // Process transaction independently
+        // Hand off the connection to a worker. The common case is
+        // that there is room in the queue.
+        if (queue.tryPush(client)) {
+            continue;
+        }
+        // The queue is full. Handle the overflow as per the policy.
+        if (policy == Overflow::Shed) {
+            sendBusyResponse(*client);
+        } else if ((policy == Overflow::Grow) &&
+                   (sm::tempThreads++ < maxThreads)) {
+            // Grow the pool by at most maxThreads temporary workers
+            std::thread(tempWorkerThread, client, std::ref(queue)).detach();
+        } else {
+            if (policy == Overflow::Grow) {
+                sm::tempThreads--;  // Undo increment from check above
+            }
+            queue.push(client);  // Wait for a worker to free up a slot
+        }
     }
 }
 
-// End of source code
-
-// Note -----------------------------------------------------------------------
-// The main.cpp file didn't seem to be included with the CODE source files and
-// this program was breaking because of that, so I just copied 
-// the necessary code here.
-// Was that file intentionally excluded? Hopefully this addition isn't
-// an issue.
-// ----------------------------------------------------------------------------
-
-/** Convenience method to decode HTML/URL encoded strings.
- *
- * This method must be used to decode query string parameters supplied
- * along with GET request.  This method converts URL encoded entities
- * in the from %nn (where 'n' is a hexadecimal digit) to corresponding
- * ASCII characters.
+/**
+ * Convert the name of an overflow policy specified as a command-line
+ * argument to the corresponding enumeration value.
  *
- * \param[in] str The string to be decoded.  If the string does not
- * have any URL encoded characters then this original string is
- * returned.  So it is always safe to call this method!
+ * \param[in] name The name of the policy.  This value must be one of
+ * "block", "shed", or "grow".
  *
- * \return The decoded string.
-*/
-std::string url_decode(std::string str) {
-    // Decode entities in the from "%xx"
-    size_t pos = 0;
-    while ((pos = str.find_first_of("%+", pos)) != std::string::npos) {
-        switch (str.at(pos)) {
-            case '+': str.replace(pos, 1, " ");
-            break;
-            case '%': {
-                std::string hex = str.substr(pos + 1, 2);
-                char ascii = std::stoi(hex, nullptr, 16);
-                str.replace(pos, 3, 1, ascii);
-            }
-        }
-        pos++;
+ * \return The overflow policy corresponding to the given name.
+ */
+Overflow toOverflow(const std::string& name) {
+    if (name == "shed") {
+        return Overflow::Shed;
+    } else if (name == "grow") {
+        return Overflow::Grow;
+    } else if (name != "block") {
+        throw std::invalid_argument("Invalid overflow policy: " + name);
     }
-    return str;
+    return Overflow::Block;
 }
 
+// End of source code
+
 // Helper method for testing.
 void checkRunClient(const std::string& port, const bool printResp = false);
 
+// The benchmarks (see ../benchmarks) link this file without main().
+#ifndef BENCHMARK
+
 /*
  * The main method that performs the basic task of accepting
  * connections from the user and processing each request using
  * multiple threads.
  *
- * \param[in] argc This program accepts up to 2 optional command-line
- * arguments (both are optional)
+ * \param[in] argc This program accepts up to 4 optional command-line
+ * arguments (all are optional)
  *
  * \param[in] argv The actual command-line arguments that are
  * interpreted as:
  *    1. First one is a port number (default is zero)
  *    2. The maximum number of threads to use (default is 20).
+ *    3. The engine to use: "async" for the asynchronous engine, or the
+ *       overflow policy for the thread-pool engine: "block"
+ *       (default), "shed", or "grow".  With the asynchronous engine,
+ *       the number of threads is the number of reactor threads.
+ *    4. A directory where stocks are durably stored.  If specified,
+ *       the stocks are recovered from this directory on startup and
+ *       all changes are logged.  By default nothing is stored.
  */
 int main(int argc, char** argv) {
     // Setup the port number for use by the server
     const int port   = (argc > 1 ? std::stoi(argv[1]) : 0);
-    // Setup the maximum number of threads to be used.
-    const int maxThr = (argc > 2 ? std::stoi(argv[2]) : 20);
+    // Setup the maximum number of threads to be used.  At least 1
+    // worker (or reactor) thread is needed to process connections.
+    const int maxThr = std::max(1, (argc > 2 ? std::stoi(argv[2]) : 20));
+    // Setup the engine (or policy to use when all workers are busy).
+    const std::string mode = (argc > 3 ? argv[3] : "block");
+
+    // Recover stocks and start logging changes, if requested.
+    if (argc > 4) {
+        sm::stockLog = new StockLog(argv[4], sm::stockMap);
+        sm::stockLog->startSnapshots(sm::SnapshotInterval,
+                                     sm::SnapshotRecords);
+    }
 
     // Create end point.  If port is zero a random port will be set
     io_service service;    
@@ -359,10 +1475,16 @@ int main(int argc, char** argv) {
 #endif
 
     // Run the server on the specified acceptor
-    runServer(server, maxThr);
+    if (mode == "async") {
+        runAsyncServer(server, service, maxThr);
+    } else {
+        runServer(server, maxThr, toOverflow(mode));
+    }
     
     // All done.
     return 0;
 }
 
+#endif  // BENCHMARK
+
 // End of Homework 8 main.cpp source code